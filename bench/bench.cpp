@@ -0,0 +1,279 @@
+#include "debugger.h"
+#include "json.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+using tinydbg::Debugger;
+
+uint64_t now()
+{
+    const auto time = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+
+// time of f in ns
+template <typename F>
+uint64_t measure(F&& f)
+{
+    const auto start = now();
+    f();
+    return now() - start;
+}
+
+// results as one JSON document, latencies as percentiles in ns
+class Report {
+public:
+    explicit Report(int fd)
+        : writer{fd}
+    {
+        writer.beginObject().key("benchmarks").beginArray();
+    }
+
+    ~Report()
+    {
+        writer.endArray().endObject().endLine();
+    }
+
+    void addLatency(const std::string& name, const std::string& target, std::vector<uint64_t> samples)
+    {
+        if (samples.empty()) {
+            return;
+        }
+        std::sort(samples.begin(), samples.end());
+        uint64_t total = 0;
+        for (const auto sample : samples) {
+            total += sample;
+        }
+        const auto percentile = [&samples](double p) {
+            return static_cast<int64_t>(samples[std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()))]);
+        };
+
+        writer.beginObject().key("name").value(name).key("target").value(target).key("unit").value("ns")
+            .key("count").value(static_cast<int64_t>(samples.size()))
+            .key("min").value(static_cast<int64_t>(samples.front()))
+            .key("p50").value(percentile(0.5))
+            .key("p90").value(percentile(0.9))
+            .key("p99").value(percentile(0.99))
+            .key("max").value(static_cast<int64_t>(samples.back()))
+            .key("mean").value(static_cast<int64_t>(total / samples.size()))
+            .endObject();
+    }
+
+    void addRate(const std::string& name, const std::string& target, const std::string& unit, double value)
+    {
+        writer.beginObject().key("name").value(name).key("target").value(target).key("unit").value(unit)
+            .key("value").value(static_cast<int64_t>(value)).endObject();
+    }
+
+private:
+    tinydbg::JsonWriter writer;
+};
+
+struct Options {
+    // where example targets are built
+    std::string directory;
+    // fewer repetitions for a smoke run
+    bool quick = false;
+
+    size_t scale(size_t count) const { return quick ? std::max<size_t>(1, count / 10) : count; }
+};
+
+// debugger stopped at exec of program, like at the first prompt
+std::unique_ptr<Debugger> start(const std::string& program)
+{
+    const auto pid = tinydbg::launch(program);
+    if (pid < 0) {
+        throw std::runtime_error{"fork failed"};
+    }
+    auto debugger = std::make_unique<Debugger>(program, pid);
+    debugger->initialize();
+    return debugger;
+}
+
+void benchStartup(Report& report, const Options& options, const std::string& target)
+{
+    std::vector<uint64_t> samples;
+    for (size_t i = 0; i < options.scale(20); ++i) {
+        std::unique_ptr<Debugger> debugger;
+        samples.push_back(measure([&] { debugger = start(options.directory + target); }));
+        debugger->killProcess();
+    }
+    report.addLatency("startup", target, samples);
+}
+
+void benchLookups(Report& report, const Options& options, const std::string& target,
+    const std::vector<std::string>& functions)
+{
+    auto debugger = start(options.directory + target);
+
+    std::vector<uint64_t> symbolSamples;
+    std::vector<uint64_t> functionSamples;
+    std::vector<uint64_t> lineSamples;
+    const auto rounds = options.scale(std::max<size_t>(1, 2000 / functions.size()));
+    for (size_t round = 0; round < rounds; ++round) {
+        for (const auto& name : functions) {
+            std::vector<tinydbg::Symbol> symbols;
+            symbolSamples.push_back(measure([&] { symbols = debugger->lookupSymbol(name); }));
+            if (symbols.empty()) {
+                continue;
+            }
+            // symbol values are link time addresses
+            const auto address = symbols.front().addr;
+            functionSamples.push_back(measure([&] { debugger->getFunction(address, /*addrOffsetted*/ false); }));
+            lineSamples.push_back(measure([&] { debugger->getLineEntry(address, /*addrOffsetted*/ false); }));
+        }
+    }
+    debugger->killProcess();
+
+    report.addLatency("lookupSymbol", target, symbolSamples);
+    report.addLatency("getFunction", target, functionSamples);
+    report.addLatency("getLineEntry", target, lineSamples);
+}
+
+// round trip of continue to a breakpoint hit by every loop iteration,
+// then how many hits a second plain continue gets through
+void benchBreakpoint(Report& report, const Options& options, const std::string& target, const std::string& function)
+{
+    auto debugger = start(options.directory + target);
+    debugger->handleCommand("breakpoint " + function);
+
+    std::vector<uint64_t> samples;
+    for (size_t i = 0; i < options.scale(2000) && debugger->getPid() != 0; ++i) {
+        samples.push_back(measure([&] { debugger->handleCommand("continue"); }));
+    }
+    report.addLatency("breakpoint_round_trip", target, samples);
+
+    size_t hits = 0;
+    const auto start = now();
+    const auto duration = options.scale(1000) * 1000 * 1000;
+    while (now() - start < duration && debugger->getPid() != 0) {
+        debugger->continueExecution();
+        ++hits;
+    }
+    report.addRate("continue_throughput", target, "hits/s", hits * 1e9 / (now() - start));
+    debugger->killProcess();
+}
+
+void benchStepping(Report& report, const Options& options, const std::string& target, const std::string& function)
+{
+    for (const std::string command : {"next", "step"}) {
+        auto debugger = start(options.directory + target);
+        debugger->handleCommand("breakpoint " + function);
+        debugger->handleCommand("continue");
+
+        std::vector<uint64_t> samples;
+        for (size_t i = 0; i < options.scale(500) && debugger->getPid() != 0; ++i) {
+            samples.push_back(measure([&] { debugger->handleCommand(command); }));
+        }
+        report.addLatency(command, target, samples);
+        debugger->killProcess();
+    }
+}
+
+// frame pointer walk from the bottom of a deep recursion
+void benchBacktrace(Report& report, const Options& options, const std::string& target, const std::string& function)
+{
+    auto debugger = start(options.directory + target);
+    debugger->handleCommand("breakpoint " + function);
+    debugger->handleCommand("continue");
+
+    std::vector<uint64_t> samples;
+    for (size_t i = 0; i < options.scale(20) && debugger->getPid() != 0; ++i) {
+        samples.push_back(measure([&] { debugger->getBacktrace(); }));
+    }
+    report.addLatency("backtrace", target, samples);
+    debugger->killProcess();
+}
+
+std::string getExecutableDirectory()
+{
+    char path[4096];
+    const auto size = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (size <= 0) {
+        return "./";
+    }
+    const std::string executable{path, static_cast<size_t>(size)};
+    return executable.substr(0, executable.rfind('/') + 1);
+}
+
+} // namespace
+
+// tinydbg_bench [--quick] [directory with example targets]
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg{argv[i]};
+        if (arg == "--quick") {
+            options.quick = true;
+        } else {
+            options.directory = arg.back() == '/' ? arg : arg + '/';
+        }
+    }
+    if (options.directory.empty()) {
+        options.directory = getExecutableDirectory();
+    }
+
+    // debugger and targets print a lot, only JSON goes to stdout and progress to stderr
+    const auto output = dup(STDOUT_FILENO);
+    auto* log = fdopen(dup(STDERR_FILENO), "w");
+    const auto null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    close(null);
+
+    // a sample of generated functions, spread over the whole program
+    std::vector<std::string> generated;
+    std::mt19937 random{42};
+    for (size_t i = 0; i < 200; ++i) {
+        generated.push_back("f" + std::to_string(random() % 2000));
+    }
+
+    const std::vector<std::pair<std::string, std::function<void(Report&)>>> benchmarks{
+        {"startup", [&](Report& report) {
+             for (const auto* target : {"hello", "variables", "unwinding", "backtrace", "many_functions", "recursion", "threads"}) {
+                 benchStartup(report, options, target);
+             }
+         }},
+        {"lookups", [&](Report& report) {
+             for (const auto* target : {"hello", "variables", "unwinding", "backtrace"}) {
+                 benchLookups(report, options, target, {"main"});
+             }
+             benchLookups(report, options, "many_functions", generated);
+         }},
+        {"breakpoint", [&](Report& report) {
+             benchBreakpoint(report, options, "many_functions", "hot");
+             benchBreakpoint(report, options, "threads", "tick");
+         }},
+        {"stepping", [&](Report& report) { benchStepping(report, options, "many_functions", "lines"); }},
+        {"backtrace", [&](Report& report) { benchBacktrace(report, options, "recursion", "bottom"); }},
+    };
+
+    int result = 0;
+    {
+        Report report{output};
+        for (const auto& [name, run] : benchmarks) {
+            std::fprintf(log, "running %s\n", name.c_str());
+            std::fflush(log);
+            try {
+                run(report);
+            } catch (const std::exception& e) {
+                std::fprintf(log, "%s failed: %s\n", name.c_str(), e.what());
+                result = 1;
+            }
+        }
+    }
+    std::fclose(log);
+    return result;
+}
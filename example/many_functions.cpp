@@ -0,0 +1,34 @@
+// thousands of generated functions around a hot loop, see CMakeLists.txt
+extern int (*const generated[])(int);
+extern const int generatedCount;
+
+__attribute__((noinline)) int hot(int x)
+{
+    return x * 3 + 1;
+}
+
+__attribute__((noinline)) int lines(int x)
+{
+    int a = x + 1;
+    int b = a * 2;
+    int c = b - x;
+    int d = c + a;
+    int e = d * b;
+    int f = e - c;
+    int g = f + d;
+    int h = g * 3;
+    int i = h - e;
+    int j = i + f;
+    return j;
+}
+
+int main()
+{
+    volatile int sink = 0;
+    for (int i = 0; i < 10000000; ++i) {
+        sink = hot(i);
+        sink = lines(sink);
+        sink = generated[i % generatedCount](sink);
+    }
+    return 0;
+}
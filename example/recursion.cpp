@@ -0,0 +1,17 @@
+__attribute__((noinline)) int bottom()
+{
+    return 42;
+}
+
+__attribute__((noinline)) int descend(int depth)
+{
+    if (depth == 0) {
+        return bottom();
+    }
+    return descend(depth - 1) + 1;
+}
+
+int main()
+{
+    return descend(10000) != 10042;
+}
@@ -0,0 +1,38 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+std::atomic<bool> done{false};
+
+__attribute__((noinline)) int tick(int x)
+{
+    return x + 1;
+}
+
+void spin()
+{
+    volatile unsigned counter = 0;
+    while (!done.load(std::memory_order_relaxed)) {
+        ++counter;
+    }
+}
+
+int main()
+{
+    // busy threads which never reach breakpoints, only main thread is traced
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 32; ++i) {
+        threads.emplace_back(spin);
+    }
+
+    volatile int sink = 0;
+    for (int i = 0; i < 10000000; ++i) {
+        sink = tick(sink);
+    }
+
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return 0;
+}
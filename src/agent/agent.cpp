@@ -0,0 +1,190 @@
+// libtinydbg-agent.so, loaded into the inferior with LD_PRELOAD.
+// It only sets up shared memory and trampoline area, tinydbg writes trampolines itself.
+// Record path runs in the middle of arbitrary code: it's built with
+// -mgeneral-regs-only and doesn't call into libc, trampolines don't save vector registers.
+
+#include "protocol.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include <cstdio>
+#include <cstring>
+
+extern "C" __attribute__((visibility("default"))) void tinydbg_agent_record(
+    uint32_t site, const tinydbg::agent::SavedRegisters* saved);
+
+namespace {
+
+using namespace tinydbg::agent;
+
+Header* header = nullptr;
+thread_local uint32_t threadId = 0;
+
+uint32_t getThreadId()
+{
+    if (threadId == 0) {
+        // raw syscall, libc wrapper isn't known to keep vector registers intact
+        long result;
+        asm volatile("syscall" : "=a"(result) : "a"(SYS_gettid) : "rcx", "r11", "memory");
+        threadId = static_cast<uint32_t>(result);
+    }
+    return threadId;
+}
+
+// the first executable mapping of the main program, trampolines need to be within reach of rel32 jumps
+bool getExecutableRange(uint64_t& start, uint64_t& end)
+{
+    auto* maps = std::fopen("/proc/self/maps", "r");
+    if (maps == nullptr) {
+        return false;
+    }
+
+    char line[512];
+    char path[512] = {};
+    bool found = false;
+    while (std::fgets(line, sizeof(line), maps) != nullptr) {
+        unsigned long low, high;
+        char mappingPath[512] = {};
+        if (std::sscanf(line, "%lx-%lx %*s %*s %*s %*s %511s", &low, &high, mappingPath) < 2) {
+            continue;
+        }
+        if (!found) {
+            // first mapping belongs to the main program
+            std::strcpy(path, mappingPath);
+            start = low;
+            found = true;
+        }
+        if (std::strcmp(path, mappingPath) == 0) {
+            end = high;
+        }
+    }
+
+    std::fclose(maps);
+    return found;
+}
+
+// executable area as close to the main program as possible
+uint64_t mapTrampolineArea(uint64_t start, uint64_t end)
+{
+    constexpr uint64_t step = 1 << 20;
+    // below the program first, the space after it is where brk heap grows
+    for (uint64_t distance = step; distance < (1ull << 30); distance += step) {
+        const uint64_t candidates[] = {start - distance - TRAMPOLINE_AREA_SIZE, end + distance};
+        for (const auto candidate : candidates) {
+            if (candidate > start && candidate < end) {
+                continue;
+            }
+            auto* area = mmap(reinterpret_cast<void*>(candidate), TRAMPOLINE_AREA_SIZE, PROT_READ | PROT_EXEC,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+            if (area == MAP_FAILED) {
+                continue;
+            }
+            if (reinterpret_cast<uint64_t>(area) == candidate) {
+                return candidate;
+            }
+            // kernels before 4.17 treat unknown flag as a hint
+            munmap(area, TRAMPOLINE_AREA_SIZE);
+        }
+    }
+    return 0;
+}
+
+__attribute__((constructor)) void initialize()
+{
+    uint64_t start = 0;
+    uint64_t end = 0;
+    if (!getExecutableRange(start, end)) {
+        return;
+    }
+    const auto area = mapTrampolineArea(start, end);
+    if (area == 0) {
+        return;
+    }
+
+    const auto name = getSharedMemoryName(getpid());
+    const auto fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    const auto size = getSharedMemorySize(RING_CAPACITY);
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return;
+    }
+    auto* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return;
+    }
+
+    auto* shared = static_cast<Header*>(memory);
+    shared->version = VERSION;
+    shared->trampolineArea = area;
+    shared->trampolineSize = TRAMPOLINE_AREA_SIZE;
+    shared->recordFunction = reinterpret_cast<uint64_t>(&tinydbg_agent_record);
+    shared->capacity = RING_CAPACITY;
+    // tinydbg checks magic before anything else
+    std::atomic_thread_fence(std::memory_order_release);
+    shared->magic = MAGIC;
+    header = shared;
+}
+
+__attribute__((destructor)) void finalize()
+{
+    // tinydbg keeps its own mapping, the name isn't needed anymore
+    if (header != nullptr) {
+        shm_unlink(getSharedMemoryName(getpid()).c_str());
+    }
+}
+
+} // namespace
+
+void tinydbg_agent_record(uint32_t site, const SavedRegisters* saved)
+{
+    if (header == nullptr) {
+        return;
+    }
+
+    auto position = header->head.load(std::memory_order_relaxed);
+    do {
+        if (position - header->tail.load(std::memory_order_acquire) >= header->capacity) {
+            header->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    } while (!header->head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed));
+
+    auto& record = getRecords(header)[position % header->capacity];
+    record.timestamp = __rdtsc();
+    record.site = site;
+    record.tid = getThreadId();
+
+    // field by field, zeroing the whole struct could become a memset call
+    auto& regs = record.regs;
+    regs.r15 = saved->r15;
+    regs.r14 = saved->r14;
+    regs.r13 = saved->r13;
+    regs.r12 = saved->r12;
+    regs.r11 = saved->r11;
+    regs.r10 = saved->r10;
+    regs.r9 = saved->r9;
+    regs.r8 = saved->r8;
+    regs.rbp = saved->rbp;
+    regs.rdi = saved->rdi;
+    regs.rsi = saved->rsi;
+    regs.rbx = saved->rbx;
+    regs.rdx = saved->rdx;
+    regs.rcx = saved->rcx;
+    regs.rax = saved->rax;
+    regs.eflags = saved->rflags;
+    regs.rsp = reinterpret_cast<uint64_t>(saved + 1) + RED_ZONE_SIZE;
+    regs.orig_rax = 0;
+    regs.rip = 0;
+    regs.cs = regs.ss = regs.ds = regs.es = regs.fs = regs.gs = 0;
+    regs.fs_base = regs.gs_base = 0;
+
+    record.sequence.store(position + 1, std::memory_order_release);
+}
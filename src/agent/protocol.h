@@ -0,0 +1,79 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Layout of shared memory between tinydbg and libtinydbg-agent.so.
+// Agent creates /dev/shm/tinydbg-agent.<pid> when the inferior starts,
+// trampolines placed by tinydbg call recordFunction which appends to the ring,
+// tinydbg drains it from its own mapping without stopping the inferior.
+namespace tinydbg::agent {
+
+constexpr uint32_t MAGIC = 0x61676474; // "tdga"
+constexpr uint32_t VERSION = 1;
+constexpr uint64_t RING_CAPACITY = 1 << 16;
+// every tracepoint gets a trampoline slot of this size
+constexpr uint64_t TRAMPOLINE_SLOT_SIZE = 256;
+constexpr uint64_t TRAMPOLINE_AREA_SIZE = 1 << 20;
+
+inline std::string getSharedMemoryName(pid_t pid)
+{
+    return "/tinydbg-agent." + std::to_string(pid);
+}
+
+struct Record {
+    // written last, equals ring position + 1 once the record is complete
+    std::atomic<uint64_t> sequence;
+    // rdtsc at hit
+    uint64_t timestamp;
+    uint32_t site;
+    uint32_t tid;
+    // rip, fs/gs and segment registers aren't filled, rip is the site address
+    user_regs_struct regs;
+};
+
+// Registers as trampoline pushes them, the lowest address first
+struct SavedRegisters {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rbx, rdx, rcx, rax;
+    uint64_t rflags;
+};
+
+// bytes below stack pointer trampoline skips to keep red zone of the interrupted code
+constexpr uint64_t RED_ZONE_SIZE = 128;
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    // executable area reserved for trampolines near the main executable
+    uint64_t trampolineArea;
+    uint64_t trampolineSize;
+    // address of void record(uint32_t site, const SavedRegisters* saved) in the inferior
+    uint64_t recordFunction;
+    uint64_t capacity;
+    // multiple producers claim positions with CAS on head, tinydbg advances tail
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    // hits lost because the ring was full
+    std::atomic<uint64_t> dropped;
+};
+
+// ring of capacity records follows the header
+inline Record* getRecords(Header* header)
+{
+    return reinterpret_cast<Record*>(header + 1);
+}
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring is shared between processes");
+
+constexpr size_t getSharedMemorySize(uint64_t capacity)
+{
+    return sizeof(Header) + capacity * sizeof(Record);
+}
+
+} // namespace tinydbg::agent
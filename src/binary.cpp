@@ -0,0 +1,51 @@
+#include "binary.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace tinydbg {
+
+namespace {
+
+elf::elf openElf(const std::string& path)
+{
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error{"Failed to open " + path + ": " + strerror(errno)};
+    }
+    return elf::elf{elf::create_mmap_loader(fd)};
+}
+
+} // namespace
+
+Binary::Binary(std::string path, const std::vector<std::string>& debugDirectories)
+    : path{std::move(path)}
+    , elf{openElf(this->path)}
+    , debugInfo{this->path, elf, debugDirectories}
+    , dwarf{debugInfo.getDwarf()}
+{
+}
+
+std::shared_ptr<Binary> BinaryCache::load(const std::string& path)
+{
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0) {
+        throw std::runtime_error{"Failed to open " + path + ": " + strerror(errno)};
+    }
+    const auto key = std::to_string(status.st_dev) + ':' + std::to_string(status.st_ino) + ':'
+        + std::to_string(status.st_mtim.tv_sec) + '.' + std::to_string(status.st_mtim.tv_nsec);
+
+    auto& cached = binaries[key];
+    if (auto binary = cached.lock()) {
+        return binary;
+    }
+    auto binary = std::make_shared<Binary>(path, debugDirectories);
+    cached = binary;
+    return binary;
+}
+
+} // namespace tinydbg
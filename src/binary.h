@@ -0,0 +1,63 @@
+#pragma once
+
+#include "completion.h"
+#include "debuginfo.h"
+#include "location.h"
+
+#include "dwarf/dwarf++.hh"
+#include "elf/elf++.hh"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace tinydbg {
+
+// data object of the symbol tables, address isn't offsetted
+struct DataSymbol {
+    uint64_t address;
+    uint64_t size;
+    std::string name;
+};
+
+// program file with its debug info and what's derived from it,
+// parsed once and shared by all inferiors which run it
+struct Binary {
+    Binary(std::string path, const std::vector<std::string>& debugDirectories);
+
+    std::string path;
+    elf::elf elf;
+    // separate, compressed and split debug info of the program
+    DebugInfo debugInfo;
+    dwarf::dwarf dwarf;
+    // compiled variable locations by unit and function DIE offset
+    std::map<std::pair<const dwarf::unit*, dwarf::section_offset>, CompiledFunction> compiledFunctions;
+    // built on the first completion, large programs have millions of symbols
+    std::optional<PrefixIndex> symbolIndex;
+    std::optional<PrefixIndex> fileIndex;
+    // sorted by address, built by the first memdiff show
+    std::optional<std::vector<DataSymbol>> dataSymbols;
+};
+
+// binaries by file identity, a binary is parsed again only after every inferior running it is gone
+class BinaryCache {
+public:
+    explicit BinaryCache(std::vector<std::string> debugDirectories = {})
+        : debugDirectories{std::move(debugDirectories)}
+    {
+    }
+
+    // throws if path can't be opened
+    std::shared_ptr<Binary> load(const std::string& path);
+
+private:
+    std::vector<std::string> debugDirectories;
+    // by device, inode and modification time, so rebuilt programs are parsed again
+    std::map<std::string, std::weak_ptr<Binary>> binaries;
+};
+
+} // namespace tinydbg
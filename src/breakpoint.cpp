@@ -1,13 +1,18 @@
 #include "breakpoint.h"
 
+#include "memory.h"
+#include "stats.h"
+
 #include <iostream>
+#include <map>
 #include <sys/ptrace.h>
+#include <unistd.h>
 
 namespace tinydbg {
 
 void Breakpoint::enable()
 {
-    const auto data = ptrace(PTRACE_PEEKDATA, pid, addr, nullptr);
+    const auto data = stats::ptrace(PTRACE_PEEKDATA, pid, addr, nullptr);
     // save bottom byte
     savedData = static_cast<uint8_t>(data & 0xFF);
 
@@ -15,16 +20,103 @@ void Breakpoint::enable()
     // ~ bitwise NOT ~01001 == 10110
     const uint64_t int3 = 0xCC;
     const uint64_t dataWithInt3 = ((data & ~0xFF) | int3);
-    ptrace(PTRACE_POKEDATA, pid, addr, dataWithInt3);
+    stats::ptrace(PTRACE_POKEDATA, pid, addr, dataWithInt3);
     enabled = true;
 }
 
+void Breakpoint::enableAll(pid_t pid, const std::vector<Breakpoint*>& breakpoints)
+{
+    const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+
+    std::map<uint64_t, std::vector<Breakpoint*>> pages;
+    for (auto* breakpoint : breakpoints) {
+        if (!breakpoint->enabled) {
+            pages[breakpoint->addr & ~(pageSize - 1)].push_back(breakpoint);
+        }
+    }
+    if (pages.empty()) {
+        return;
+    }
+
+    std::vector<MemoryRange> ranges;
+    for (const auto& [page, pageBreakpoints] : pages) {
+        // coalesce adjacent pages into a single range
+        if (!ranges.empty() && ranges.back().address + ranges.back().size == page) {
+            ranges.back().size += pageSize;
+        } else {
+            ranges.push_back({page, pageSize});
+        }
+    }
+
+    std::vector<uint8_t> buffer(pages.size() * pageSize);
+    if (readMemoryBatch(pid, ranges, buffer.data()) != buffer.size()) {
+        // don't write back zeroes of pages we failed to read
+        for (const auto& [page, pageBreakpoints] : pages) {
+            for (auto* breakpoint : pageBreakpoints) {
+                breakpoint->enable();
+            }
+        }
+        return;
+    }
+
+    size_t pageIndex = 0;
+    for (const auto& [page, pageBreakpoints] : pages) {
+        auto* data = buffer.data() + pageIndex++ * pageSize;
+        for (auto* breakpoint : pageBreakpoints) {
+            auto& byte = data[breakpoint->addr - page];
+            breakpoint->savedData = byte;
+            byte = 0xCC;
+        }
+    }
+
+    // int3 is in memory only where the write got as far as its byte,
+    // the rest stays disabled with the original byte in place
+    std::vector<size_t> written;
+    writeMemoryBatch(pid, ranges, buffer.data(), &written);
+    size_t rangeIndex = 0;
+    for (const auto& [page, pageBreakpoints] : pages) {
+        while (page >= ranges[rangeIndex].address + ranges[rangeIndex].size) {
+            ++rangeIndex;
+        }
+        for (auto* breakpoint : pageBreakpoints) {
+            breakpoint->enabled = breakpoint->addr - ranges[rangeIndex].address < written[rangeIndex];
+        }
+    }
+}
+
 void Breakpoint::disable()
 {
-    const auto data = ptrace(PTRACE_PEEKDATA, pid, addr, nullptr);
+    const auto data = stats::ptrace(PTRACE_PEEKDATA, pid, addr, nullptr);
     const uint64_t restoredData = ((data & ~0xFF) | savedData);
-    ptrace(PTRACE_POKEDATA, pid, addr, restoredData);
+    stats::ptrace(PTRACE_POKEDATA, pid, addr, restoredData);
     enabled = false;
 }
 
+BreakpointTable BreakpointTable::share(pid_t forkPid) const
+{
+    auto table = *this;
+    table.pid = forkPid;
+    return table;
+}
+
+void BreakpointTable::setPid(pid_t newPid)
+{
+    pid = newPid;
+    detach();
+}
+
+BreakpointTable::Map& BreakpointTable::detach()
+{
+    if (shared.use_count() > 1) {
+        shared = std::make_shared<Shared>(*shared);
+    }
+    if (shared->owner != pid) {
+        shared->owner = pid;
+        for (auto& [address, breakpoint] : shared->map) {
+            breakpoint.setPid(pid);
+        }
+    }
+    return shared->map;
+}
+
 } // namespace tinydbg
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <termio.h>
+#include <unordered_map>
+#include <vector>
 
 namespace tinydbg {
 
@@ -17,8 +20,15 @@ public:
 
     void enable();
     void disable();
+    // enable many breakpoints of the same process at once,
+    // every affected page is read and written only once
+    static void enableAll(pid_t pid, const std::vector<Breakpoint*>& breakpoints);
     bool isEnabled() const { return enabled; }
     uint64_t getAddress() const { return addr; }
+    // original byte replaced by int3
+    uint8_t getSavedData() const { return savedData; }
+    // used when debugger switches to a forked copy of the inferior
+    void setPid(pid_t newPid) { pid = newPid; }
 
 private:
     pid_t pid;
@@ -28,4 +38,48 @@ private:
     uint8_t savedData;
 };
 
+// Breakpoints of a process by address.
+// Forks get the table of their parent shared, it's copied only when either of
+// them changes it, so following many workers of one parent costs nothing until then.
+// Non-const access is a change, it makes the table private first.
+class BreakpointTable {
+public:
+    using Map = std::unordered_map<uint64_t, Breakpoint>;
+
+    explicit BreakpointTable(pid_t pid = 0)
+        : pid{pid}
+        , shared{std::make_shared<Shared>(Shared{pid, {}})}
+    {
+    }
+
+    // table of a fork of the process, which has the same breakpoints in its memory
+    BreakpointTable share(pid_t forkPid) const;
+    // process was replaced by its fork
+    void setPid(pid_t newPid);
+
+    size_t count(uint64_t address) const { return shared->map.count(address); }
+    bool empty() const { return shared->map.empty(); }
+    const Breakpoint& at(uint64_t address) const { return shared->map.at(address); }
+    Breakpoint& at(uint64_t address) { return detach().at(address); }
+    std::pair<Map::iterator, bool> insert(Map::value_type value) { return detach().insert(std::move(value)); }
+    size_t erase(uint64_t address) { return detach().erase(address); }
+    Map::const_iterator begin() const { return shared->map.cbegin(); }
+    Map::const_iterator end() const { return shared->map.cend(); }
+    Map::iterator begin() { return detach().begin(); }
+    Map::iterator end() { return detach().end(); }
+
+private:
+    // entries carry the pid of the table which last changed them,
+    // the other sharer may be left holding them alone
+    struct Shared {
+        pid_t owner;
+        Map map;
+    };
+
+    Map& detach();
+
+    pid_t pid;
+    std::shared_ptr<Shared> shared;
+};
+
 } // namespace tinydbg
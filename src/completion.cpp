@@ -0,0 +1,42 @@
+#include "completion.h"
+
+#include <algorithm>
+
+namespace tinydbg {
+
+namespace {
+
+// matches ranked for a single query
+constexpr size_t SCAN_LIMIT = 4096;
+
+} // namespace
+
+void PrefixIndex::build()
+{
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+    entries.shrink_to_fit();
+}
+
+std::vector<std::string> PrefixIndex::find(const std::string& prefix, size_t limit) const
+{
+    // every entry with the prefix sorts right after its lower bound
+    std::vector<const std::string*> matches;
+    for (auto it = std::lower_bound(entries.cbegin(), entries.cend(), prefix);
+         it != entries.cend() && matches.size() < SCAN_LIMIT && it->compare(0, prefix.size(), prefix) == 0; ++it) {
+        matches.push_back(&*it);
+    }
+
+    const auto count = std::min(limit, matches.size());
+    std::partial_sort(matches.begin(), matches.begin() + count, matches.end(), [](const auto* lhs, const auto* rhs) {
+        return lhs->size() != rhs->size() ? lhs->size() < rhs->size() : *lhs < *rhs;
+    });
+
+    std::vector<std::string> result;
+    for (size_t i = 0; i < count; ++i) {
+        result.push_back(*matches[i]);
+    }
+    return result;
+}
+
+} // namespace tinydbg
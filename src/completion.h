@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace tinydbg {
+
+// sorted strings answering prefix queries with a binary search
+class PrefixIndex {
+public:
+    void add(std::string s) { entries.push_back(std::move(s)); }
+    // sorts and drops duplicates, must be called before find
+    void build();
+
+    // at most limit entries starting with prefix, shorter ones first,
+    // only a bounded number of matches is looked at so huge ranges stay cheap
+    std::vector<std::string> find(const std::string& prefix, size_t limit) const;
+    size_t size() const { return entries.size(); }
+
+private:
+    std::vector<std::string> entries;
+};
+
+} // namespace tinydbg
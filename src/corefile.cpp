@@ -0,0 +1,588 @@
+#include "corefile.h"
+
+#include "memory.h"
+#include "stats.h"
+
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/procfs.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace tinydbg {
+
+namespace {
+
+static_assert(sizeof(elf_gregset_t) == sizeof(user_regs_struct),
+    "NT_PRSTATUS registers should have user_regs_struct layout");
+
+size_t align4(size_t value)
+{
+    return (value + 3) & ~size_t{3};
+}
+
+std::string getRealPath(const std::string& path)
+{
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved) == nullptr) {
+        return path;
+    }
+    return resolved;
+}
+
+std::string getBaseName(const std::string& path)
+{
+    const auto slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// memory is copied in chunks of this size, one process_vm_readv each
+constexpr size_t COPY_CHUNK_SIZE = 8 << 20;
+
+struct ProcessMapping {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;
+    uint32_t flags;
+    // content can be taken from the file, so unmodified pages aren't dumped
+    bool fileBacked;
+    std::string path;
+};
+
+struct LoadSegment {
+    uint64_t address;
+    uint64_t size;
+    uint64_t fileSize;
+    uint64_t offset;
+    uint32_t flags;
+};
+
+// range of inferior memory and where it goes in the core file
+struct CopyRange {
+    uint64_t address;
+    size_t size;
+    uint64_t offset;
+};
+
+std::vector<ProcessMapping> readMappings(pid_t pid)
+{
+    std::vector<ProcessMapping> mappings;
+    for (const auto& region : readMemoryRegions(pid)) {
+        // vvar and vsyscall can't be read through process_vm_readv
+        const auto& path = region.path;
+        if (!region.isReadable() || region.perms.size() < 4
+            || path == "[vvar]" || path == "[vvar_vclock]" || path == "[vsyscall]") {
+            continue;
+        }
+
+        const std::string deleted = " (deleted)";
+        const auto isDeleted = path.size() >= deleted.size()
+            && path.compare(path.size() - deleted.size(), deleted.size(), deleted) == 0;
+        const uint32_t flags = PF_R | (region.perms[1] == 'w' ? PF_W : 0) | (region.perms[2] == 'x' ? PF_X : 0);
+        mappings.push_back({region.start, region.end, region.offset, flags, region.inode != 0 && !isDeleted, path});
+    }
+    return mappings;
+}
+
+bool isZero(const uint8_t* data, size_t size)
+{
+    return data[0] == 0 && std::memcmp(data, data + 1, size - 1) == 0;
+}
+
+// split mapping into load segments and ranges which need to be copied,
+// pages which aren't worth dumping are either holes or not in the file at all
+void planMapping(const ProcessMapping& mapping, int pagemap, uint64_t pageSize, uint64_t& fileOffset,
+    std::vector<LoadSegment>& segments, std::vector<CopyRange>& copies)
+{
+    const auto pageCount = (mapping.end - mapping.start) / pageSize;
+    // mappings which only had address space reserved can be huge, read pagemap in pieces
+    constexpr size_t PAGEMAP_CHUNK = 1 << 16;
+    std::vector<uint64_t> entries(std::min<uint64_t>(pageCount, PAGEMAP_CHUNK));
+
+    auto addCopy = [&copies](uint64_t address, uint64_t size, uint64_t offset) {
+        if (!copies.empty() && copies.back().address + copies.back().size == address
+            && copies.back().offset + copies.back().size == offset) {
+            copies.back().size += size;
+        } else {
+            copies.push_back({address, size, offset});
+        }
+    };
+
+    if (!mapping.fileBacked) {
+        // whole anonymous mapping is in the file, never touched pages are holes
+        segments.push_back({mapping.start, mapping.end - mapping.start, mapping.end - mapping.start, fileOffset, mapping.flags});
+    }
+
+    for (uint64_t first = 0; first < pageCount; first += entries.size()) {
+        const auto count = std::min<uint64_t>(pageCount - first, entries.size());
+        const auto pagemapOffset = (mapping.start / pageSize + first) * sizeof(uint64_t);
+        const auto read = pagemap < 0 ? -1 : pread(pagemap, entries.data(), count * sizeof(uint64_t), pagemapOffset);
+
+        for (uint64_t i = 0; i < count; ++i) {
+            const auto address = mapping.start + (first + i) * pageSize;
+            // without pagemap everything is dumped
+            const auto entry = static_cast<size_t>(read) == count * sizeof(uint64_t) ? entries[i] : PAGEMAP_PRESENT;
+            const auto resident = (entry & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED)) != 0;
+
+            if (!mapping.fileBacked) {
+                if (resident) {
+                    addCopy(address, pageSize, segments.back().offset + (address - mapping.start));
+                }
+                continue;
+            }
+
+            const auto modified = resident && (entry & PAGEMAP_FILE) == 0;
+            // after the first page the last segment belongs to this mapping
+            if (first + i > 0 && (segments.back().fileSize != 0) == modified) {
+                segments.back().size += pageSize;
+                segments.back().fileSize += modified ? pageSize : 0;
+            } else {
+                segments.push_back({address, pageSize, modified ? pageSize : 0, fileOffset, mapping.flags});
+            }
+            if (modified) {
+                addCopy(address, pageSize, fileOffset);
+                fileOffset += pageSize;
+            }
+        }
+    }
+
+    if (!mapping.fileBacked) {
+        fileOffset += mapping.end - mapping.start;
+    }
+}
+
+void appendNote(std::vector<uint8_t>& notes, uint32_t type, const void* desc, size_t size)
+{
+    static const char name[] = "CORE";
+    const Elf64_Nhdr header{sizeof(name), static_cast<Elf64_Word>(size), type};
+    const auto* headerBytes = reinterpret_cast<const uint8_t*>(&header);
+    const auto* descBytes = static_cast<const uint8_t*>(desc);
+
+    notes.insert(notes.end(), headerBytes, headerBytes + sizeof(header));
+    notes.insert(notes.end(), name, name + sizeof(name));
+    notes.resize(align4(notes.size()));
+    notes.insert(notes.end(), descBytes, descBytes + size);
+    notes.resize(align4(notes.size()));
+}
+
+std::string readProcFile(pid_t pid, const std::string& name)
+{
+    std::ifstream file{"/proc/" + std::to_string(pid) + "/" + name, std::ios::binary};
+    return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+std::vector<uint8_t> buildNotes(pid_t pid, const std::vector<CoreFile::Thread>& threads,
+    const std::vector<ProcessMapping>& mappings, uint64_t pageSize)
+{
+    std::vector<uint8_t> notes;
+
+    // main thread goes first, readers treat it as the one which crashed
+    for (const auto& thread : threads) {
+        elf_prstatus status{};
+        status.pr_pid = thread.tid;
+        status.pr_cursig = thread.signal;
+        std::memcpy(&status.pr_reg, &thread.regs, sizeof(thread.regs));
+        appendNote(notes, NT_PRSTATUS, &status, sizeof(status));
+    }
+
+    elf_prpsinfo info{};
+    info.pr_pid = pid;
+    const auto comm = readProcFile(pid, "comm");
+    std::strncpy(info.pr_fname, comm.c_str(), std::min(comm.find('\n'), sizeof(info.pr_fname) - 1));
+    auto cmdline = readProcFile(pid, "cmdline");
+    std::replace(cmdline.begin(), cmdline.end(), '\0', ' ');
+    std::strncpy(info.pr_psargs, cmdline.c_str(), sizeof(info.pr_psargs) - 1);
+    appendNote(notes, NT_PRPSINFO, &info, sizeof(info));
+
+    const auto auxv = readProcFile(pid, "auxv");
+    appendNote(notes, NT_AUXV, auxv.data(), auxv.size());
+
+    // count, page size, count * (start, end, page offset), count * path
+    std::vector<uint64_t> ranges{0, pageSize};
+    std::string names;
+    for (const auto& mapping : mappings) {
+        if (mapping.fileBacked) {
+            ranges.insert(ranges.end(), {mapping.start, mapping.end, mapping.offset / pageSize});
+            names.append(mapping.path).push_back('\0');
+            ++ranges[0];
+        }
+    }
+    std::vector<uint8_t> files(ranges.size() * sizeof(uint64_t) + names.size());
+    std::memcpy(files.data(), ranges.data(), ranges.size() * sizeof(uint64_t));
+    std::memcpy(files.data() + ranges.size() * sizeof(uint64_t), names.data(), names.size());
+    appendNote(notes, NT_FILE, files.data(), files.size());
+
+    return notes;
+}
+
+} // namespace
+
+std::vector<CoreFile::Thread> stopThreads(pid_t pid)
+{
+    std::vector<CoreFile::Thread> threads;
+    const auto path = "/proc/" + std::to_string(pid) + "/task";
+    auto* dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return threads;
+    }
+
+    while (const auto* entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        const pid_t tid = std::stoi(entry->d_name);
+        if (tid == pid || stats::ptrace(PTRACE_SEIZE, tid, nullptr, nullptr) != 0) {
+            continue;
+        }
+        stats::ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
+        stats::waitpid(tid, nullptr, __WALL);
+
+        CoreFile::Thread thread{tid, 0, {}};
+        stats::ptrace(PTRACE_GETREGS, tid, nullptr, &thread.regs);
+        threads.push_back(thread);
+    }
+
+    closedir(dir);
+    return threads;
+}
+
+CoreFile::CoreFile(const std::string& path)
+    : data{nullptr}
+    , size{0}
+{
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error{"Failed to open core file " + path};
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Elf64_Ehdr)) {
+        close(fd);
+        throw std::runtime_error{"Invalid core file " + path};
+    }
+
+    // mapping is lazy, multi GB cores open instantly
+    size = st.st_size;
+    auto* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error{"Failed to map core file " + path};
+    }
+    data = static_cast<const uint8_t*>(mapping);
+
+    const auto* ehdr = reinterpret_cast<const Elf64_Ehdr*>(data);
+    if (size < sizeof(Elf64_Ehdr)
+        || std::memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0
+        || ehdr->e_ident[EI_CLASS] != ELFCLASS64
+        || ehdr->e_type != ET_CORE) {
+        munmap(mapping, size);
+        throw std::runtime_error{"Not an x86_64 ELF core file: " + path};
+    }
+    // extended numbering, the real count is in sh_info of section header 0
+    size_t phnum = ehdr->e_phnum;
+    if (phnum == PN_XNUM && ehdr->e_shoff != 0 && ehdr->e_shoff + sizeof(Elf64_Shdr) <= size) {
+        phnum = reinterpret_cast<const Elf64_Shdr*>(data + ehdr->e_shoff)->sh_info;
+    }
+    if (ehdr->e_phoff + phnum * sizeof(Elf64_Phdr) > size) {
+        munmap(mapping, size);
+        throw std::runtime_error{"Not an x86_64 ELF core file: " + path};
+    }
+
+    const auto* phdrs = reinterpret_cast<const Elf64_Phdr*>(data + ehdr->e_phoff);
+    for (size_t i = 0; i < phnum; ++i) {
+        const auto& phdr = phdrs[i];
+        if (phdr.p_offset > size) {
+            continue;
+        }
+        // truncated cores still have everything that made it to the disk
+        const auto fileSize = std::min<uint64_t>(phdr.p_filesz, size - phdr.p_offset);
+        if (phdr.p_type == PT_LOAD) {
+            segments.push_back({phdr.p_vaddr, fileSize, phdr.p_memsz, phdr.p_offset});
+        } else if (phdr.p_type == PT_NOTE) {
+            parseNotes(data + phdr.p_offset, fileSize);
+        }
+    }
+
+    std::sort(segments.begin(), segments.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.address < rhs.address; });
+}
+
+CoreFile::~CoreFile()
+{
+    munmap(const_cast<uint8_t*>(data), size);
+}
+
+void CoreFile::parseNotes(const uint8_t* notes, size_t notesSize)
+{
+    size_t offset = 0;
+    while (offset + sizeof(Elf64_Nhdr) <= notesSize) {
+        const auto* nhdr = reinterpret_cast<const Elf64_Nhdr*>(notes + offset);
+        const auto descOffset = offset + sizeof(Elf64_Nhdr) + align4(nhdr->n_namesz);
+        if (descOffset + nhdr->n_descsz > notesSize) {
+            break;
+        }
+        const auto* desc = notes + descOffset;
+
+        if (nhdr->n_type == NT_PRSTATUS && nhdr->n_descsz >= sizeof(elf_prstatus)) {
+            elf_prstatus status;
+            std::memcpy(&status, desc, sizeof(status));
+            Thread thread{status.pr_pid, status.pr_cursig, {}};
+            std::memcpy(&thread.regs, &status.pr_reg, sizeof(thread.regs));
+            threads.push_back(thread);
+        } else if (nhdr->n_type == NT_FILE && nhdr->n_descsz >= 2 * sizeof(uint64_t)) {
+            // count, page size, count * (start, end, page offset), count * path
+            const auto* words = reinterpret_cast<const uint64_t*>(desc);
+            const auto count = words[0];
+            const auto pageSize = words[1];
+            const auto* names = reinterpret_cast<const char*>(words + 2 + count * 3);
+            const auto* end = reinterpret_cast<const char*>(desc + nhdr->n_descsz);
+            for (uint64_t i = 0; i < count && names < end; ++i) {
+                const auto* entry = words + 2 + i * 3;
+                std::string path{names, strnlen(names, end - names)};
+                names += path.size() + 1;
+                files.push_back({entry[0], entry[1], entry[2] * pageSize, std::move(path)});
+            }
+        }
+
+        offset = descOffset + align4(nhdr->n_descsz);
+    }
+}
+
+const uint8_t* CoreFile::getPointer(uint64_t address, size_t length) const
+{
+    // last segment starting at or before address
+    auto it = std::upper_bound(segments.cbegin(), segments.cend(), address,
+        [](uint64_t address, const auto& segment) { return address < segment.address; });
+    if (it == segments.cbegin()) {
+        return nullptr;
+    }
+    --it;
+
+    const auto segmentOffset = address - it->address;
+    if (segmentOffset + length > it->fileSize) {
+        return nullptr;
+    }
+    return data + it->offset + segmentOffset;
+}
+
+bool CoreFile::readMemory(uint64_t address, void* buffer, size_t length) const
+{
+    const auto* pointer = getPointer(address, length);
+    if (pointer != nullptr) {
+        std::memcpy(buffer, pointer, length);
+        return true;
+    }
+
+    // range may span several adjacent segments
+    auto* out = static_cast<uint8_t*>(buffer);
+    while (length > 0) {
+        auto it = std::upper_bound(segments.cbegin(), segments.cend(), address,
+            [](uint64_t address, const auto& segment) { return address < segment.address; });
+        if (it == segments.cbegin()) {
+            return false;
+        }
+        --it;
+        const auto segmentOffset = address - it->address;
+        if (segmentOffset >= it->memorySize) {
+            return false;
+        }
+        const auto chunk = std::min<uint64_t>(length, it->memorySize - segmentOffset);
+        // parts of segment which weren't dumped aren't known
+        if (segmentOffset + chunk > it->fileSize) {
+            return false;
+        }
+        std::memcpy(out, data + it->offset + segmentOffset, chunk);
+        out += chunk;
+        address += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+std::vector<MemoryRegion> CoreFile::getRegions() const
+{
+    std::vector<MemoryRegion> regions;
+    for (const auto& segment : segments) {
+        if (segment.fileSize == 0) {
+            continue;
+        }
+        MemoryRegion region{segment.address, segment.address + segment.fileSize, 0, 0, "r---", {}};
+        for (const auto& file : files) {
+            if (file.start <= segment.address && segment.address < file.end) {
+                region.path = file.path;
+                region.offset = file.offset + (segment.address - file.start);
+                break;
+            }
+        }
+        regions.push_back(std::move(region));
+    }
+    return regions;
+}
+
+std::optional<uint64_t> CoreFile::getLoadAddress(const std::string& path) const
+{
+    const auto realPath = getRealPath(path);
+    const auto baseName = getBaseName(path);
+
+    std::optional<uint64_t> byPath;
+    std::optional<uint64_t> byName;
+    for (const auto& file : files) {
+        if (file.path == realPath) {
+            byPath = std::min(byPath.value_or(file.start), file.start);
+        } else if (getBaseName(file.path) == baseName) {
+            byName = std::min(byName.value_or(file.start), file.start);
+        }
+    }
+    return byPath ? byPath : byName;
+}
+
+bool writeCoreFile(pid_t pid, const user_regs_struct& regs, const std::vector<CorePatch>& patches,
+    const std::string& path)
+{
+    const auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+
+    const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    std::vector<CoreFile::Thread> threads{{pid, 0, regs}};
+
+    // the traced thread is already stopped, the rest of the process is paused from here
+    const auto others = stopThreads(pid);
+    threads.insert(threads.end(), others.cbegin(), others.cend());
+
+    const auto mappings = readMappings(pid);
+    const auto pagemapPath = "/proc/" + std::to_string(pid) + "/pagemap";
+    const auto pagemap = open(pagemapPath.c_str(), O_RDONLY);
+
+    // memory goes right after elf header, notes and program headers follow it
+    uint64_t fileOffset = pageSize;
+    std::vector<LoadSegment> segments;
+    std::vector<CopyRange> copies;
+    for (const auto& mapping : mappings) {
+        planMapping(mapping, pagemap, pageSize, fileOffset, segments, copies);
+    }
+    if (pagemap >= 0) {
+        close(pagemap);
+    }
+
+    std::vector<uint8_t> buffer(COPY_CHUNK_SIZE);
+    bool success = true;
+    auto copy = copies.cbegin();
+    size_t copyDone = 0;
+    while (copy != copies.cend()) {
+        // gather up to a chunk worth of ranges, large ones are split
+        std::vector<MemoryRange> batch;
+        std::vector<CopyRange> targets;
+        size_t batchSize = 0;
+        while (copy != copies.cend() && batchSize < buffer.size()) {
+            const auto size = std::min(copy->size - copyDone, buffer.size() - batchSize);
+            batch.push_back({copy->address + copyDone, size});
+            targets.push_back({copy->address + copyDone, size, copy->offset + copyDone});
+            batchSize += size;
+            copyDone += size;
+            if (copyDone == copy->size) {
+                ++copy;
+                copyDone = 0;
+            }
+        }
+        readMemoryBatch(pid, batch, buffer.data());
+
+        auto* data = buffer.data();
+        for (const auto& target : targets) {
+            // memory should look like there are no breakpoints
+            auto patch = std::lower_bound(patches.cbegin(), patches.cend(), target.address,
+                [](const auto& patch, uint64_t address) { return patch.address < address; });
+            for (; patch != patches.cend() && patch->address < target.address + target.size; ++patch) {
+                data[patch->address - target.address] = patch->byte;
+            }
+
+            // zero pages stay holes of the sparse file
+            for (size_t page = 0; page < target.size;) {
+                if (isZero(data + page, pageSize)) {
+                    page += pageSize;
+                    continue;
+                }
+                auto end = page + pageSize;
+                while (end < target.size && !isZero(data + end, pageSize)) {
+                    end += pageSize;
+                }
+                const auto written = pwrite(fd, data + page, end - page, target.offset + page);
+                success = success && written == static_cast<ssize_t>(end - page);
+                page = end;
+            }
+            data += target.size;
+        }
+    }
+
+    for (const auto& thread : others) {
+        stats::ptrace(PTRACE_DETACH, thread.tid, nullptr, nullptr);
+    }
+
+    // process runs again, the rest doesn't need its memory
+    const auto notes = buildNotes(pid, threads, mappings, pageSize);
+    const auto notesOffset = fileOffset;
+    const auto headersOffset = (notesOffset + notes.size() + 7) & ~uint64_t{7};
+
+    std::vector<Elf64_Phdr> phdrs;
+    phdrs.push_back({PT_NOTE, 0, notesOffset, 0, 0, notes.size(), 0, 4});
+    for (const auto& segment : segments) {
+        phdrs.push_back({PT_LOAD, segment.flags, segment.offset, segment.address, 0,
+            segment.fileSize, segment.size, pageSize});
+    }
+
+    Elf64_Ehdr ehdr{};
+    std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_NONE;
+    ehdr.e_type = ET_CORE;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_phoff = headersOffset;
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    // like the kernel does for processes with many mappings: e_phnum is PN_XNUM and
+    // the count is in sh_info of the only section header, which follows program headers
+    Elf64_Shdr extendedNumbering{};
+    if (phdrs.size() < PN_XNUM) {
+        ehdr.e_phnum = static_cast<Elf64_Half>(phdrs.size());
+    } else {
+        ehdr.e_phnum = PN_XNUM;
+        ehdr.e_shoff = headersOffset + phdrs.size() * sizeof(Elf64_Phdr);
+        ehdr.e_shentsize = sizeof(Elf64_Shdr);
+        ehdr.e_shnum = 1;
+        ehdr.e_shstrndx = SHN_UNDEF;
+        extendedNumbering.sh_info = static_cast<Elf64_Word>(phdrs.size());
+    }
+
+    const uint64_t padding = 0;
+    iovec tail[] = {
+        {const_cast<uint8_t*>(notes.data()), notes.size()},
+        {const_cast<uint64_t*>(&padding), headersOffset - notesOffset - notes.size()},
+        {phdrs.data(), phdrs.size() * sizeof(Elf64_Phdr)},
+        {&extendedNumbering, ehdr.e_shnum * sizeof(Elf64_Shdr)},
+    };
+    const auto tailSize = tail[0].iov_len + tail[1].iov_len + tail[2].iov_len + tail[3].iov_len;
+    success = success && pwritev(fd, tail, 4, notesOffset) == static_cast<ssize_t>(tailSize);
+    success = success && pwrite(fd, &ehdr, sizeof(ehdr), 0) == sizeof(ehdr);
+
+    close(fd);
+    return success;
+}
+
+} // namespace tinydbg
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "memory.h"
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace tinydbg {
+
+// ELF core dump mapped into memory.
+// Nothing is read upfront besides headers and notes, memory of the
+// inferior is served straight from the mapping, so pages of the core
+// file are loaded by the kernel only when they're touched.
+class CoreFile {
+public:
+    struct Thread {
+        pid_t tid;
+        int signal;
+        user_regs_struct regs;
+    };
+
+    explicit CoreFile(const std::string& path);
+    ~CoreFile();
+
+    CoreFile(const CoreFile&) = delete;
+    CoreFile& operator=(const CoreFile&) = delete;
+
+    // pointer into the mapping or nullptr if range isn't backed by the core,
+    // parts of segments which weren't dumped (e.g. file backed) aren't available
+    const uint8_t* getPointer(uint64_t address, size_t size) const;
+    bool readMemory(uint64_t address, void* buffer, size_t size) const;
+
+    // parts of the address space which are present in the core
+    std::vector<MemoryRegion> getRegions() const;
+    const std::vector<Thread>& getThreads() const { return threads; }
+    // lowest address file with such path is mapped at, from NT_FILE note
+    std::optional<uint64_t> getLoadAddress(const std::string& path) const;
+
+private:
+    struct Segment {
+        uint64_t address;
+        uint64_t fileSize;
+        uint64_t memorySize;
+        uint64_t offset;
+    };
+
+    struct MappedFile {
+        uint64_t start;
+        uint64_t end;
+        uint64_t offset;
+        std::string path;
+    };
+
+    void parseNotes(const uint8_t* notes, size_t size);
+
+    const uint8_t* data;
+    size_t size;
+    // sorted by address
+    std::vector<Segment> segments;
+    std::vector<Thread> threads;
+    std::vector<MappedFile> files;
+};
+
+// seize and stop every thread but the traced one pid, new threads appearing while
+// the list is walked can be missed, PTRACE_DETACH resumes them
+std::vector<CoreFile::Thread> stopThreads(pid_t pid);
+
+// byte to put into the dump instead of what's in memory, e.g. under a breakpoint
+struct CorePatch {
+    uint64_t address;
+    uint8_t byte;
+};
+
+// Writes ELF core of the inferior whose thread pid is in ptrace stop with regs.
+// Other threads are stopped only while memory is copied, notes and headers
+// are written after they are resumed. Never touched anonymous pages, zero
+// pages and file backed pages which weren't modified are not written.
+bool writeCoreFile(pid_t pid, const user_regs_struct& regs, const std::vector<CorePatch>& patches,
+    const std::string& path);
+
+} // namespace tinydbg
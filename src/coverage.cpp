@@ -0,0 +1,134 @@
+#include "coverage.h"
+
+#include <cstdlib>
+#include <fstream>
+
+namespace tinydbg {
+
+namespace {
+
+// DA lines of an lcov tracefile, malformed ones are skipped
+Coverage::LineCounts readTracefile(const std::string& path)
+{
+    Coverage::LineCounts counts;
+    std::ifstream in{path};
+    std::string line;
+    std::map<size_t, uint64_t>* fileCounts = nullptr;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 3, "SF:") == 0) {
+            fileCounts = &counts[line.substr(3)];
+        } else if (line.compare(0, 3, "DA:") == 0 && fileCounts != nullptr) {
+            char* end = nullptr;
+            const auto lineNumber = std::strtoull(line.c_str() + 3, &end, 10);
+            if (end == line.c_str() + 3 || *end != ',') {
+                continue;
+            }
+            const auto* countStart = end + 1;
+            // DA may carry a checksum after the count
+            const auto count = std::strtoull(countStart, &end, 10);
+            if (end == countStart || (*end != '\0' && *end != ',')) {
+                continue;
+            }
+            (*fileCounts)[lineNumber] += count;
+        } else if (line == "end_of_record") {
+            fileCounts = nullptr;
+        }
+    }
+    return counts;
+}
+
+} // namespace
+
+void Coverage::addLine(uint64_t address, const std::string& file, size_t line)
+{
+    // map nodes are stable, so pointer to the key stays valid
+    auto fileIt = lines.try_emplace(file).first;
+    auto& counts = fileIt->second;
+    const auto [lineIt, inserted] = counts.try_emplace(line, 0);
+    if (!inserted && lineIt->second > 0) {
+        // line was already executed in previous runs
+        return;
+    }
+    pending[address].push_back({&fileIt->first, line});
+}
+
+std::vector<uint64_t> Coverage::pendingAddresses() const
+{
+    std::vector<uint64_t> addresses;
+    addresses.reserve(pending.size());
+    for (const auto& [address, refs] : pending) {
+        addresses.push_back(address);
+    }
+    return addresses;
+}
+
+void Coverage::hit(uint64_t address)
+{
+    const auto it = pending.find(address);
+    if (it == pending.end()) {
+        return;
+    }
+    for (const auto& ref : it->second) {
+        ++lines[*ref.file][ref.line];
+    }
+    pending.erase(it);
+}
+
+void Coverage::rebase(int64_t delta)
+{
+    std::unordered_map<uint64_t, std::vector<LineRef>> rebased;
+    for (auto& [address, refs] : pending) {
+        rebased[address + delta] = std::move(refs);
+    }
+    pending = std::move(rebased);
+}
+
+void Coverage::printSummary(std::ostream& out) const
+{
+    size_t total = 0;
+    size_t executed = 0;
+    for (const auto& [file, counts] : lines) {
+        size_t fileExecuted = 0;
+        for (const auto& [line, count] : counts) {
+            fileExecuted += count > 0;
+        }
+        out << file << ": " << std::dec << fileExecuted << '/' << counts.size() << " lines\n";
+        total += counts.size();
+        executed += fileExecuted;
+    }
+    out << "total: " << executed << '/' << total << " lines, "
+        << pending.size() << " breakpoints pending\n";
+}
+
+bool Coverage::save(const std::string& path)
+{
+    // tracefile of previous sessions is read once, saving again mustn't add our counts twice
+    auto baseline = baselines.find(path);
+    if (baseline == baselines.end()) {
+        baseline = baselines.emplace(path, readTracefile(path)).first;
+    }
+    auto merged = baseline->second;
+    for (const auto& [file, fileCounts] : lines) {
+        auto& mergedCounts = merged[file];
+        for (const auto& [lineNumber, count] : fileCounts) {
+            mergedCounts[lineNumber] += count;
+        }
+    }
+
+    std::ofstream out{path, std::ios::trunc};
+    if (!out) {
+        return false;
+    }
+    for (const auto& [file, fileCounts] : merged) {
+        size_t executed = 0;
+        out << "TN:\nSF:" << file << '\n';
+        for (const auto& [lineNumber, count] : fileCounts) {
+            out << "DA:" << lineNumber << ',' << count << '\n';
+            executed += count > 0;
+        }
+        out << "LF:" << fileCounts.size() << "\nLH:" << executed << "\nend_of_record\n";
+    }
+    return static_cast<bool>(out);
+}
+
+} // namespace tinydbg
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tinydbg {
+
+// Line coverage collected with one-shot breakpoints.
+// Debugger owns the breakpoints, coverage tells which ones are still needed.
+class Coverage {
+public:
+    // file -> line -> hit count
+    using LineCounts = std::map<std::string, std::map<size_t, uint64_t>>;
+
+    // address should be offset to process virtual memory
+    void addLine(uint64_t address, const std::string& file, size_t line);
+    bool isPending(uint64_t address) const { return pending.count(address) > 0; }
+    std::vector<uint64_t> pendingAddresses() const;
+
+    // mark lines at address as executed, address isn't pending afterwards
+    void hit(uint64_t address);
+    // move pending addresses by delta, used when process is relaunched
+    void rebase(int64_t delta);
+    void stop() { pending.clear(); }
+
+    void printSummary(std::ostream& out) const;
+    // write lcov tracefile, counts the file had before the first save of the session are added up
+    bool save(const std::string& path);
+
+private:
+    struct LineRef {
+        const std::string* file;
+        size_t line;
+    };
+
+    LineCounts lines;
+    // tracefile contents before this session saved to it, by path
+    std::map<std::string, LineCounts> baselines;
+    std::unordered_map<uint64_t, std::vector<LineRef>> pending;
+};
+
+} // namespace tinydbg
@@ -1,19 +1,32 @@
 #include "debugger.h"
 
-#include "registers.h"
+#include "gdbserver.h"
+#include "inject.h"
+#include "interpreter.h"
+#include "memory.h"
+#include "search.h"
+#include "stats.h"
+#include "syscalls.h"
 
 #include "linenoise.h"
 
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <utility>
 #include <sys/ptrace.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <vector>
 
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <linux/seccomp.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -51,11 +64,9 @@ std::vector<std::string> split(const std::string& s, char delimiter)
 }
 
 // ugly workaround to get offset from /proc/<pid>/maps
+// should be called after exec, when maps describe the debugee
 std::optional<uint64_t> getOffset(pid_t pid)
 {
-    // TODO get rid of this sleep
-    // wait to change /proc/<pid>/maps after fork
-    sleep(1);
     std::string filename = "/proc/" + std::to_string(pid) + "/maps";
     std::ifstream f{filename};
     if (f.good()) {
@@ -83,66 +94,275 @@ std::optional<uint64_t> parseAddress(const std::string& s)
     return std::stol(addr, 0, 16);
 }
 
+// memory is searched in chunks of this size, one process_vm_readv each
+constexpr size_t SEARCH_CHUNK_SIZE = 8 << 20;
+// matches printed by find commands
+constexpr size_t SEARCH_LIMIT = 100;
+// bytes shown of every memdiff change
+constexpr size_t MEMDIFF_BYTES = 16;
+// unchanged bytes between two changes which still make them one
+constexpr size_t MEMDIFF_GAP = 8;
+
+// bytes of the program file at link time address, memory may have int3 in them
+bool readCode(const elf::elf& file, uint64_t address, uint8_t* buffer, size_t size)
+{
+    for (const auto& section : file.sections()) {
+        const auto& header = section.get_hdr();
+        if (header.type == elf::sht::progbits && header.addr <= address && address + size <= header.addr + header.size) {
+            std::memcpy(buffer, static_cast<const uint8_t*>(section.data()) + (address - header.addr), size);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string describeAddress(uint64_t address, const std::vector<MemoryRegion>& regions)
+{
+    std::stringstream description;
+    description << "0x" << std::hex << address;
+    const auto region = std::find_if(regions.cbegin(), regions.cend(),
+        [address](const auto& region) { return region.start <= address && address < region.end; });
+    if (region != regions.cend() && !region->path.empty()) {
+        description << " in " << region->path;
+    }
+    return description.str();
+}
+
+// every debugee runs with these, forks made by checkpoints too
+constexpr long PTRACE_OPTIONS = PTRACE_O_TRACESECCOMP | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK
+    | PTRACE_O_TRACEVFORKDONE | PTRACE_O_TRACEEXEC;
+
+// candidates offered for a single tab press
+constexpr size_t COMPLETION_LIMIT = 32;
+
+using CommandArgs = std::vector<std::string>;
+
+struct Command {
+    const char* name;
+    void (*handler)(Debugger& debugger, const CommandArgs& args);
+    // usable before the program runs or after it exited
+    bool withoutProcess;
+    // usable on a core dump, nothing can be executed or written there
+    bool withCore;
+};
+
+// order decides abbreviations, "c" is continue and "b" is breakpoint
+const Command COMMANDS[] = {
+    {"continue", [](Debugger& debugger, const CommandArgs&) { debugger.continueExecution(); }, false, false},
+    {"breakpoint", [](Debugger& debugger, const CommandArgs& args) { debugger.handleBreakpoint(args); }, false, false},
+    {"register", [](Debugger& debugger, const CommandArgs& args) { debugger.handleRegister(args); }, false, true},
+    {"step", [](Debugger& debugger, const CommandArgs&) { debugger.stepIn(); }, false, false},
+    {"next", [](Debugger& debugger, const CommandArgs&) { debugger.stepOver(); }, false, false},
+    {"finish", [](Debugger& debugger, const CommandArgs&) { debugger.stepOut(); }, false, false},
+    {"stepi", [](Debugger& debugger, const CommandArgs&) { debugger.handleStepi(); }, false, false},
+    {"symbol", [](Debugger& debugger, const CommandArgs& args) { debugger.handleSymbol(args); }, true, true},
+    {"backtrace", [](Debugger& debugger, const CommandArgs&) { debugger.printBacktrace(); }, false, true},
+    {"variables", [](Debugger& debugger, const CommandArgs&) { debugger.readVariables(); }, false, true},
+    {"display", [](Debugger& debugger, const CommandArgs& args) { debugger.handleDisplay(args); }, false, true},
+    {"undisplay", [](Debugger& debugger, const CommandArgs& args) { debugger.handleUndisplay(args); }, false, true},
+    {"checkpoint", [](Debugger& debugger, const CommandArgs& args) { debugger.handleCheckpoint(args); }, false, false},
+    {"restart", [](Debugger& debugger, const CommandArgs& args) { debugger.handleRestart(args); }, false, false},
+    {"run", [](Debugger& debugger, const CommandArgs&) { debugger.handleRun(); }, true, false},
+    {"kill", [](Debugger& debugger, const CommandArgs&) { debugger.killProcess(); }, false, false},
+    {"trace", [](Debugger& debugger, const CommandArgs& args) { debugger.handleTrace(args); }, false, false},
+    {"coverage", [](Debugger& debugger, const CommandArgs& args) { debugger.handleCoverage(args); }, false, false},
+    {"catch", [](Debugger& debugger, const CommandArgs& args) { debugger.handleCatch(args); }, false, false},
+    {"memory", [](Debugger& debugger, const CommandArgs& args) { debugger.handleMemory(args); }, false, true},
+    {"thread", [](Debugger& debugger, const CommandArgs& args) { debugger.handleThread(args); }, false, true},
+    {"gcore", [](Debugger& debugger, const CommandArgs& args) { debugger.handleGcore(args); }, false, false},
+    {"find", [](Debugger& debugger, const CommandArgs& args) { debugger.handleFind(args); }, false, true},
+    {"find-pointers-to", [](Debugger& debugger, const CommandArgs& args) { debugger.handleFindPointers(args); }, false, true},
+    {"tracepoint", [](Debugger& debugger, const CommandArgs& args) { debugger.handleTracepoint(args); }, false, false},
+    {"stats", [](Debugger& debugger, const CommandArgs& args) { debugger.handleStats(args); }, true, true},
+    {"inferior", [](Debugger& debugger, const CommandArgs& args) { debugger.handleInferior(args); }, true, false},
+    {"memdiff", [](Debugger& debugger, const CommandArgs& args) { debugger.handleMemdiff(args); }, false, false},
+};
+
+// every prefix of every command name resolves to the first command in the table it abbreviates
+const Command* findCommand(const std::string& abbreviation)
+{
+    static const auto prefixes = [] {
+        std::unordered_map<std::string, const Command*> prefixes;
+        for (const auto& command : COMMANDS) {
+            const std::string name{command.name};
+            for (size_t size = 1; size <= name.size(); ++size) {
+                prefixes.emplace(name.substr(0, size), &command);
+            }
+        }
+        return prefixes;
+    }();
+
+    const auto it = prefixes.find(abbreviation);
+    return it != prefixes.cend() ? it->second : nullptr;
+}
+
+const PrefixIndex& getCommandIndex()
+{
+    static const auto index = [] {
+        PrefixIndex index;
+        for (const auto& command : COMMANDS) {
+            index.add(command.name);
+        }
+        index.build();
+        return index;
+    }();
+    return index;
+}
+
+// general purpose ones and everything XSAVE may have
+const PrefixIndex& getRegisterIndex()
+{
+    static const auto index = [] {
+        PrefixIndex index;
+        for (const auto& descriptor : REGISTOR_DESCRIPTORS) {
+            index.add(descriptor.name);
+        }
+        for (size_t i = 0; i < 32; ++i) {
+            for (const auto* prefix : {"xmm", "ymm", "zmm"}) {
+                index.add(prefix + std::to_string(i));
+            }
+        }
+        for (size_t i = 0; i < 8; ++i) {
+            index.add("st" + std::to_string(i));
+            index.add("k" + std::to_string(i));
+        }
+        index.add("mxcsr");
+        index.build();
+        return index;
+    }();
+    return index;
+}
+
+// run loop of the current prompt, linenoise callback has no user data
+Debugger* completingDebugger = nullptr;
+
+void completeLine(const char* line, linenoiseCompletions* completions)
+{
+    if (completingDebugger == nullptr) {
+        return;
+    }
+    try {
+        for (const auto& candidate : completingDebugger->complete(line)) {
+            linenoiseAddCompletion(completions, candidate.c_str());
+        }
+    } catch (const std::exception&) {
+        // broken debug info shouldn't end the session on tab
+    }
+}
+
+// little endian register bytes as one hex number
+std::string formatVectorRegister(const std::vector<uint8_t>& bytes)
+{
+    std::stringstream stream;
+    stream << "0x" << std::hex << std::setfill('0');
+    for (auto it = bytes.crbegin(); it != bytes.crend(); ++it) {
+        stream << std::setw(2) << static_cast<unsigned>(*it);
+    }
+    return stream.str();
+}
+
 siginfo_t getSigInfo(pid_t pid)
 {
     siginfo_t info;
-    ptrace(PTRACE_GETSIGINFO, pid, nullptr, &info);
+    stats::ptrace(PTRACE_GETSIGINFO, pid, nullptr, &info);
     return info;
 }
 
-class PtraceExprContext : public dwarf::expr_context {
+// injected fork makes the caught syscall issue again, it would be caught a second time
+bool isAtSeccompStop(pid_t pid)
+{
+    return getSigInfo(pid).si_code == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8));
+}
+
+// used for location expressions we can't compile ourselves
+class SnapshotExprContext : public dwarf::expr_context {
 public:
-    PtraceExprContext(pid_t pid)
-        : pid{pid}
+    SnapshotExprContext(const Debugger& debugger, const user_regs_struct& regs)
+        : debugger{debugger}
+        , regs{regs}
     {
     }
 
     dwarf::taddr reg(unsigned regnum) override
     {
-        return getRegisterValueFromDwarf(pid, static_cast<int>(regnum));
+        return debugger.getDwarfRegisterValue(static_cast<int>(regnum));
     }
 
     dwarf::taddr pc() override
     {
-        struct user_regs_struct regs;
-        ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
         return regs.rip;
     }
 
-    dwarf::taddr deref_size(dwarf::taddr address, unsigned size)
+    dwarf::taddr deref_size(dwarf::taddr address, unsigned size) override
     {
-        // TODO take size into account
-        return ptrace(PTRACE_PEEKDATA, pid, address, nullptr);
+        dwarf::taddr value = 0;
+        debugger.readMemory(address, &value, std::min<size_t>(size, sizeof(value)));
+        return value;
     }
 
 private:
-    pid_t pid;
+    const Debugger& debugger;
+    const user_regs_struct& regs;
+};
+
+// threads of stopThreads are let go at the end of scope
+struct ResumeThreads {
+    const std::vector<CoreFile::Thread>& threads;
+    ~ResumeThreads()
+    {
+        for (const auto& thread : threads) {
+            stats::ptrace(PTRACE_DETACH, thread.tid, nullptr, nullptr);
+        }
+    }
 };
 
 } // namespace
 
-Debugger::Debugger(std::string programName, int pid)
+Debugger::Debugger(std::string programName, int pid, std::vector<int> caughtSyscalls, std::string agentLibrary,
+    const std::vector<std::string>& debugDirectories)
     : programName{std::move(programName)}
     , pid{pid}
     , memoryOffset{0}
+    , binaries{debugDirectories}
+    , breakpoints{pid}
+    , caughtSyscalls{caughtSyscalls.cbegin(), caughtSyscalls.cend()}
+    , filteredSyscalls{caughtSyscalls.cbegin(), caughtSyscalls.cend()}
+    , agentLibrary{std::move(agentLibrary)}
 {
-    auto offset = getOffset(pid);
-    if (offset) {
-        memoryOffset = *offset;
-    } else {
-        std::cerr << "Failed to get proc memory offset\n";
-    }
+    binary = binaries.load(this->programName);
+}
 
-    auto fd = open(this->programName.c_str(), O_RDONLY);
+Debugger::Debugger(std::string programName, std::shared_ptr<CoreFile> core, const std::vector<std::string>& debugDirectories)
+    : Debugger{std::move(programName), 0, {}, {}, debugDirectories}
+{
+    this->core = std::move(core);
+}
 
-    elf = elf::elf{elf::create_mmap_loader(fd)};
-    dwarf = dwarf::dwarf{dwarf::elf::create_loader(elf)};
+void Debugger::initialize()
+{
+    if (core) {
+        // main executable is the first mapping of the program, like for a live process
+        memoryOffset = core->getLoadAddress(programName).value_or(0);
+        const auto& threads = core->getThreads();
+        if (!threads.empty()) {
+            std::cerr << "Core was generated by pid " << std::dec << threads.front().tid;
+            if (threads.front().signal != 0) {
+                std::cerr << ", terminated by signal: " << strsignal(threads.front().signal);
+            }
+            std::cerr << std::endl;
+        }
+    } else {
+        waitForSignal();
+        updateMemoryOffset();
+    }
 }
 
 void Debugger::run()
 {
-    waitForSignal();
+    initialize();
 
+    completingDebugger = this;
+    linenoiseSetCompletionCallback(completeLine);
     char* line = linenoise("tinydbg> ");
     while (line != nullptr) {
         handleCommand(line);
@@ -150,36 +370,131 @@ void Debugger::run()
         linenoiseFree(line);
         line = linenoise("tinydbg> ");
     }
+    completingDebugger = nullptr;
 }
 
 void Debugger::handleCommand(const std::string& line)
+{
+    // bad arguments like "undisplay x" end the command, not the session
+    try {
+        executeCommand(line);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
+}
+
+void Debugger::executeCommand(const std::string& line)
 {
     auto args = split(line, ' ');
-    const auto& command = args[0];
-
-    if (isPrefix(command, "continue")) {
-        continueExecution();
-    } else if (isPrefix(command, "breakpoint")) {
-        handleBreakpoint(args);
-    } else if (isPrefix(command, "register")) {
-        handleRegister(args);
-    } else if (isPrefix(command, "step")) {
-        stepIn();
-    } else if (isPrefix(command, "next")) {
-        stepOver();
-    } else if (isPrefix(command, "finish")) {
-        stepOut();
-    } else if (isPrefix(command, "stepi")) {
-        handleStepi();
-    } else if (isPrefix(command, "symbol")) {
-        handleSymbol(args);
-    } else if (isPrefix(command, "backtrace")) {
-        printBacktrace();
-    } else if (isPrefix(command, "variables")) {
-        readVariables();
-    } else {
+    if (args.empty()) {
+        return;
+    }
+
+    const auto* command = findCommand(args[0]);
+    if (command == nullptr) {
         std::cerr << "Unknown command\n";
+        return;
+    }
+
+    if (core) {
+        // nothing can be executed or written, there is no process
+        if (!command->withCore) {
+            std::cerr << "Not available when debugging a core file\n";
+            return;
+        }
+    } else if (pid == 0 && !command->withoutProcess) {
+        std::cerr << "The program is not being run\n";
+        return;
+    }
+
+    const stats::CommandTimer timer{command->name};
+    command->handler(*this, args);
+}
+
+std::string Debugger::resolveCommand(const std::string& abbreviation)
+{
+    const auto* command = findCommand(abbreviation);
+    return command != nullptr ? command->name : std::string{};
+}
+
+std::vector<std::string> Debugger::complete(const std::string& line)
+{
+    // completions replace the whole line, they keep everything before the last word
+    const auto wordStart = line.rfind(' ') + 1;
+    const auto head = line.substr(0, wordStart);
+    const auto word = line.substr(wordStart);
+    const auto args = split(head, ' ');
+
+    std::vector<std::string> candidates;
+    if (args.empty()) {
+        candidates = getCommandIndex().find(word, COMPLETION_LIMIT);
+    } else {
+        const auto command = resolveCommand(args[0]);
+        if (args.size() == 1
+            && (command == "breakpoint" || command == "tracepoint" || command == "trace" || command == "symbol")) {
+            candidates = getSymbolIndex().find(word, COMPLETION_LIMIT);
+            if (command == "breakpoint" || command == "tracepoint") {
+                for (auto& file : getFileIndex().find(word, COMPLETION_LIMIT)) {
+                    candidates.push_back(file + ':');
+                }
+            }
+        } else if (command == "register" && args.size() == 2) {
+            candidates = getRegisterIndex().find(word, COMPLETION_LIMIT);
+        } else if (command == "display" && args.size() == 1 && !word.empty() && word[0] == '$') {
+            for (const auto& name : getRegisterIndex().find(word.substr(1), COMPLETION_LIMIT)) {
+                candidates.push_back('$' + name);
+            }
+        }
+    }
+
+    for (auto& candidate : candidates) {
+        candidate = head + candidate;
+    }
+    return candidates;
+}
+
+const PrefixIndex& Debugger::getSymbolIndex()
+{
+    if (binary->symbolIndex) {
+        return *binary->symbolIndex;
+    }
+
+    // what breakpoint, trace and symbol accept: DWARF function names, raw and demangled ELF symbols
+    binary->symbolIndex.emplace();
+    for (const auto& cu : binary->dwarf.compilation_units()) {
+        for (const auto& die : binary->debugInfo.getUnitRoot(cu)) {
+            if (die.tag == dwarf::DW_TAG::subprogram && die.has(dwarf::DW_AT::name)) {
+                binary->symbolIndex->add(at_name(die));
+            }
+        }
+    }
+    for (const auto& section : binary->debugInfo.getSymbolTables()) {
+        for (auto sym : section.as_symtab()) {
+            auto name = sym.get_name();
+            if (name.empty()) {
+                continue;
+            }
+            auto demangled = demangle(name);
+            if (demangled != name) {
+                binary->symbolIndex->add(demangled.substr(0, demangled.find('(')));
+            }
+            binary->symbolIndex->add(std::move(name));
+        }
+    }
+    binary->symbolIndex->build();
+    return *binary->symbolIndex;
+}
+
+const PrefixIndex& Debugger::getFileIndex()
+{
+    if (!binary->fileIndex) {
+        binary->fileIndex.emplace();
+        for (const auto& cu : binary->dwarf.compilation_units()) {
+            binary->fileIndex->add(at_name(cu.root()));
+        }
+        binary->fileIndex->build();
     }
+    return *binary->fileIndex;
 }
 
 void Debugger::handleBreakpoint(const std::vector<std::string>& args)
@@ -189,19 +504,27 @@ void Debugger::handleBreakpoint(const std::vector<std::string>& args)
         return;
     }
 
-    if (isPrefix("0x", args[1])) {
-        auto address = parseAddress(args[1]);
+    setBreakpointAtSpec(args[1]);
+    if (std::find(breakpointSpecs.cbegin(), breakpointSpecs.cend(), args[1]) == breakpointSpecs.cend()) {
+        breakpointSpecs.push_back(args[1]);
+    }
+}
+
+void Debugger::setBreakpointAtSpec(const std::string& spec)
+{
+    if (isPrefix("0x", spec)) {
+        auto address = parseAddress(spec);
         if (!address) {
             std::cerr << "Failed to parse address, expected format: 0xADDRESS\n";
             return;
         }
         auto offsettedAddress = getOffsettedAddress(*address);
         setBreakpoint(offsettedAddress);
-    } else if (args[1].find(':') != std::string::npos) {
-        auto fileAndLine = split(args[1], ':');
+    } else if (spec.find(':') != std::string::npos) {
+        auto fileAndLine = split(spec, ':');
         setBreakpointAtLine(fileAndLine[0], std::stoi(fileAndLine[1]));
     } else {
-        setBreakpointAtFunction(args[1]);
+        setBreakpointAtFunction(spec);
     }
 }
 
@@ -213,7 +536,13 @@ void Debugger::handleRegister(const std::vector<std::string>& args)
     }
 
     if (isPrefix(args[1], "dump")) {
-        dumpRegisters(pid);
+        dumpRegisters(getRegisters());
+        if (args.size() > 2 && isPrefix(args[2], "vector")) {
+            const auto& xstate = getXState();
+            for (const auto& name : xstate.getRegisterNames()) {
+                std::cerr << name << ' ' << formatVectorRegister(xstate.getRegister(name)) << '\n';
+            }
+        }
         return;
     }
 
@@ -224,13 +553,25 @@ void Debugger::handleRegister(const std::vector<std::string>& args)
 
     const auto reg = getRegister(args[2]);
     if (!reg) {
-        std::cerr << "Unknown register: '" << args[2] << "'\n";
+        // x87 and vector registers come from the XSAVE area, fetched only now
+        const auto bytes = getXState().getRegister(args[2]);
+        if (bytes.empty()) {
+            std::cerr << "Unknown register: '" << args[2] << "'\n";
+        } else if (isPrefix(args[1], "read")) {
+            std::cerr << formatVectorRegister(bytes) << std::endl;
+        } else {
+            std::cerr << "Only general purpose registers can be written\n";
+        }
         return;
     }
 
     if (isPrefix(args[1], "read")) {
-        std::cerr << "0x" << std::hex << getRegisterValue(pid, *reg) << std::endl;
+        std::cerr << "0x" << std::hex << getRegisterValue(getRegisters(), *reg) << std::endl;
     } else if (isPrefix(args[1], "write")) {
+        if (core) {
+            std::cerr << "Core file is read only\n";
+            return;
+        }
         if (args.size() < 4) {
             std::cerr << "Insufficient num of args to write register\n";
             return;
@@ -242,7 +583,7 @@ void Debugger::handleRegister(const std::vector<std::string>& args)
             return;
         }
 
-        setRegisterValue(pid, *reg, *address);
+        setRegister(*reg, *address);
     } else {
         std::cerr << "Unknown register command: '" << args[1] << "'\n";
     }
@@ -264,6 +605,10 @@ void Debugger::handleMemory(const std::vector<std::string>& args)
     if (isPrefix(args[1], "read")) {
         std::cerr << std::hex << readMemory(*address) << std::endl;
     } else if (isPrefix(args[1], "write")) {
+        if (core) {
+            std::cerr << "Core file is read only\n";
+            return;
+        }
         if (args.size() < 4) {
             std::cerr << "Insufficient num of args to write memory\n";
             return;
@@ -281,8 +626,12 @@ void Debugger::handleMemory(const std::vector<std::string>& args)
 void Debugger::handleStepi()
 {
     singleStepInstructionWithBpCheck();
+    if (pid == 0) {
+        return;
+    }
     const auto line = getLineEntry(getPC());
     printSource(line->file->path, line->line);
+    refreshDisplays();
 }
 void Debugger::handleSymbol(const std::vector<std::string>& args)
 {
@@ -295,66 +644,1355 @@ void Debugger::handleSymbol(const std::vector<std::string>& args)
 
 void Debugger::continueExecution()
 {
+    do {
+        resume();
+        waitForSignal(0, /*anyInferior*/ true);
+    } while (pid != 0 && resumeAfterStop);
+}
+
+void Debugger::resume(int signal)
+{
+    resumeAfterStop = false;
     stepOverBreakpoint();
-    ptrace(PTRACE_CONT, pid, nullptr, nullptr);
-    waitForSignal();
+    stats::ptrace(PTRACE_CONT, pid, nullptr, signal);
+}
+
+void Debugger::detach()
+{
+    while (pid != 0) {
+        for (auto& [address, breakpoint] : breakpoints) {
+            if (breakpoint.isEnabled()) {
+                breakpoint.disable();
+            }
+        }
+        if (tracepoints) {
+            // the agent keeps serving jumps which can't be taken out, nobody drains its ring though
+            if (!removeTracepoints()) {
+                std::cerr << "Tracepoints stay in pid " << std::dec << pid << std::endl;
+            }
+            tracepoints.reset();
+        }
+        stats::ptrace(PTRACE_DETACH, pid, nullptr, nullptr);
+        std::cerr << "Detached from pid " << std::dec << pid << std::endl;
+        // the filter traces syscalls to nobody now, the kernel fails them
+        if (!filteredSyscalls.empty()) {
+            std::cerr << "Seccomp filter stays in pid " << pid << ", its caught syscalls fail with ENOSYS\n";
+        }
+        pid = 0;
+        clearRegisterCache();
+
+        // followed forks go too, stopped first to take breakpoints out of their memory
+        if (!inferiors.empty()) {
+            const auto running = inferiors.back().running;
+            switchInferior(inferiors.size() - 1, /*currentRunning*/ false);
+            if (running) {
+                if (!stopRequested) {
+                    kill(pid, SIGSTOP);
+                }
+                int waitStatus;
+                stats::waitpid(pid, &waitStatus, __WALL);
+                if (!WIFSTOPPED(waitStatus)) {
+                    pid = 0;
+                }
+            }
+        }
+    }
 }
 
 void Debugger::printBacktrace()
 {
-    auto outputFrame = [frameNumber = 0](auto&& func) mutable {
-        std::cerr << "frame #" << frameNumber++
-                  << ": 0x" << dwarf::at_low_pc(func)
-                  << ' ' << dwarf::at_name(func) << std::endl;
+    const auto frames = getBacktrace();
+    for (size_t i = 0; i < frames.size(); ++i) {
+        std::cerr << "frame #" << std::dec << i
+                  << ": 0x" << std::hex << frames[i].address
+                  << ' ' << frames[i].function << std::endl;
+    }
+}
+
+std::vector<Debugger::Frame> Debugger::getBacktrace()
+{
+    std::vector<Frame> frames;
+    auto addFrame = [this, &frames](uint64_t pc) {
+        const auto function = getFunction(pc);
+        frames.push_back({pc, dwarf::at_low_pc(function), dwarf::at_name(function)});
     };
 
-    auto currentFunc = getFunction(getPC());
-    outputFrame(currentFunc);
-    auto framePointer = getRegisterValue(pid, Register::rbp);
+    addFrame(getPC());
+    auto framePointer = getRegisterValue(getRegisters(), Register::rbp);
     auto returnAddress = readMemory(framePointer + 8);
 
-    do {
-        currentFunc = getFunction(returnAddress);
-        outputFrame(currentFunc);
-        framePointer = readMemory(framePointer);
-        returnAddress = readMemory(framePointer + 8);
-    } while (dwarf::at_name(currentFunc) != "main");
+    do {
+        addFrame(returnAddress);
+        framePointer = readMemory(framePointer);
+        returnAddress = readMemory(framePointer + 8);
+    } while (frames.back().function != "main");
+    return frames;
+}
+
+void Debugger::handleDisplay(const std::vector<std::string>& args)
+{
+    if (args.size() < 2) {
+        refreshDisplays(/*force*/ true);
+        return;
+    }
+
+    displays.push_back({nextDisplayNumber++, args[1], {}, false});
+    refreshDisplays();
+}
+
+void Debugger::handleUndisplay(const std::vector<std::string>& args)
+{
+    if (args.size() < 2) {
+        displays.clear();
+        return;
+    }
+
+    const auto number = std::stoul(args[1]);
+    const auto it = std::find_if(displays.begin(), displays.end(),
+        [number](const auto& display) { return display.number == number; });
+    if (it == displays.end()) {
+        std::cerr << "No display number " << number << std::endl;
+        return;
+    }
+    displays.erase(it);
+}
+
+void Debugger::handleCheckpoint(const std::vector<std::string>& args)
+{
+    if (args.size() >= 2 && isPrefix(args[1], "list")) {
+        for (const auto& checkpoint : checkpoints) {
+            std::cerr << checkpoint.number << ": pid " << std::dec << checkpoint.pid
+                      << " at 0x" << std::hex << checkpoint.pc << std::endl;
+        }
+        return;
+    }
+
+    if (args.size() >= 3 && isPrefix(args[1], "delete")) {
+        const auto number = std::stoul(args[2]);
+        const auto it = std::find_if(checkpoints.begin(), checkpoints.end(),
+            [number](const auto& checkpoint) { return checkpoint.number == number; });
+        if (it == checkpoints.end()) {
+            std::cerr << "No checkpoint number " << number << std::endl;
+            return;
+        }
+        kill(it->pid, SIGKILL);
+        stats::waitpid(it->pid, nullptr, __WALL);
+        checkpoints.erase(it);
+        return;
+    }
+
+    if (isAtSeccompStop(pid)) {
+        std::cerr << "Can't create checkpoint at a caught syscall, step or continue first\n";
+        return;
+    }
+    // fork shares memory pages with the inferior until either of them writes,
+    // so taking a checkpoint is cheap regardless of the inferior size
+    const auto fork = injectFork(pid, PTRACE_OPTIONS);
+    // pc and syscall registers are changed when a syscall is issued again on resume
+    clearRegisterCache();
+    if (!fork) {
+        std::cerr << "Failed to create checkpoint\n";
+        return;
+    }
+
+    checkpoints.push_back({nextCheckpointNumber++, *fork, getPC(), breakpoints});
+    std::cerr << "Checkpoint " << checkpoints.back().number
+              << ": pid " << std::dec << *fork
+              << " at 0x" << std::hex << getPC() << std::endl;
+}
+
+void Debugger::handleRestart(const std::vector<std::string>& args)
+{
+    if (args.size() < 2) {
+        std::cerr << "Insufficient num of args to restart\n";
+        return;
+    }
+
+    const auto number = std::stoul(args[1]);
+    const auto checkpoint = std::find_if(checkpoints.cbegin(), checkpoints.cend(),
+        [number](const auto& checkpoint) { return checkpoint.number == number; });
+    if (checkpoint == checkpoints.cend()) {
+        std::cerr << "No checkpoint number " << number << std::endl;
+        return;
+    }
+
+    // run a fork of the checkpoint, so it can be restarted again later
+    const auto fork = injectFork(checkpoint->pid, PTRACE_OPTIONS);
+    if (!fork) {
+        std::cerr << "Failed to restart from checkpoint\n";
+        return;
+    }
+
+    const auto isCheckpoint = std::any_of(checkpoints.cbegin(), checkpoints.cend(),
+        [this](const auto& checkpoint) { return checkpoint.pid == pid; });
+    if (!isCheckpoint) {
+        kill(pid, SIGKILL);
+        stats::waitpid(pid, nullptr, __WALL);
+    }
+
+    pid = *fork;
+    clearRegisterCache();
+    if (tracepoints) {
+        tracepoints->setPid(pid);
+    }
+
+    // memory of the fork contains breakpoints which were set at checkpoint time,
+    // bring it in sync with the current breakpoints
+    for (auto [address, breakpoint] : checkpoint->breakpoints) {
+        if (breakpoint.isEnabled()) {
+            breakpoint.setPid(pid);
+            breakpoint.disable();
+        }
+    }
+    breakpoints.setPid(pid);
+    for (auto& [address, breakpoint] : breakpoints) {
+        if (breakpoint.isEnabled()) {
+            breakpoint.enable();
+        }
+    }
+
+    std::cerr << "Switched to pid " << std::dec << pid
+              << " at 0x" << std::hex << getPC() << std::endl;
+    const auto lineEntry = getLineEntry(getPC());
+    printSource(lineEntry->file->path, lineEntry->line);
+    refreshDisplays(/*force*/ true);
+}
+
+void Debugger::handleRun()
+{
+    if (pid != 0) {
+        killProcess();
+    }
+    tracepoints.reset();
+
+    // checkpoints and forks belong to the previous process image
+    for (const auto& checkpoint : checkpoints) {
+        kill(checkpoint.pid, SIGKILL);
+        stats::waitpid(checkpoint.pid, nullptr, __WALL);
+    }
+    checkpoints.clear();
+    for (const auto& inferior : inferiors) {
+        kill(inferior.pid, SIGKILL);
+        stats::waitpid(inferior.pid, nullptr, __WALL);
+    }
+    inferiors.clear();
+    unknownForks.clear();
+    dropMemorySnapshot();
+
+    // the current inferior may have executed another program
+    const auto program = binaries.load(programName);
+    if (program != binary) {
+        // addresses of the previous build mean nothing, what break was given is resolved again
+        binary = program;
+        size_t dropped = 0;
+        for (const auto& [address, breakpoint] : std::as_const(breakpoints)) {
+            dropped += internalBreakpoints.count(address) == 0;
+        }
+        if (dropped > 0) {
+            std::cerr << "Program changed, its " << std::dec << dropped << " breakpoints are dropped, "
+                      << breakpointSpecs.size() << " given to break are set again once it's loaded\n";
+        }
+        breakpoints = BreakpointTable{};
+        resolveSpecsOnExec = true;
+    }
+
+    // elf, dwarf and compiled locations don't depend on the process, keep them,
+    // exec of the program moves breakpoints to the new process
+    pid = launch(programName, caughtSyscalls, agentLibrary);
+    filteredSyscalls = caughtSyscalls;
+    if (pid < 0) {
+        std::cerr << "fork failed, pid: " << pid << std::endl;
+        pid = 0;
+        return;
+    }
+    waitForSignal();
+
+    continueExecution();
+}
+
+void Debugger::killProcess()
+{
+    if (pid == 0) {
+        return;
+    }
+
+    dropMemorySnapshot();
+    kill(pid, SIGKILL);
+    stats::waitpid(pid, nullptr, __WALL);
+    std::cerr << "Killed pid " << std::dec << pid << std::endl;
+    pid = 0;
+    clearRegisterCache();
+    // agent memory belonged to the killed process
+    tracepoints.reset();
+}
+
+void Debugger::handleTrace(const std::vector<std::string>& args)
+{
+    if (args.size() < 2) {
+        std::cerr << "Insufficient num of args to trace\n";
+        return;
+    }
+
+    if (args[1] == "dump") {
+        const size_t count = args.size() > 2 ? std::stoul(args[2]) : 100;
+        tracer.dump(std::cerr, count);
+    } else if (args[1] == "stats") {
+        tracer.printStats(std::cerr);
+    } else if (args[1] == "clear") {
+        tracer.clearEvents();
+    } else if (args[1] == "stop") {
+        stopTracing();
+    } else {
+        auto pattern = args[1];
+        if (pattern.size() >= 2 && (pattern.front() == '\'' || pattern.front() == '"')
+            && pattern.back() == pattern.front()) {
+            pattern = pattern.substr(1, pattern.size() - 2);
+        }
+        traceFunctions(pattern);
+    }
+}
+
+void Debugger::traceFunctions(const std::string& pattern)
+{
+    size_t traced = 0;
+    std::vector<uint64_t> added;
+    for (const auto& section : binary->debugInfo.getSymbolTables()) {
+        if (section.get_hdr().type != elf::sht::symtab) {
+            continue;
+        }
+
+        for (auto sym : section.as_symtab()) {
+            const auto& data = sym.get_data();
+            if (data.type() != elf::stt::func || data.value == 0) {
+                continue;
+            }
+
+            const auto name = demangle(sym.get_name());
+            // match "ns::f" pattern both against "ns::f(int)" and "ns::f"
+            const auto shortName = name.substr(0, name.find('('));
+            if (fnmatch(pattern.c_str(), name.c_str(), 0) != 0
+                && fnmatch(pattern.c_str(), shortName.c_str(), 0) != 0
+                && fnmatch(pattern.c_str(), sym.get_name().c_str(), 0) != 0) {
+                continue;
+            }
+
+            // breakpoint at the very first instruction, before prologue,
+            // so that return address is on top of the stack
+            const auto address = getOffsettedAddress(data.value);
+            tracer.addFunction(address, name);
+            ++traced;
+            if (breakpoints.count(address) == 0) {
+                breakpoints.insert({address, Breakpoint{pid, address}});
+                internalBreakpoints.insert(address);
+                added.push_back(address);
+            }
+        }
+    }
+
+    std::vector<Breakpoint*> toEnable;
+    for (const auto address : added) {
+        toEnable.push_back(&breakpoints.at(address));
+    }
+    Breakpoint::enableAll(pid, toEnable);
+
+    std::cerr << "Tracing " << std::dec << traced << " functions\n";
+}
+
+void Debugger::stopTracing()
+{
+    std::vector<uint64_t> addresses = tracer.entryAddresses();
+    const auto returns = tracer.returnAddresses();
+    addresses.insert(addresses.end(), returns.cbegin(), returns.cend());
+    tracer.clear();
+
+    for (const auto address : addresses) {
+        if (!isInternalBreakpointNeeded(address) && internalBreakpoints.erase(address) > 0) {
+            removeBreakpoint(address);
+        }
+    }
+}
+
+void Debugger::handleCoverage(const std::vector<std::string>& args)
+{
+    if (args.size() < 2) {
+        coverage.printSummary(std::cerr);
+        return;
+    }
+
+    if (args[1] == "start") {
+        startCoverage();
+    } else if (args[1] == "stop") {
+        stopCoverage();
+    } else if (args[1] == "save") {
+        if (args.size() < 3) {
+            std::cerr << "Insufficient num of args to save coverage\n";
+            return;
+        }
+        if (!coverage.save(args[2])) {
+            std::cerr << "Failed to write " << args[2] << std::endl;
+        }
+    } else {
+        std::cerr << "Unknown coverage command: '" << args[1] << "'\n";
+    }
+}
+
+void Debugger::startCoverage()
+{
+    for (const auto& cu : binary->dwarf.compilation_units()) {
+        for (const auto& entry : cu.get_line_table()) {
+            if (entry.is_stmt && !entry.end_sequence) {
+                coverage.addLine(getOffsettedAddress(entry.address), entry.file->path, entry.line);
+            }
+        }
+    }
+
+    std::vector<uint64_t> added;
+    for (const auto address : coverage.pendingAddresses()) {
+        if (breakpoints.count(address) == 0) {
+            breakpoints.insert({address, Breakpoint{pid, address}});
+            internalBreakpoints.insert(address);
+            added.push_back(address);
+        }
+    }
+
+    // lots of breakpoints close to each other, write them page by page
+    std::vector<Breakpoint*> toEnable;
+    for (const auto address : added) {
+        toEnable.push_back(&breakpoints.at(address));
+    }
+    Breakpoint::enableAll(pid, toEnable);
+
+    std::cerr << "Coverage breakpoints: " << std::dec << added.size() << std::endl;
+}
+
+void Debugger::stopCoverage()
+{
+    const auto addresses = coverage.pendingAddresses();
+    coverage.stop();
+
+    for (const auto address : addresses) {
+        if (!isInternalBreakpointNeeded(address) && internalBreakpoints.erase(address) > 0) {
+            removeBreakpoint(address);
+        }
+    }
+}
+
+void Debugger::handleCoverageHit(uint64_t pc)
+{
+    if (!coverage.isPending(pc)) {
+        return;
+    }
+
+    coverage.hit(pc);
+    // one-shot: once every line is hit coverage costs nothing
+    if (!isInternalBreakpointNeeded(pc) && internalBreakpoints.erase(pc) > 0) {
+        removeBreakpoint(pc);
+    }
+}
+
+void Debugger::handleCatch(const std::vector<std::string>& args)
+{
+    if (args.size() < 2 || !isPrefix(args[1], "syscall")) {
+        std::cerr << "Usage: catch syscall [name...|none]\n";
+        return;
+    }
+
+    if (args.size() == 2) {
+        for (const auto number : caughtSyscalls) {
+            std::cerr << getSyscallName(number)
+                      << (filteredSyscalls.count(number) > 0 ? "" : " (after run)") << std::endl;
+        }
+        return;
+    }
+
+    if (args[2] == "none") {
+        // filter can't be removed from running process, its stops are skipped
+        caughtSyscalls.clear();
+        return;
+    }
+
+    bool needsRestart = false;
+    for (size_t i = 2; i < args.size(); ++i) {
+        const auto number = getSyscallNumber(args[i]);
+        if (!number) {
+            std::cerr << "Unknown syscall: '" << args[i] << "'\n";
+            continue;
+        }
+        caughtSyscalls.insert(*number);
+        needsRestart = needsRestart || filteredSyscalls.count(*number) == 0;
+    }
+
+    if (needsRestart) {
+        std::cerr << "Seccomp filter is installed at program start, new syscalls are caught after run\n";
+    }
+}
+
+void Debugger::handleThread(const std::vector<std::string>& args)
+{
+    if (!core) {
+        std::cerr << "Only the traced thread is available\n";
+        return;
+    }
+
+    const auto& threads = core->getThreads();
+    if (args.size() < 2) {
+        for (size_t i = 0; i < threads.size(); ++i) {
+            std::cerr << (i == currentThread ? "* " : "  ") << std::dec << i
+                      << ": tid " << threads[i].tid
+                      << " at 0x" << std::hex << threads[i].regs.rip << std::endl;
+        }
+        return;
+    }
+
+    const auto number = std::stoul(args[1]);
+    if (number >= threads.size()) {
+        std::cerr << "No thread number " << number << std::endl;
+        return;
+    }
+    currentThread = number;
+    clearRegisterCache();
+    refreshDisplays(/*force*/ true);
+}
+
+void Debugger::handleGcore(const std::vector<std::string>& args)
+{
+    if (args.size() < 2) {
+        std::cerr << "Insufficient num of args to gcore\n";
+        return;
+    }
+
+    std::vector<CorePatch> patches;
+    for (const auto& [address, breakpoint] : std::as_const(breakpoints)) {
+        if (breakpoint.isEnabled()) {
+            patches.push_back({address, breakpoint.getSavedData()});
+        }
+    }
+    // code under tracepoint jumps too
+    if (tracepoints) {
+        for (const auto& [address, byte] : tracepoints->getOriginalBytes()) {
+            patches.push_back({address, byte});
+        }
+    }
+    std::sort(patches.begin(), patches.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.address < rhs.address; });
+
+    if (!writeCoreFile(pid, getRegisters(), patches, args[1])) {
+        std::cerr << "Failed to write core file " << args[1] << std::endl;
+        return;
+    }
+    std::cerr << "Saved core file " << args[1] << std::endl;
+}
+
+void Debugger::handleFind(const std::vector<std::string>& args)
+{
+    if (args.size() < 3) {
+        std::cerr << "Insufficient num of args to find\n";
+        return;
+    }
+
+    const auto regions = selectMemoryRegions(args[1]);
+    if (!regions) {
+        std::cerr << "Failed to parse region, expected 0xSTART, 0xSTART-0xEND, all or part of mapping path\n";
+        return;
+    }
+
+    // strings may contain spaces
+    auto text = args[2];
+    for (size_t i = 3; i < args.size(); ++i) {
+        text += ' ' + args[i];
+    }
+    const auto pattern = parseSearchPattern(text);
+    if (!pattern) {
+        std::cerr << "Failed to parse pattern, expected \"text\", x:HEX with ? wildcards, "
+                     "u8/u16/u32/u64/i8/i16/i32/i64:VALUE[/MASK] or a number\n";
+        return;
+    }
+
+    std::vector<uint64_t> matches;
+    bool complete = true;
+    scanMemory(*regions, pattern->bytes.size() - 1, [&](const uint8_t* data, size_t size, uint64_t address) {
+        const auto first = matches.size();
+        complete = findPattern(data, size, *pattern, matches, SEARCH_LIMIT);
+        for (auto i = first; i < matches.size(); ++i) {
+            matches[i] += address;
+        }
+        return complete;
+    });
+
+    for (const auto match : matches) {
+        std::cerr << describeAddress(match, *regions) << std::endl;
+    }
+    std::cerr << std::dec << matches.size() << (complete ? " matches" : " matches, search stopped") << std::endl;
+}
+
+void Debugger::handleFindPointers(const std::vector<std::string>& args)
+{
+    if (args.size() < 2) {
+        std::cerr << "Insufficient num of args to find pointers\n";
+        return;
+    }
+
+    const auto address = parseAddress(args[1]);
+    if (!address) {
+        std::cerr << "Failed to parse address, expected format: 0xADDRESS\n";
+        return;
+    }
+    const auto size = args.size() > 2 ? std::stoull(args[2], nullptr, 0) : 1;
+
+    // pointers are expected to be aligned
+    auto regions = getMemoryRegions();
+    for (auto& region : regions) {
+        region.start = (region.start + 7) & ~uint64_t{7};
+    }
+
+    std::vector<uint64_t> matches;
+    bool complete = true;
+    scanMemory(regions, 0, [&](const uint8_t* data, size_t chunkSize, uint64_t chunkAddress) {
+        const auto first = matches.size();
+        complete = findPointers(data, chunkSize, *address, *address + size, matches, SEARCH_LIMIT);
+        for (auto i = first; i < matches.size(); ++i) {
+            matches[i] += chunkAddress;
+        }
+        return complete;
+    });
+
+    for (const auto match : matches) {
+        std::cerr << describeAddress(match, regions) << ": 0x" << std::hex << readMemory(match) << std::endl;
+    }
+    std::cerr << std::dec << matches.size() << (complete ? " pointers" : " pointers, search stopped") << std::endl;
+}
+
+void Debugger::handleTracepoint(const std::vector<std::string>& args)
+{
+    if (args.size() < 2) {
+        std::cerr << "Insufficient num of args to tracepoint\n";
+        return;
+    }
+
+    if (args[1] == "list" || args[1] == "dump" || args[1] == "stats" || args[1] == "clear" || args[1] == "stop") {
+        if (!tracepoints) {
+            std::cerr << "No tracepoints\n";
+        } else if (args[1] == "list") {
+            tracepoints->list(std::cerr);
+        } else if (args[1] == "dump") {
+            tracepoints->dump(std::cerr, args.size() > 2 ? std::stoul(args[2]) : 100);
+        } else if (args[1] == "stats") {
+            tracepoints->printStats(std::cerr);
+        } else if (args[1] == "clear") {
+            tracepoints->clearEvents();
+        } else {
+            removeTracepoints();
+        }
+        return;
+    }
+
+    if (isPrefix("0x", args[1])) {
+        const auto address = parseAddress(args[1]);
+        if (!address) {
+            std::cerr << "Failed to parse address, expected format: 0xADDRESS\n";
+            return;
+        }
+        addTracepoint(getOffsettedAddress(*address), args[1]);
+    } else if (args[1].find(':') != std::string::npos) {
+        const auto fileAndLine = split(args[1], ':');
+        const size_t line = std::stoul(fileAndLine[1]);
+        for (const auto& cu : binary->dwarf.compilation_units()) {
+            if (isSuffix(fileAndLine[0], at_name(cu.root()))) {
+                for (const auto& entry : cu.get_line_table()) {
+                    if (entry.is_stmt && entry.line == line) {
+                        addTracepoint(getOffsettedAddress(entry.address), args[1]);
+                        return;
+                    }
+                }
+            }
+        }
+        std::cerr << "Failed to find: " << args[1] << std::endl;
+    } else {
+        // first instruction, prologue is rarely a jump target
+        for (const auto& cu : binary->dwarf.compilation_units()) {
+            for (const auto& die : binary->debugInfo.getUnitRoot(cu)) {
+                if (die.has(dwarf::DW_AT::name) && at_name(die) == args[1] && die.has(dwarf::DW_AT::low_pc)) {
+                    addTracepoint(getOffsettedAddress(at_low_pc(die)), args[1]);
+                }
+            }
+        }
+    }
+}
+
+void Debugger::addTracepoint(uint64_t address, const std::string& name)
+{
+    try {
+        if (!tracepoints) {
+            tracepoints = std::make_unique<TracepointAgent>(pid);
+        }
+
+        // other threads could run into the site while it's patched, they wait until it's done
+        const auto others = stopThreads(pid);
+        ResumeThreads resume{others};
+
+        uint8_t code[32];
+        if (!readMemory(address, code, sizeof(code))) {
+            std::cerr << "Failed to read code at 0x" << std::hex << address << std::endl;
+            return;
+        }
+        // decode original instructions, not our int3
+        for (const auto& [breakpointAddress, breakpoint] : std::as_const(breakpoints)) {
+            if (breakpoint.isEnabled() && breakpointAddress >= address && breakpointAddress < address + sizeof(code)) {
+                code[breakpointAddress - address] = breakpoint.getSavedData();
+            }
+        }
+
+        const auto displaced = TracepointAgent::getDisplacedSize(code, sizeof(code));
+        if (!displaced) {
+            std::cerr << "Instructions at 0x" << std::hex << address << " can't be moved to a trampoline\n";
+            return;
+        }
+        for (const auto& [breakpointAddress, breakpoint] : std::as_const(breakpoints)) {
+            if (breakpointAddress >= address && breakpointAddress < address + *displaced) {
+                std::cerr << "Breakpoint at 0x" << std::hex << breakpointAddress << " overlaps the tracepoint\n";
+                return;
+            }
+        }
+
+        // something jumping into the middle of displaced instructions would break,
+        // line boundaries are the usual jump targets
+        const auto low = getSourceAddress(address);
+        for (const auto& cu : binary->dwarf.compilation_units()) {
+            if (!die_pc_range(cu.root()).contains(low)) {
+                continue;
+            }
+            for (const auto& entry : cu.get_line_table()) {
+                if (entry.address > low && entry.address < low + *displaced) {
+                    std::cerr << "Line starts inside of instructions the tracepoint replaces\n";
+                    return;
+                }
+            }
+        }
+
+        // a thread resuming inside of the jump would execute its tail
+        std::vector<uint64_t> threadPCs{getPC()};
+        for (const auto& thread : others) {
+            threadPCs.push_back(thread.regs.rip);
+        }
+        for (const auto threadPC : threadPCs) {
+            if (threadPC > address && threadPC < address + *displaced) {
+                std::cerr << "A thread is stopped at 0x" << std::hex << threadPC << " inside of instructions the tracepoint replaces\n";
+                return;
+            }
+        }
+
+        tracepoints->addTracepoint(address, name, code, sizeof(code));
+        std::cerr << "Tracepoint at 0x" << std::hex << address << ' ' << name << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+bool Debugger::removeTracepoints()
+{
+    // other threads could run into a site while its jump is half restored
+    const auto others = stopThreads(pid);
+    ResumeThreads resume{others};
+
+    std::vector<uint64_t> threadPCs{getPC()};
+    for (const auto& thread : others) {
+        threadPCs.push_back(thread.regs.rip);
+    }
+    for (const auto threadPC : threadPCs) {
+        if (tracepoints->isInsideSite(threadPC)) {
+            std::cerr << "A thread is stopped at 0x" << std::hex << threadPC << " inside of instructions a tracepoint replaces\n";
+            return false;
+        }
+    }
+    tracepoints->removeTracepoints();
+    return true;
+}
+
+void Debugger::handleStats(const std::vector<std::string>& args)
+{
+    if (args.size() < 2) {
+        stats::print(std::cerr);
+    } else if (isPrefix(args[1], "reset")) {
+        stats::reset();
+    } else if (isPrefix(args[1], "export") && args.size() > 2) {
+        if (!stats::exportJson(args[2])) {
+            std::cerr << "Failed to write " << args[2] << ": " << strerror(errno) << std::endl;
+        }
+    } else {
+        std::cerr << "Unknown stats command: '" << args[1] << "'\n";
+    }
+}
+
+void Debugger::handleInferior(const std::vector<std::string>& args)
+{
+    if (args.size() < 2) {
+        if (pid != 0) {
+            std::cerr << "* " << std::dec << inferiorNumber << " pid " << pid << ' ' << binary->path << std::endl;
+        }
+        std::vector<const Inferior*> others;
+        for (const auto& inferior : inferiors) {
+            others.push_back(&inferior);
+        }
+        std::sort(others.begin(), others.end(), [](const auto* lhs, const auto* rhs) { return lhs->number < rhs->number; });
+        for (const auto* inferior : others) {
+            std::cerr << "  " << std::dec << inferior->number << " pid " << inferior->pid << ' ' << inferior->binary->path
+                      << (inferior->running ? " (running)" : "") << std::endl;
+        }
+        return;
+    }
+
+    const auto number = std::stoul(args[1]);
+    const auto inferior = std::find_if(inferiors.cbegin(), inferiors.cend(),
+        [number](const auto& inferior) { return inferior.number == number; });
+    if (inferior == inferiors.cend()) {
+        if (number != inferiorNumber || pid == 0) {
+            std::cerr << "No inferior number " << number << std::endl;
+        }
+        return;
+    }
+
+    const auto running = inferior->running;
+    switchInferior(inferior - inferiors.cbegin(), /*currentRunning*/ false);
+    std::cerr << "Switched to inferior " << std::dec << inferiorNumber << " (pid " << pid << ")" << std::endl;
+    if (running) {
+        // a pending SIGSTOP, the first one of a fork included, stops it anyway
+        if (!stopRequested) {
+            kill(pid, SIGSTOP);
+        }
+        int waitStatus;
+        stats::waitpid(pid, &waitStatus, __WALL);
+        stopRequested = false;
+        if (!WIFSTOPPED(waitStatus) || WSTOPSIG(waitStatus) != SIGSTOP) {
+            // it stopped on its own before, SIGSTOP is still to come
+            stopRequested = WIFSTOPPED(waitStatus);
+            clearRegisterCache();
+            handleStop(waitStatus);
+            return;
+        }
+    }
+
+    try {
+        const auto lineEntry = getLineEntry(getPC());
+        printSource(lineEntry->file->path, lineEntry->line);
+    } catch (const std::out_of_range&) {
+        std::cerr << "At 0x" << std::hex << getPC() << std::endl;
+    }
+    refreshDisplays(/*force*/ true);
+}
+
+void Debugger::handleMemdiff(const std::vector<std::string>& args)
+{
+    if (args.size() < 2) {
+        std::cerr << "Insufficient num of args to memdiff\n";
+        return;
+    }
+
+    // shared mappings are the same in the snapshot, they can't be diffed
+    const auto regions = readMemoryRegions(pid);
+    std::vector<MemoryRange> writable;
+    for (const auto& region : regions) {
+        if (region.perms.size() == 4 && region.perms[1] == 'w' && region.perms[3] == 'p') {
+            writable.push_back({region.start, region.end - region.start});
+        }
+    }
+
+    if (args[1] == "start") {
+        if (isAtSeccompStop(pid)) {
+            std::cerr << "Can't snapshot memory at a caught syscall, step or continue first\n";
+            return;
+        }
+        dropMemorySnapshot();
+        // fork shares pages copy on write, so only the written ones get copied
+        const auto fork = injectFork(pid, PTRACE_OPTIONS);
+        clearRegisterCache();
+        if (!fork) {
+            std::cerr << "Failed to fork inferior\n";
+            return;
+        }
+        // after the fork, copy on write faults of the inferior must count as writes
+        const auto softDirty = isSoftDirtyTracked() && clearSoftDirty(pid);
+        memorySnapshot = MemorySnapshot{pid, *fork, softDirty};
+        std::cerr << "Memory of pid " << std::dec << pid << " saved in fork " << *fork << std::endl;
+        if (!softDirty) {
+            std::cerr << "Kernel doesn't track soft-dirty pages, every resident page will be compared\n";
+        }
+        return;
+    }
+    if (args[1] == "stop") {
+        dropMemorySnapshot();
+        return;
+    }
+    if (args[1] != "show") {
+        std::cerr << "Unknown memdiff command, expected start, show [n] or stop\n";
+        return;
+    }
+    if (!memorySnapshot || memorySnapshot->pid != pid) {
+        std::cerr << "No memory snapshot of pid " << std::dec << pid << ", memdiff start first\n";
+        return;
+    }
+    size_t limit = SEARCH_LIMIT;
+    if (args.size() > 2) {
+        try {
+            limit = std::stoul(args[2]);
+        } catch (const std::logic_error&) {
+            std::cerr << "Invalid number of changes: " << args[2] << std::endl;
+            return;
+        }
+    }
+
+    const auto dirtyPages = readPagemap(pid, writable,
+        memorySnapshot->softDirty ? PAGEMAP_SOFT_DIRTY : PAGEMAP_PRESENT | PAGEMAP_SWAPPED);
+    if (!dirtyPages) {
+        std::cerr << "Failed to read pagemap of pid " << std::dec << pid << std::endl;
+        return;
+    }
+
+    struct Change {
+        uint64_t address;
+        size_t size;
+        std::vector<uint8_t> before;
+        std::vector<uint8_t> after;
+    };
+    std::vector<Change> changes;
+    size_t changeCount = 0;
+    size_t changedBytes = 0;
+    size_t pageCount = 0;
+
+    // dirty pages are read from both processes in batches, one process_vm_readv for many ranges
+    std::vector<uint8_t> before(SEARCH_CHUNK_SIZE);
+    std::vector<uint8_t> after(SEARCH_CHUNK_SIZE);
+    std::vector<MemoryRange> batch;
+    auto compareBatch = [&]() {
+        tinydbg::readMemoryBatch(memorySnapshot->fork, batch, before.data());
+        tinydbg::readMemoryBatch(pid, batch, after.data());
+        size_t offset = 0;
+        for (const auto& range : batch) {
+            // pages which didn't change back and forth end up unchanged
+            std::optional<size_t> start;
+            size_t end = 0;
+            auto addChange = [&]() {
+                ++changeCount;
+                if (changes.size() < limit) {
+                    const auto shown = std::min(end - *start, MEMDIFF_BYTES);
+                    changes.push_back({range.address + *start - offset, end - *start,
+                        {before.begin() + *start, before.begin() + *start + shown},
+                        {after.begin() + *start, after.begin() + *start + shown}});
+                }
+            };
+            for (auto i = offset; i < offset + range.size; ++i) {
+                if (before[i] == after[i]) {
+                    continue;
+                }
+                ++changedBytes;
+                if (start && i - end >= MEMDIFF_GAP) {
+                    addChange();
+                    start.reset();
+                }
+                if (!start) {
+                    start = i;
+                }
+                end = i + 1;
+            }
+            if (start) {
+                addChange();
+            }
+            offset += range.size;
+        }
+        batch.clear();
+    };
+
+    size_t batchSize = 0;
+    for (const auto& dirty : *dirtyPages) {
+        pageCount += dirty.size / sysconf(_SC_PAGESIZE);
+        for (uint64_t address = dirty.address; address < dirty.address + dirty.size; address += SEARCH_CHUNK_SIZE) {
+            const auto size = std::min<uint64_t>(SEARCH_CHUNK_SIZE, dirty.address + dirty.size - address);
+            if (batchSize + size > SEARCH_CHUNK_SIZE) {
+                compareBatch();
+                batchSize = 0;
+            }
+            batch.push_back({address, size});
+            batchSize += size;
+        }
+    }
+    if (!batch.empty()) {
+        compareBatch();
+    }
+
+    // names come from locals of the current function and data symbols
+    struct Named {
+        uint64_t address;
+        uint64_t size;
+        std::string name;
+    };
+    std::vector<Named> locals;
+    try {
+        const auto& compiled = getCompiledFunction(getFunction(getPC()));
+        std::vector<const CompiledVariable*> variables;
+        for (const auto& variable : compiled.variables) {
+            variables.push_back(&variable);
+        }
+        const auto values = evaluateVariables(compiled, variables);
+        for (size_t i = 0; i < variables.size(); ++i) {
+            if (values[i].location.type == Location::Type::Address) {
+                locals.push_back({values[i].location.value, variables[i]->size, variables[i]->name});
+            }
+        }
+    } catch (const std::out_of_range&) {
+        // stopped outside of known code, only symbols name memory
+    }
+    const auto& symbols = getDataSymbols();
+    const auto loadBias = getLoadBias();
+    auto nameOf = [&](uint64_t address) -> std::string {
+        std::stringstream name;
+        for (const auto& local : locals) {
+            if (local.address <= address && address < local.address + std::max<uint64_t>(local.size, 1)) {
+                name << local.name;
+                if (address != local.address) {
+                    name << "+0x" << std::hex << address - local.address;
+                }
+                return name.str();
+            }
+        }
+        const auto it = std::upper_bound(symbols.cbegin(), symbols.cend(), address - loadBias,
+            [](uint64_t address, const auto& symbol) { return address < symbol.address; });
+        if (it != symbols.cbegin() && address - loadBias < std::prev(it)->address + std::prev(it)->size) {
+            const auto& symbol = *std::prev(it);
+            name << symbol.name;
+            if (address - loadBias != symbol.address) {
+                name << "+0x" << std::hex << address - loadBias - symbol.address;
+            }
+        }
+        return name.str();
+    };
+
+    for (const auto& change : changes) {
+        std::cerr << describeAddress(change.address, regions);
+        const auto name = nameOf(change.address);
+        if (!name.empty()) {
+            std::cerr << " " << name;
+        }
+        std::cerr << ", " << std::dec << change.size << " bytes:" << std::hex << std::setfill('0');
+        for (const auto byte : change.before) {
+            std::cerr << ' ' << std::setw(2) << static_cast<int>(byte);
+        }
+        std::cerr << " ->";
+        for (const auto byte : change.after) {
+            std::cerr << ' ' << std::setw(2) << static_cast<int>(byte);
+        }
+        std::cerr << std::setfill(' ') << (change.size > MEMDIFF_BYTES ? " ..." : "") << std::endl;
+    }
+    std::cerr << std::dec << pageCount << (memorySnapshot->softDirty ? " dirty pages, " : " resident pages, ") << changedBytes << " bytes changed in "
+              << changeCount << (changeCount > changes.size() ? " ranges, first ones shown" : " ranges") << std::endl;
+}
+
+const std::vector<DataSymbol>& Debugger::getDataSymbols()
+{
+    if (binary->dataSymbols) {
+        return *binary->dataSymbols;
+    }
+
+    auto& symbols = binary->dataSymbols.emplace();
+    for (const auto& section : binary->debugInfo.getSymbolTables()) {
+        for (auto sym : section.as_symtab()) {
+            const auto& data = sym.get_data();
+            if (data.type() == elf::stt::object && data.size > 0) {
+                symbols.push_back({data.value, data.size, demangle(sym.get_name())});
+            }
+        }
+    }
+    // symtab and dynsym name the same objects
+    std::sort(symbols.begin(), symbols.end(), [](const auto& lhs, const auto& rhs) { return lhs.address < rhs.address; });
+    symbols.erase(std::unique(symbols.begin(), symbols.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.address == rhs.address; }), symbols.end());
+    return symbols;
+}
+
+void Debugger::dropMemorySnapshot()
+{
+    if (!memorySnapshot) {
+        return;
+    }
+    kill(memorySnapshot->fork, SIGKILL);
+    stats::waitpid(memorySnapshot->fork, nullptr, __WALL);
+    memorySnapshot.reset();
+}
+
+std::vector<MemoryRegion> Debugger::getMemoryRegions() const
+{
+    if (core) {
+        return core->getRegions();
+    }
+
+    std::vector<MemoryRegion> regions;
+    for (auto& region : readMemoryRegions(pid)) {
+        // not readable through process_vm_readv
+        if (region.isReadable() && region.path != "[vvar]" && region.path != "[vvar_vclock]" && region.path != "[vsyscall]") {
+            regions.push_back(std::move(region));
+        }
+    }
+    return regions;
+}
+
+std::optional<std::vector<MemoryRegion>> Debugger::selectMemoryRegions(const std::string& selector) const
+{
+    auto regions = getMemoryRegions();
+    if (selector == "all") {
+        return regions;
+    }
+
+    if (isPrefix("0x", selector)) {
+        // 0xSTART or 0xSTART-0xEND
+        const auto dash = selector.find('-');
+        const auto start = parseAddress(selector.substr(0, dash));
+        const auto end = dash == std::string::npos ? std::optional<uint64_t>{~uint64_t{0}} : parseAddress(selector.substr(dash + 1));
+        if (!start || !end) {
+            return {};
+        }
+
+        std::vector<MemoryRegion> selected;
+        for (auto& region : regions) {
+            region.start = std::max(region.start, *start);
+            region.end = std::min(region.end, *end);
+            if (region.start < region.end) {
+                selected.push_back(std::move(region));
+            }
+        }
+        return selected;
+    }
+
+    regions.erase(std::remove_if(regions.begin(), regions.end(),
+                      [&selector](const auto& region) { return region.path.find(selector) == std::string::npos; }),
+        regions.end());
+    return regions;
+}
+
+void Debugger::scanMemory(const std::vector<MemoryRegion>& regions, size_t overlap,
+    const std::function<bool(const uint8_t* data, size_t size, uint64_t address)>& scan) const
+{
+    if (core) {
+        // core is mapped already, regions are scanned in place
+        for (const auto& region : regions) {
+            const auto* data = core->getPointer(region.start, region.end - region.start);
+            if (data != nullptr && !scan(data, region.end - region.start, region.start)) {
+                return;
+            }
+        }
+        return;
+    }
+
+    std::vector<uint8_t> buffer(SEARCH_CHUNK_SIZE + overlap);
+    for (const auto& region : regions) {
+        for (auto address = region.start; address < region.end; address += SEARCH_CHUNK_SIZE) {
+            const auto size = std::min<uint64_t>(buffer.size(), region.end - address);
+            // mapping may have changed since maps were read
+            if (!tinydbg::readMemory(pid, address, buffer.data(), size)) {
+                continue;
+            }
+            if (!scan(buffer.data(), size, address)) {
+                return;
+            }
+        }
+    }
+}
+
+bool Debugger::isInternalBreakpointNeeded(uint64_t address) const
+{
+    return tracer.isEntry(address) || tracer.isReturn(address) || coverage.isPending(address);
+}
+
+void Debugger::handleTraceHit(uint64_t pc)
+{
+    if (!tracer.isEntry(pc) && !tracer.isReturn(pc)) {
+        return;
+    }
+
+    const auto& regs = getRegisters();
+
+    if (tracer.isReturn(pc)) {
+        for (const auto address : tracer.onReturn(pc, regs, pid)) {
+            if (!isInternalBreakpointNeeded(address) && internalBreakpoints.erase(address) > 0) {
+                removeBreakpoint(address);
+            }
+        }
+    }
+
+    if (tracer.isEntry(pc)) {
+        const auto returnAddress = readMemory(regs.rsp);
+        if (tracer.onEntry(pc, returnAddress, regs, pid) && breakpoints.count(returnAddress) == 0) {
+            Breakpoint breakpoint{pid, returnAddress};
+            breakpoint.enable();
+            breakpoints.insert({returnAddress, breakpoint});
+            internalBreakpoints.insert(returnAddress);
+        }
+    }
+}
+
+std::vector<uint64_t> Debugger::borrowInternalBreakpoints(const std::vector<uint64_t>& addresses)
+{
+    std::vector<uint64_t> borrowed;
+    for (const auto address : addresses) {
+        if (internalBreakpoints.erase(address) > 0) {
+            borrowed.push_back(address);
+        }
+    }
+    return borrowed;
+}
+
+void Debugger::returnInternalBreakpoints(const std::vector<uint64_t>& addresses)
+{
+    for (const auto address : addresses) {
+        if (breakpoints.count(address) == 0) {
+            continue;
+        }
+        if (isInternalBreakpointNeeded(address)) {
+            internalBreakpoints.insert(address);
+        } else {
+            // tracer or coverage released it while we were stepping
+            removeBreakpoint(address);
+        }
+    }
+}
+
+void Debugger::updateMemoryOffset()
+{
+    auto offset = getOffset(pid);
+    if (offset) {
+        memoryOffset = *offset;
+    } else {
+        std::cerr << "Failed to get proc memory offset\n";
+    }
+}
+
+uint64_t Debugger::getLoadBias() const
+{
+    return binary->elf.get_hdr().type == elf::et::dyn ? memoryOffset : 0;
+}
+
+void Debugger::readVariables()
+{
+    for (const auto& [name, location, value] : getVariables()) {
+        switch (location.type) {
+        case Location::Type::Address:
+            std::cerr << name
+                      << " (0x" << std::hex << location.value << ") = "
+                      << value << std::endl;
+            break;
+        case Location::Type::Register:
+            std::cerr << name
+                      << " (reg " << location.value << ") = "
+                      << value << std::endl;
+            break;
+        case Location::Type::Value:
+            std::cerr << name << " = " << value << std::endl;
+            break;
+        case Location::Type::Unavailable:
+            std::cerr << name << " = <optimized out>" << std::endl;
+            break;
+        }
+    }
+}
+
+std::vector<Debugger::Variable> Debugger::getVariables()
+{
+    const auto& compiled = getCompiledFunction(getFunction(getPC()));
+
+    std::vector<const CompiledVariable*> variables;
+    for (const auto& variable : compiled.variables) {
+        variables.push_back(&variable);
+    }
+    const auto values = evaluateVariables(compiled, variables);
+
+    std::vector<Variable> result;
+    for (size_t i = 0; i < variables.size(); ++i) {
+        result.push_back({variables[i]->name, values[i].location, values[i].value});
+    }
+    return result;
 }
 
-void Debugger::readVariables()
+void Debugger::refreshDisplays(bool force)
 {
-    const auto func = getFunction(getPC());
-
-    for (const auto& die : func) {
-        if (die.tag == dwarf::DW_TAG::variable) {
-            const auto location = die[dwarf::DW_AT::location];
-            if (location.get_type() == dwarf::value::type::exprloc) {
-                PtraceExprContext context{pid};
-                const auto result = location.as_exprloc().evaluate(&context);
-                switch (result.location_type) {
-                case dwarf::expr_result::type::address: {
-                    const auto value = readMemory(result.value);
-                    std::cerr << at_name(die)
-                              << " (0x" << std::hex << result.value << ") = "
-                              << value << std::endl;
-                }
-                case dwarf::expr_result::type::reg: {
-                    const auto value = getRegisterValueFromDwarf(pid, result.value);
-                    std::cerr << at_name(die)
-                              << " (reg " << result.value << ") = "
-                              << value << std::endl;
-                }
-                default:
-                    throw std::runtime_error{"Unhandled variable location"};
+    if (displays.empty()) {
+        return;
+    }
+
+    const CompiledFunction* compiled = nullptr;
+    try {
+        compiled = &getCompiledFunction(getFunction(getPC()));
+    } catch (const std::out_of_range&) {
+        // stopped outside of known code, only registers can be displayed
+    }
+
+    // resolve everything first so that memory is read with a single batch
+    std::vector<const CompiledVariable*> variables;
+    std::vector<std::optional<size_t>> variableIndices;
+    for (const auto& display : displays) {
+        if (display.expression.empty() || display.expression[0] == '$' || compiled == nullptr) {
+            variableIndices.push_back({});
+            continue;
+        }
+
+        const auto it = std::find_if(compiled->variables.cbegin(), compiled->variables.cend(),
+            [&display](const auto& variable) { return variable.name == display.expression; });
+        if (it == compiled->variables.cend()) {
+            variableIndices.push_back({});
+            continue;
+        }
+        variableIndices.push_back(variables.size());
+        variables.push_back(&*it);
+    }
+
+    std::vector<VariableValue> values;
+    if (!variables.empty()) {
+        values = evaluateVariables(*compiled, variables);
+    }
+
+    for (size_t i = 0; i < displays.size(); ++i) {
+        auto& display = displays[i];
+
+        std::optional<uint64_t> value;
+        if (variableIndices[i]) {
+            const auto& variableValue = values[*variableIndices[i]];
+            if (variableValue.location.type != Location::Type::Unavailable) {
+                value = variableValue.value;
+            }
+        } else if (!display.expression.empty() && display.expression[0] == '$') {
+            const auto name = display.expression.substr(1);
+            const auto reg = getRegister(name);
+            if (reg) {
+                value = getRegisterValue(getRegisters(), *reg);
+            } else {
+                // low 64 bits of vector registers
+                const auto bytes = getXState().getRegister(name);
+                if (!bytes.empty()) {
+                    value = 0;
+                    std::memcpy(&*value, bytes.data(), std::min(bytes.size(), sizeof(uint64_t)));
                 }
             }
         }
+
+        if (!force && display.shown && value == display.lastValue) {
+            continue;
+        }
+        display.lastValue = value;
+        display.shown = true;
+
+        std::cerr << display.number << ": " << display.expression << " = ";
+        if (value) {
+            std::cerr << "0x" << std::hex << *value << std::endl;
+        } else {
+            std::cerr << "<not available>" << std::endl;
+        }
     }
 }
 
 void Debugger::setBreakpoint(uint64_t address)
 {
     std::cerr << "Set breakpoint at address 0x" << std::hex << address << std::endl;
+    if (breakpoints.count(address) > 0) {
+        // already in memory on behalf of tracer or coverage, from now on it stops execution
+        internalBreakpoints.erase(address);
+        return;
+    }
     Breakpoint breakpoint{pid, address};
     breakpoint.enable();
     breakpoints.insert({address, breakpoint});
@@ -362,22 +2000,27 @@ void Debugger::setBreakpoint(uint64_t address)
 
 void Debugger::setBreakpointAtFunction(const std::string& name)
 {
-    for (const auto& cu : dwarf.compilation_units()) {
-        for (const auto& die : cu.root()) {
+    bool found = false;
+    for (const auto& cu : binary->dwarf.compilation_units()) {
+        for (const auto& die : binary->debugInfo.getUnitRoot(cu)) {
             if (die.has(dwarf::DW_AT::name) && at_name(die) == name) {
                 const auto lowPC = at_low_pc(die);
                 auto entry = getLineEntry(lowPC, /*addrOffsetted*/ false);
                 // skip function prologue
                 ++entry;
                 setBreakpoint(getOffsettedAddress(entry->address));
+                found = true;
             }
         }
     }
+    if (!found) {
+        std::cerr << "Failed to find: " << name << std::endl;
+    }
 }
 
 void Debugger::setBreakpointAtLine(const std::string& file, size_t line)
 {
-    for (const auto& cu : dwarf.compilation_units()) {
+    for (const auto& cu : binary->dwarf.compilation_units()) {
         if (isSuffix(file, at_name(cu.root()))) {
             const auto& lineTable = cu.get_line_table();
             for (const auto& entry : lineTable) {
@@ -396,12 +2039,7 @@ std::vector<Symbol> Debugger::lookupSymbol(const std::string& name)
 {
     std::vector<Symbol> syms;
 
-    for (const auto& section : elf.sections()) {
-        if (section.get_hdr().type != elf::sht::symtab
-            && section.get_hdr().type != elf::sht::dynsym) {
-            continue;
-        }
-
+    for (const auto& section : binary->debugInfo.getSymbolTables()) {
         for (auto sym : section.as_symtab()) {
             if (sym.get_name() == name) {
                 const auto& data = sym.get_data();
@@ -424,7 +2062,7 @@ void Debugger::removeBreakpoint(uint64_t address)
 
 void Debugger::singleStepInstruction()
 {
-    ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
+    stats::ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
     waitForSignal();
 }
 void Debugger::singleStepInstructionWithBpCheck()
@@ -443,15 +2081,19 @@ void Debugger::stepIn()
     // single instruction step until get to new line
     while (getLineEntry(getPC())->line == line) {
         singleStepInstructionWithBpCheck();
+        if (pid == 0) {
+            return;
+        }
     }
 
     const auto line_entry = getLineEntry(getPC());
     printSource(line_entry->file->path, line_entry->line);
+    refreshDisplays();
 }
 
 void Debugger::stepOut()
 {
-    const auto framePointer = getRegisterValue(pid, Register::rbp);
+    const auto framePointer = getRegisterValue(getRegisters(), Register::rbp);
     const auto returnAddress = readMemory(framePointer + 8);
 
     bool shouldRemoveBreakpoint = false;
@@ -459,9 +2101,11 @@ void Debugger::stepOut()
         setBreakpoint(returnAddress);
         shouldRemoveBreakpoint = true;
     }
+    const auto borrowed = borrowInternalBreakpoints({returnAddress});
 
     continueExecution();
 
+    returnInternalBreakpoints(borrowed);
     if (shouldRemoveBreakpoint) {
         removeBreakpoint(returnAddress);
     }
@@ -480,24 +2124,33 @@ void Debugger::stepOver()
     const auto startLine = getLineEntry(getPC());
 
     std::vector<uint64_t> toDelete;
+    std::vector<uint64_t> existing;
     while (line->address < functionEnd) {
         const auto offsettedLineAddr = getOffsettedAddress(line->address);
-        if (line->address != startLine->address && breakpoints.count(offsettedLineAddr) == 0) {
-            setBreakpoint(offsettedLineAddr);
-            toDelete.push_back(offsettedLineAddr);
+        if (line->address != startLine->address) {
+            if (breakpoints.count(offsettedLineAddr) == 0) {
+                setBreakpoint(offsettedLineAddr);
+                toDelete.push_back(offsettedLineAddr);
+            } else {
+                existing.push_back(offsettedLineAddr);
+            }
         }
         ++line;
     }
 
-    const auto framePointer = getRegisterValue(pid, Register::rbp);
+    const auto framePointer = getRegisterValue(getRegisters(), Register::rbp);
     const auto returnAddress = readMemory(framePointer + 8);
     if (breakpoints.count(returnAddress) == 0) {
         setBreakpoint(returnAddress);
         toDelete.push_back(returnAddress);
+    } else {
+        existing.push_back(returnAddress);
     }
+    const auto borrowed = borrowInternalBreakpoints(existing);
 
     continueExecution();
 
+    returnInternalBreakpoints(borrowed);
     for (const auto address : toDelete) {
         removeBreakpoint(address);
     }
@@ -505,37 +2158,267 @@ void Debugger::stepOver()
 
 void Debugger::stepOverBreakpoint()
 {
-    if (breakpoints.count(getPC()) > 0) {
-        auto& breakpoint = breakpoints.at(getPC());
-        if (breakpoint.isEnabled()) {
-            breakpoint.disable();
-            ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
-            waitForSignal();
-            breakpoint.enable();
+    const auto pc = getPC();
+    if (breakpoints.count(pc) > 0 && breakpoints.at(pc).isEnabled()) {
+        breakpoints.at(pc).disable();
+        stats::ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
+        waitForSignal();
+        // the step may have hit coverage of pc again, which removes its breakpoint
+        if (pid != 0 && breakpoints.count(pc) > 0) {
+            breakpoints.at(pc).enable();
         }
     }
 }
 
-void Debugger::waitForSignal()
+bool Debugger::waitForSignal(int options, bool anyInferior)
 {
+    // inferior was resumed, cached registers are stale
+    clearRegisterCache();
+
     int waitStatus;
-    auto options = 0;
-    waitpid(pid, &waitStatus, options);
+    while (true) {
+        const auto stopped = stats::waitpid(anyInferior && !inferiors.empty() ? -1 : pid, &waitStatus, options);
+        if (stopped <= 0) {
+            return stopped < 0;
+        }
+        if (stopped != pid) {
+            if (handleInferiorEvent(stopped, waitStatus)) {
+                break;
+            }
+            continue;
+        }
+        if (stopRequested && WIFSTOPPED(waitStatus) && WSTOPSIG(waitStatus) == SIGSTOP) {
+            // something else stopped it before the SIGSTOP of inferior selection
+            stopRequested = false;
+            stats::ptrace(PTRACE_CONT, pid, nullptr, nullptr);
+            continue;
+        }
+        break;
+    }
+    handleStop(waitStatus);
+    return true;
+}
+
+void Debugger::handleStop(int waitStatus)
+{
+    ++stopCount;
+
+    if (WIFEXITED(waitStatus) || WIFSIGNALED(waitStatus)) {
+        if (WIFEXITED(waitStatus)) {
+            std::cerr << "Process exited with code " << std::dec << WEXITSTATUS(waitStatus) << describeInferior() << std::endl;
+            lastStop = {StopReason::Kind::Exited, WEXITSTATUS(waitStatus), false};
+        } else {
+            std::cerr << "Process terminated by signal: " << strsignal(WTERMSIG(waitStatus)) << describeInferior() << std::endl;
+            lastStop = {StopReason::Kind::Terminated, WTERMSIG(waitStatus), false};
+        }
+        pid = 0;
+        if (!inferiors.empty()) {
+            std::cerr << "Other inferiors are still there, select one with inferior {n}\n";
+        }
+        return;
+    }
 
     auto siginfo = getSigInfo(pid);
+    lastStop = {StopReason::Kind::Signal, siginfo.si_signo,
+        siginfo.si_signo == SIGTRAP && (siginfo.si_code == TRAP_BRKPT || siginfo.si_code == SI_KERNEL)};
     switch (siginfo.si_signo) {
     case SIGTRAP:
         handleSigtrap(siginfo);
         break;
     case SIGSEGV:
-        std::cerr << "Segfault, reason: " << siginfo.si_code << std::endl;
+        std::cerr << "Segfault, reason: " << siginfo.si_code << describeInferior() << std::endl;
         break;
     default:
-        std::cerr << "Got signal: " << strsignal(siginfo.si_signo) << std::endl;
+        std::cerr << "Got signal: " << strsignal(siginfo.si_signo) << describeInferior() << std::endl;
         break;
     }
 }
 
+void Debugger::handleFork(bool vfork)
+{
+    unsigned long childPid = 0;
+    stats::ptrace(PTRACE_GETEVENTMSG, pid, nullptr, &childPid);
+    const auto child = static_cast<pid_t>(childPid);
+    // fork starts with SIGSTOP, it may have been reported before the parent's event
+    bool stopped = unknownForks.erase(child) > 0;
+    // memory of the child can be changed only once it's stopped
+    const auto waitStopped = [&]() {
+        if (!stopped) {
+            stats::waitpid(child, nullptr, __WALL);
+            stopped = true;
+        }
+    };
+
+    // memory of a fork is a copy with tracepoint jumps in it, its hits would go to the ring
+    // it shares with the parent, vfork shares all memory with the parent like a thread
+    if (!vfork && tracepoints) {
+        waitStopped();
+        tracepoints->removeFromFork(child);
+    }
+
+    if (!followForks) {
+        waitStopped();
+        // int3 left in the memory of a detached fork would kill it, memory of vfork is the parent's one,
+        // breakpoints are put back there once the vfork is done
+        for (auto [address, breakpoint] : std::as_const(breakpoints)) {
+            if (breakpoint.isEnabled()) {
+                breakpoint.setPid(child);
+                breakpoint.disable();
+            }
+        }
+        stats::ptrace(PTRACE_DETACH, child, nullptr, nullptr);
+        if (!filteredSyscalls.empty()) {
+            std::cerr << "Detached fork " << std::dec << child
+                      << " inherited the seccomp filter, its caught syscalls fail with ENOSYS\n";
+        }
+        return;
+    }
+
+    // same program and breakpoints in memory, both are shared until something changes
+    inferiors.push_back({nextInferiorNumber++, child, memoryOffset, binary, breakpoints.share(child), nullptr, true, !stopped});
+    if (stopped) {
+        stats::ptrace(PTRACE_CONT, child, nullptr, nullptr);
+    }
+    std::cerr << "Following " << (vfork ? "vfork" : "fork") << " of pid " << std::dec << pid
+              << ": inferior " << inferiors.back().number << " (pid " << child << ")" << std::endl;
+}
+
+void Debugger::handleExec()
+{
+    // nothing of the old image is left, breakpoints and the agent included
+    tracepoints.reset();
+    if (memorySnapshot && memorySnapshot->pid == pid) {
+        dropMemorySnapshot();
+    }
+    char path[PATH_MAX];
+    const auto size = readlink(("/proc/" + std::to_string(pid) + "/exe").c_str(), path, sizeof(path) - 1);
+    std::shared_ptr<Binary> next;
+    if (size > 0) {
+        path[size] = '\0';
+        try {
+            next = binaries.load(path);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    const auto previousOffset = memoryOffset;
+    updateMemoryOffset();
+    if (next != binary) {
+        std::cerr << "Process " << std::dec << pid << " is executing new program: " << (size > 0 ? path : "?") << std::endl;
+        if (next) {
+            binary = std::move(next);
+        }
+        breakpoints = BreakpointTable{pid};
+        return;
+    }
+
+    // same program again, load address may change, move breakpoints accordingly
+
+    // return breakpoints belonged to frames of the previous image
+    for (const auto address : tracer.returnAddresses()) {
+        if (!coverage.isPending(address) && internalBreakpoints.erase(address) > 0) {
+            breakpoints.erase(address);
+        }
+    }
+    tracer.rebase(memoryOffset - previousOffset);
+    coverage.rebase(memoryOffset - previousOffset);
+    std::unordered_set<uint64_t> rebasedInternalBreakpoints;
+    for (const auto address : internalBreakpoints) {
+        rebasedInternalBreakpoints.insert(address - previousOffset + memoryOffset);
+    }
+    internalBreakpoints = std::move(rebasedInternalBreakpoints);
+
+    BreakpointTable rebased{pid};
+    for (const auto& [address, breakpoint] : std::as_const(breakpoints)) {
+        if (breakpoint.isEnabled()) {
+            const auto newAddress = address - previousOffset + memoryOffset;
+            rebased.insert({newAddress, Breakpoint{pid, newAddress}});
+        }
+    }
+    breakpoints = std::move(rebased);
+
+    std::vector<Breakpoint*> toEnable;
+    for (auto& [address, breakpoint] : breakpoints) {
+        toEnable.push_back(&breakpoint);
+    }
+    Breakpoint::enableAll(pid, toEnable);
+
+    // rebuilt program, specs may resolve elsewhere or not at all
+    if (resolveSpecsOnExec) {
+        resolveSpecsOnExec = false;
+        for (const auto& spec : breakpointSpecs) {
+            try {
+                setBreakpointAtSpec(spec);
+            } catch (const std::exception& e) {
+                std::cerr << "Failed to set breakpoint " << spec << ": " << e.what() << std::endl;
+            }
+        }
+    }
+}
+
+bool Debugger::handleInferiorEvent(pid_t stopped, int waitStatus)
+{
+    const auto inferior = std::find_if(inferiors.begin(), inferiors.end(),
+        [stopped](const auto& inferior) { return inferior.pid == stopped; });
+    if (inferior == inferiors.end()) {
+        // fork which stopped before its parent reported the fork, resumed once the parent does
+        if (WIFSTOPPED(waitStatus)) {
+            unknownForks.insert(stopped);
+        }
+        return false;
+    }
+
+    if (WIFEXITED(waitStatus)) {
+        std::cerr << "Inferior " << std::dec << inferior->number << " (pid " << stopped
+                  << ") exited with code " << WEXITSTATUS(waitStatus) << std::endl;
+        inferiors.erase(inferior);
+        return false;
+    }
+    if (WIFSIGNALED(waitStatus)) {
+        std::cerr << "Inferior " << std::dec << inferior->number << " (pid " << stopped
+                  << ") terminated by signal: " << strsignal(WTERMSIG(waitStatus)) << std::endl;
+        inferiors.erase(inferior);
+        return false;
+    }
+    if (inferior->stopRequested && WSTOPSIG(waitStatus) == SIGSTOP) {
+        // first stop of a fork or the one of a selection which something else came before
+        inferior->stopRequested = false;
+        stats::ptrace(PTRACE_CONT, stopped, nullptr, nullptr);
+        return false;
+    }
+
+    switchInferior(inferior - inferiors.begin(), /*currentRunning*/ true);
+    return true;
+}
+
+void Debugger::switchInferior(size_t index, bool currentRunning)
+{
+    auto next = std::move(inferiors[index]);
+    inferiors.erase(inferiors.begin() + index);
+    if (pid != 0) {
+        inferiors.push_back({inferiorNumber, pid, memoryOffset, std::move(binary), std::move(breakpoints),
+            std::move(tracepoints), currentRunning, stopRequested});
+    }
+
+    inferiorNumber = next.number;
+    pid = next.pid;
+    memoryOffset = next.memoryOffset;
+    binary = std::move(next.binary);
+    breakpoints = std::move(next.breakpoints);
+    tracepoints = std::move(next.tracepoints);
+    stopRequested = next.stopRequested;
+    clearRegisterCache();
+}
+
+std::string Debugger::describeInferior() const
+{
+    if (inferiors.empty()) {
+        return {};
+    }
+    return " in inferior " + std::to_string(inferiorNumber) + " (pid " + std::to_string(pid) + ")";
+}
+
 void Debugger::handleSigtrap(siginfo_t siginfo)
 {
     switch (siginfo.si_code) {
@@ -543,13 +2426,60 @@ void Debugger::handleSigtrap(siginfo_t siginfo)
     case TRAP_BRKPT: {
         // put pc back where it should be
         setPC(getPC() - 1);
-        std::cerr << "Hit breakpoint at address 0x" << std::hex << getPC() << std::endl;
-        const auto lineEntry = getLineEntry(getPC());
-        printSource(lineEntry->file->path, lineEntry->line);
+        const auto pc = getPC();
+        const auto isInternal = internalBreakpoints.count(pc) > 0;
+        handleTraceHit(pc);
+        handleCoverageHit(pc);
+        if (isInternal) {
+            resumeAfterStop = true;
+            return;
+        }
+        std::cerr << "Hit breakpoint at address 0x" << std::hex << getPC() << describeInferior() << std::endl;
+        try {
+            const auto lineEntry = getLineEntry(getPC());
+            printSource(lineEntry->file->path, lineEntry->line);
+        } catch (const std::out_of_range&) {
+            // breakpoint outside of the program, e.g. set by a remote client in a library
+        }
+        refreshDisplays();
         return;
     }
     case TRAP_TRACE:
+        // stepping executes lines without hitting their breakpoints
+        handleCoverageHit(getPC());
+        return;
+    case SIGTRAP | (PTRACE_EVENT_FORK << 8):
+    case SIGTRAP | (PTRACE_EVENT_VFORK << 8):
+        handleFork(siginfo.si_code == (SIGTRAP | (PTRACE_EVENT_VFORK << 8)));
+        resumeAfterStop = true;
         return;
+    case SIGTRAP | (PTRACE_EVENT_VFORK_DONE << 8):
+        if (!followForks) {
+            // breakpoints were taken out of the memory the detached vfork shared with us,
+            // the table still has them enabled with the original bytes saved
+            for (auto [address, breakpoint] : std::as_const(breakpoints)) {
+                if (breakpoint.isEnabled()) {
+                    breakpoint.enable();
+                }
+            }
+        }
+        resumeAfterStop = true;
+        return;
+    case SIGTRAP | (PTRACE_EVENT_EXEC << 8):
+        handleExec();
+        resumeAfterStop = true;
+        return;
+    case SIGTRAP | (PTRACE_EVENT_SECCOMP << 8): {
+        // syscall number is in orig_rax, arguments are in registers
+        const auto& regs = getRegisters();
+        if (caughtSyscalls.count(static_cast<int>(regs.orig_rax)) == 0) {
+            resumeAfterStop = true;
+            return;
+        }
+        std::cerr << "Caught syscall " << formatSyscall(pid, regs) << std::endl;
+        refreshDisplays();
+        return;
+    }
     default:
         std::cerr << "Unknown SIGTRAP code: " << siginfo.si_code << std::endl;
         return;
@@ -558,22 +2488,140 @@ void Debugger::handleSigtrap(siginfo_t siginfo)
 
 uint64_t Debugger::readMemory(uint64_t address) const
 {
-    return ptrace(PTRACE_PEEKDATA, pid, address, nullptr);
+    if (core) {
+        uint64_t value = 0;
+        core->readMemory(address, &value, sizeof(value));
+        return value;
+    }
+    return stats::ptrace(PTRACE_PEEKDATA, pid, address, nullptr);
+}
+
+bool Debugger::readMemory(uint64_t address, void* buffer, size_t size) const
+{
+    if (core) {
+        return core->readMemory(address, buffer, size);
+    }
+    return tinydbg::readMemory(pid, address, buffer, size);
+}
+
+size_t Debugger::readMemoryBatch(const std::vector<MemoryRange>& ranges, void* buffer) const
+{
+    if (!core) {
+        return tinydbg::readMemoryBatch(pid, ranges, buffer);
+    }
+
+    // core memory is already mapped, plain copies are enough
+    size_t read = 0;
+    auto* out = static_cast<uint8_t*>(buffer);
+    for (const auto& range : ranges) {
+        if (core->readMemory(range.address, out, range.size)) {
+            read += range.size;
+        } else {
+            std::memset(out, 0, range.size);
+        }
+        out += range.size;
+    }
+    return read;
 }
 
 void Debugger::writeMemory(uint64_t address, uint64_t value)
 {
-    ptrace(PTRACE_POKEDATA, pid, address, value);
+    stats::ptrace(PTRACE_POKEDATA, pid, address, value);
+}
+
+bool Debugger::writeMemory(uint64_t address, const void* data, size_t size)
+{
+    if (core) {
+        return false;
+    }
+
+    // keep our breakpoints in place, new bytes under them become their saved data
+    std::vector<Breakpoint*> covered;
+    for (auto& [breakpointAddress, breakpoint] : breakpoints) {
+        if (breakpoint.isEnabled() && breakpointAddress >= address && breakpointAddress < address + size) {
+            covered.push_back(&breakpoint);
+        }
+    }
+    for (auto* breakpoint : covered) {
+        breakpoint->disable();
+    }
+    const auto written = writeMemoryBatch(pid, {{address, size}}, data);
+    for (auto* breakpoint : covered) {
+        breakpoint->enable();
+    }
+    return written;
+}
+
+void Debugger::hideBreakpoints(uint64_t address, uint8_t* data, size_t size) const
+{
+    for (const auto& [breakpointAddress, breakpoint] : breakpoints) {
+        if (breakpoint.isEnabled() && breakpointAddress >= address && breakpointAddress < address + size) {
+            data[breakpointAddress - address] = breakpoint.getSavedData();
+        }
+    }
+}
+
+const user_regs_struct& Debugger::getRegisters() const
+{
+    if (!registers) {
+        registers = core ? core->getThreads().at(currentThread).regs : tinydbg::getRegisters(pid);
+    }
+    return *registers;
+}
+
+const XState& Debugger::getXState() const
+{
+    if (!xstate) {
+        // notes of core files don't carry it
+        xstate = core ? XState{} : XState::read(pid);
+    }
+    return *xstate;
+}
+
+uint64_t Debugger::getDwarfRegisterValue(int dwarfRegNum) const
+{
+    const auto name = XState::getDwarfRegisterName(dwarfRegNum);
+    if (!name) {
+        return getRegisterValueFromDwarf(getRegisters(), dwarfRegNum);
+    }
+
+    const auto bytes = getXState().getRegister(*name);
+    if (bytes.empty()) {
+        throw std::out_of_range{"Register " + *name + " is not available"};
+    }
+    uint64_t value = 0;
+    std::memcpy(&value, bytes.data(), std::min(bytes.size(), sizeof(value)));
+    return value;
+}
+
+void Debugger::clearRegisterCache() const
+{
+    registers.reset();
+    xstate.reset();
+}
+
+void Debugger::setRegister(Register r, uint64_t value)
+{
+    auto regs = getRegisters();
+    setRegisterValue(regs, r, value);
+    tinydbg::setRegisters(pid, regs);
+    registers = regs;
+}
+
+void Debugger::setRegisters(const user_regs_struct& regs)
+{
+    tinydbg::setRegisters(pid, regs);
+    registers = regs;
 }
 
 uint64_t Debugger::getPC() const
 {
-    return getRegisterValue(pid, Register::rip);
+    return getRegisters().rip;
 }
 
 void Debugger::setPC(uint64_t pc)
 {
-    setRegisterValue(pid, Register::rip, pc);
+    setRegister(Register::rip, pc);
 }
 
 dwarf::die Debugger::getFunction(uint64_t pc, bool addrOffsetted)
@@ -582,9 +2630,9 @@ dwarf::die Debugger::getFunction(uint64_t pc, bool addrOffsetted)
         pc = getSourceAddress(pc);
     }
 
-    for (const auto& cu : dwarf.compilation_units()) {
+    for (const auto& cu : binary->dwarf.compilation_units()) {
         if (die_pc_range(cu.root()).contains(pc)) {
-            for (const auto& die : cu.root()) {
+            for (const auto& die : binary->debugInfo.getUnitRoot(cu)) {
                 if (die.tag == dwarf::DW_TAG::subprogram) {
                     // TODO investigate this behaviour
                     // die doesn't have range attrs so you can't use die_pc_range
@@ -604,13 +2652,168 @@ dwarf::die Debugger::getFunction(uint64_t pc, bool addrOffsetted)
     throw std::out_of_range{"Cannot find function"};
 }
 
+const CompiledFunction& Debugger::getCompiledFunction(const dwarf::die& function)
+{
+    // split units have their own offsets
+    const auto key = std::make_pair(&function.get_unit(), function.get_section_offset());
+    auto it = binary->compiledFunctions.find(key);
+    if (it == binary->compiledFunctions.end()) {
+        const auto debugLoc = binary->debugInfo.getLocationLists(function.get_unit());
+        it = binary->compiledFunctions.emplace(key, compileFunction(function, *debugLoc)).first;
+    }
+    return it->second;
+}
+
+std::vector<Debugger::VariableValue> Debugger::evaluateVariables(const CompiledFunction& function,
+    const std::vector<const CompiledVariable*>& variables)
+{
+    const auto& regs = getRegisters();
+    const auto pc = getSourceAddress(regs.rip);
+
+    EvaluationContext context{regs, {}, [this](uint64_t address, unsigned size) {
+                                  uint64_t value = 0;
+                                  readMemory(address, &value, std::min<size_t>(size, sizeof(value)));
+                                  return value;
+                              }};
+    context.cfa = getCallFrameCfa(function, regs);
+    // registers which can't be read and broken expressions make variables unavailable,
+    // this runs on every stop for displays and must not throw
+    if (function.frameBase) {
+        try {
+            const auto frameBase = evaluateLocation(*function.frameBase, context);
+            if (frameBase.type != Location::Type::Unavailable) {
+                context.frameBase = frameBase.type == Location::Type::Register
+                    ? getDwarfRegisterValue(static_cast<int>(frameBase.value))
+                    : frameBase.value;
+            }
+        } catch (const std::exception&) {
+            context.frameBase.reset();
+        }
+    }
+
+    std::vector<VariableValue> values;
+    std::vector<MemoryRange> ranges;
+    size_t totalSize = 0;
+    for (const auto* variable : variables) {
+        Location location{Location::Type::Unavailable, 0};
+        uint64_t value = 0;
+        try {
+            location = locateVariable(*variable, context, pc);
+            if (location.type == Location::Type::Register) {
+                value = getDwarfRegisterValue(static_cast<int>(location.value));
+            }
+        } catch (const std::exception&) {
+            location = {Location::Type::Unavailable, 0};
+        }
+        switch (location.type) {
+        case Location::Type::Address: {
+            const auto size = std::min<size_t>(variable->size, sizeof(uint64_t));
+            ranges.push_back({location.value, size});
+            // keep offset into the batch buffer until it's read
+            value = totalSize;
+            totalSize += size;
+            break;
+        }
+        case Location::Type::Register:
+            break;
+        case Location::Type::Value:
+            value = location.value;
+            break;
+        case Location::Type::Unavailable:
+            break;
+        }
+        values.push_back({location, value});
+    }
+
+    // fetch all variables living in memory with a single syscall
+    std::vector<uint8_t> buffer(totalSize);
+    readMemoryBatch(ranges, buffer.data());
+
+    auto range = ranges.cbegin();
+    for (auto& value : values) {
+        if (value.location.type == Location::Type::Address) {
+            const auto offset = value.value;
+            value.value = 0;
+            std::memcpy(&value.value, buffer.data() + offset, range->size);
+            ++range;
+        }
+    }
+
+    return values;
+}
+
+std::optional<uint64_t> Debugger::getCallFrameCfa(const CompiledFunction& function, const user_regs_struct& regs) const
+{
+    // without unwind tables only the usual "push rbp; mov rbp, rsp" prologue is understood,
+    // functions built without frame pointers get no cfa
+    uint8_t prologue[8];
+    if (function.lowPC == 0 || !readCode(binary->elf, function.lowPC, prologue, sizeof(prologue))) {
+        return {};
+    }
+    size_t push = 0;
+    // endbr64
+    if (std::memcmp(prologue, "\xf3\x0f\x1e\xfa", 4) == 0) {
+        push = 4;
+    }
+    if (prologue[push] != 0x55
+        || (std::memcmp(prologue + push + 1, "\x48\x89\xe5", 3) != 0 && std::memcmp(prologue + push + 1, "\x48\x8b\xec", 3) != 0)) {
+        return {};
+    }
+
+    const auto pc = regs.rip - memoryOffset;
+    if (pc <= function.lowPC + push) {
+        // return address is on top of the stack
+        return regs.rsp + 8;
+    }
+    if (pc < function.lowPC + push + 4) {
+        // rbp is pushed but isn't the frame pointer yet
+        return regs.rsp + 16;
+    }
+    uint8_t instruction = 0;
+    if (readCode(binary->elf, pc, &instruction, 1) && instruction == 0xc3) {
+        // rbp was restored by the epilogue
+        return regs.rsp + 8;
+    }
+    // cfa is the stack pointer before the call, i.e. above saved rbp and return address
+    return regs.rbp + 16;
+}
+
+Location Debugger::locateVariable(const CompiledVariable& variable, const EvaluationContext& context, uint64_t pc) const
+{
+    if (variable.location) {
+        const auto* program = variable.location->select(pc);
+        if (program == nullptr) {
+            return {Location::Type::Unavailable, 0};
+        }
+        return evaluateLocation(*program, context);
+    }
+
+    const auto value = variable.die[dwarf::DW_AT::location];
+    if (value.get_type() != dwarf::value::type::exprloc) {
+        return {Location::Type::Unavailable, 0};
+    }
+
+    SnapshotExprContext exprContext{*this, context.regs};
+    const auto result = value.as_exprloc().evaluate(&exprContext);
+    switch (result.location_type) {
+    case dwarf::expr_result::type::address:
+        return {Location::Type::Address, result.value};
+    case dwarf::expr_result::type::reg:
+        return {Location::Type::Register, result.value};
+    case dwarf::expr_result::type::literal:
+        return {Location::Type::Value, result.value};
+    default:
+        return {Location::Type::Unavailable, 0};
+    }
+}
+
 dwarf::line_table::iterator Debugger::getLineEntry(uint64_t pc, bool addrOffsetted)
 {
     if (addrOffsetted) {
         pc = getSourceAddress(pc);
     }
 
-    for (const auto& cu : dwarf.compilation_units()) {
+    for (const auto& cu : binary->dwarf.compilation_units()) {
         if (die_pc_range(cu.root()).contains(pc)) {
             const auto& lineTable = cu.get_line_table();
             auto it = lineTable.find_address(pc);
@@ -667,26 +2870,108 @@ void Debugger::printSource(const std::string& fileName, size_t line, size_t line
     std::cerr << std::endl;
 }
 
-int debug(const std::string& programName)
+pid_t launch(const std::string& programName, const std::set<int>& caughtSyscalls, const std::string& agentLibrary)
 {
+    // prepare filter before fork
+    const auto filter = buildSyscallFilter({caughtSyscalls.cbegin(), caughtSyscalls.cend()});
+    const sock_fprog filterProgram{static_cast<unsigned short>(filter.size()), const_cast<sock_filter*>(filter.data())};
+
     auto pid = fork();
 
     if (pid == 0) {
         // we're in the child process
         // execute debugee
         std::cerr << "child pid: " << getpid() << std::endl;
-        ptrace(PTRACE_TRACEME, pid, nullptr, nullptr);
+        stats::ptrace(PTRACE_TRACEME, pid, nullptr, nullptr);
+        // wait for debugger to set PTRACE_O_TRACESECCOMP,
+        // without it traced syscalls would fail with ENOSYS
+        raise(SIGSTOP);
+        if (!caughtSyscalls.empty()) {
+            prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+            if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &filterProgram) != 0) {
+                std::cerr << "Failed to install seccomp filter: " << strerror(errno) << std::endl;
+            }
+        }
+        if (!agentLibrary.empty()) {
+            setenv("LD_PRELOAD", agentLibrary.c_str(), 1);
+        }
         execl(programName.c_str(), programName.c_str(), nullptr);
-    } else if (pid >= 1) {
-        // we're in the parent process
-        // execute debugger
-        tinydbg::Debugger debugger{programName, pid};
+        std::cerr << "exec failed: " << strerror(errno) << std::endl;
+        _exit(1);
+    }
+
+    if (pid > 0) {
+        stats::waitpid(pid, nullptr, 0);
+        stats::ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_OPTIONS);
+        stats::ptrace(PTRACE_CONT, pid, nullptr, nullptr);
+    }
+
+    return pid;
+}
+
+int debug(const DebugOptions& options)
+{
+    std::vector<int> caughtSyscalls;
+    for (const auto& name : options.catchSyscalls) {
+        const auto number = getSyscallNumber(name);
+        if (!number) {
+            std::cerr << "Unknown syscall: '" << name << "'\n";
+            return -1;
+        }
+        caughtSyscalls.push_back(*number);
+    }
+
+    if (!options.interpreter.empty() && options.interpreter != "json") {
+        std::cerr << "Unknown interpreter: '" << options.interpreter << "'\n";
+        return -1;
+    }
+    // stdin and stdout are kept for JSON lines on descriptors the program doesn't inherit,
+    // the program and stray prints go to stderr
+    const auto json = options.interpreter == "json";
+    const auto jsonInput = json ? fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0) : -1;
+    const auto jsonOutput = json ? fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0) : -1;
+    if (jsonOutput >= 0) {
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    // requests on stdin mustn't be read by the program, the server has no use for stdin either
+    if (json || !options.serverAddress.empty()) {
+        const auto null = open("/dev/null", O_RDONLY);
+        if (null >= 0) {
+            dup2(null, STDIN_FILENO);
+            close(null);
+        }
+    }
+
+    if (!options.coreFile.empty()) {
+        tinydbg::Debugger debugger{options.programName, std::make_shared<CoreFile>(options.coreFile), options.debugDirectories};
+        if (jsonOutput >= 0) {
+            JsonInterpreter interpreter{debugger, jsonInput, jsonOutput};
+            return interpreter.run();
+        }
         debugger.run();
-    } else {
+        return 0;
+    }
+
+    auto pid = launch(options.programName, {caughtSyscalls.cbegin(), caughtSyscalls.cend()}, options.agentLibrary);
+    if (pid < 0) {
         std::cerr << "fork failed, pid: " << pid << std::endl;
         return -1;
     }
 
+    // we're in the parent process
+    // execute debugger
+    tinydbg::Debugger debugger{options.programName, pid, caughtSyscalls, options.agentLibrary, options.debugDirectories};
+    if (!options.serverAddress.empty()) {
+        debugger.initialize();
+        GdbServer server{debugger};
+        return server.serve(options.serverAddress);
+    }
+    if (jsonOutput >= 0) {
+        JsonInterpreter interpreter{debugger, jsonInput, jsonOutput};
+        return interpreter.run();
+    }
+    debugger.run();
+
     return 0;
 }
 
@@ -1,37 +1,146 @@
 #pragma once
 
+#include "binary.h"
 #include "breakpoint.h"
+#include "completion.h"
+#include "corefile.h"
+#include "coverage.h"
+#include "location.h"
+#include "memory.h"
+#include "registers.h"
 #include "symbol.h"
+#include "trace.h"
+#include "tracepoint.h"
 
 #include "dwarf/dwarf++.hh"
 #include "elf/elf++.hh"
 
 #include <signal.h>
+#include <sys/user.h>
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace tinydbg {
 
-int debug(const std::string& programName);
+struct DebugOptions {
+    std::string programName;
+    // syscall names to stop on, selected with seccomp filter at start
+    std::vector<std::string> catchSyscalls;
+    // post-mortem debugging of a core dump instead of launching the program
+    std::string coreFile;
+    // libtinydbg-agent.so preloaded into the program for fast tracepoints
+    std::string agentLibrary;
+    // serve GDB remote protocol on unix:/path or host:port instead of the command line
+    std::string serverAddress;
+    // "json" for JSON lines requests and events instead of the prompt
+    std::string interpreter;
+    // stats are written there as JSON when the session ends
+    std::string statsFile;
+    // searched for separate debug files before /usr/lib/debug
+    std::vector<std::string> debugDirectories;
+};
+
+int debug(const DebugOptions& options);
+
+// fork and exec debugee, it stops with SIGTRAP once exec is done
+// caught syscalls stop debugee through seccomp filter, the rest run at full speed
+pid_t launch(const std::string& programName, const std::set<int>& caughtSyscalls = {}, const std::string& agentLibrary = {});
 
 class Debugger {
 public:
-    Debugger(std::string programName, int pid);
+    Debugger(std::string programName, int pid, std::vector<int> caughtSyscalls = {}, std::string agentLibrary = {},
+        const std::vector<std::string>& debugDirectories = {});
+    // read-only debugger over a core dump, there is no process
+    Debugger(std::string programName, std::shared_ptr<CoreFile> core, const std::vector<std::string>& debugDirectories = {});
 
+    // wait for the launched program to stop after exec, or load the core
+    void initialize();
     void run();
+    // errors of the command are printed
     void handleCommand(const std::string& line);
+    // errors of the command are thrown, for callers which report them themselves
+    void executeCommand(const std::string& line);
+    // full command name for an abbreviation like "b", empty if there is no such command
+    static std::string resolveCommand(const std::string& abbreviation);
+    // lines the tab key offers for line, commands, symbols, source files and registers
+    std::vector<std::string> complete(const std::string& line);
     void handleBreakpoint(const std::vector<std::string>& args);
     void handleRegister(const std::vector<std::string>& args);
     void handleMemory(const std::vector<std::string>& args);
     void handleStepi();
     void handleSymbol(const std::vector<std::string>& args);
+    void handleDisplay(const std::vector<std::string>& args);
+    void handleUndisplay(const std::vector<std::string>& args);
+    void handleCheckpoint(const std::vector<std::string>& args);
+    void handleRestart(const std::vector<std::string>& args);
+    // relaunch inferior keeping debug info and breakpoints
+    void handleRun();
+    void killProcess();
+    void handleTrace(const std::vector<std::string>& args);
+    // trace entry and exit of functions which match glob pattern
+    void traceFunctions(const std::string& pattern);
+    void stopTracing();
+    void handleCoverage(const std::vector<std::string>& args);
+    // one-shot breakpoint on every statement line
+    void startCoverage();
+    void stopCoverage();
+    void handleCatch(const std::vector<std::string>& args);
+    // list or select core dump threads
+    void handleThread(const std::vector<std::string>& args);
+    // dump core of the running process
+    void handleGcore(const std::vector<std::string>& args);
+    // find {0xSTART|0xSTART-0xEND|all|path} {pattern}
+    void handleFind(const std::vector<std::string>& args);
+    // find-pointers-to {0xADDRESS} [size] lists words pointing into [address, address + size)
+    void handleFindPointers(const std::vector<std::string>& args);
+    void handleTracepoint(const std::vector<std::string>& args);
+    // list inferiors followed through fork, inferior {n} selects one
+    void handleInferior(const std::vector<std::string>& args);
+    // memdiff start snapshots memory, memdiff show [n] lists what was written since, stop
+    void handleMemdiff(const std::vector<std::string>& args);
+    // with false forks are detached instead of followed, their breakpoints removed
+    void setFollowForks(bool follow) { followForks = follow; }
+    // syscall and command counters, stats [reset|export {file.json}]
+    void handleStats(const std::vector<std::string>& args);
+    // jump patched tracepoint recorded by the agent, address should be offset to process virtual memory
+    void addTracepoint(uint64_t address, const std::string& name);
+    // put original instructions of every tracepoint back, false if a thread is inside of one
+    bool removeTracepoints();
     void continueExecution();
     void printBacktrace();
     void readVariables();
+
+    struct Frame {
+        uint64_t pc;
+        // start of the function
+        uint64_t address;
+        std::string function;
+    };
+    // frames up to main walked by frame pointers
+    std::vector<Frame> getBacktrace();
+
+    struct Variable {
+        std::string name;
+        Location location;
+        uint64_t value;
+    };
+    // all variables of the current function
+    std::vector<Variable> getVariables();
+    // print display expressions which changed since the previous stop
+    void refreshDisplays(bool force = false);
     // address should be offset to process virtual memory
     void setBreakpoint(uint64_t address);
     void setBreakpointAtFunction(const std::string& name);
     void setBreakpointAtLine(const std::string& file, size_t line);
+    // 0xADDRESS, file:line or function as given to break
+    void setBreakpointAtSpec(const std::string& spec);
     std::vector<Symbol> lookupSymbol(const std::string& name);
     void removeBreakpoint(uint64_t address);
     void singleStepInstruction();
@@ -40,11 +149,51 @@ public:
     void stepOut();
     void stepOver();
     void stepOverBreakpoint();
-    void waitForSignal();
+    // returns false if options has WNOHANG and the inferior is still running,
+    // with anyInferior a stop of another inferior makes it the current one
+    bool waitForSignal(int options = 0, bool anyInferior = false);
     void handleSigtrap(siginfo_t siginfo);
+    // continue from the current stop delivering signal, doesn't wait
+    void resume(int signal = 0);
+    // the last stop was handled internally (tracing, coverage, skipped syscall)
+    bool isResumeNeeded() const { return resumeAfterStop; }
+    void detach();
+
+    struct StopReason {
+        enum class Kind {
+            Signal,
+            Exited,
+            Terminated,
+        };
+
+        Kind kind;
+        // signal number or exit code
+        int value;
+        bool breakpoint;
+    };
+    const StopReason& getLastStop() const { return lastStop; }
+    // grows on every stop, tells if a command ran the inferior
+    uint64_t getStopCount() const { return stopCount; }
+    pid_t getPid() const { return pid; }
+    // there is a live process or a core dump to inspect
+    bool canInspect() const { return pid != 0 || core != nullptr; }
 
     uint64_t readMemory(uint64_t address) const;
+    bool readMemory(uint64_t address, void* buffer, size_t size) const;
+    size_t readMemoryBatch(const std::vector<MemoryRange>& ranges, void* buffer) const;
     void writeMemory(uint64_t address, uint64_t value);
+    bool writeMemory(uint64_t address, const void* data, size_t size);
+    // replace int3 of our breakpoints in data read from address with original bytes
+    void hideBreakpoints(uint64_t address, uint8_t* data, size_t size) const;
+
+    // registers are fetched once per stop and cached until the inferior resumes
+    const user_regs_struct& getRegisters() const;
+    void setRegister(Register r, uint64_t value);
+    void setRegisters(const user_regs_struct& regs);
+    // x87, SSE and AVX state, fetched on the first use after a stop
+    const XState& getXState() const;
+    // low 64 bits for vector registers, throws std::out_of_range if it's unknown or unavailable
+    uint64_t getDwarfRegisterValue(int dwarfRegNum) const;
 
     uint64_t getPC() const;
     void setPC(uint64_t pc);
@@ -52,18 +201,149 @@ public:
     dwarf::die getFunction(uint64_t pc, bool addrOffsetted = true);
     dwarf::line_table::iterator getLineEntry(uint64_t pc, bool addrOffsetted = true);
 
+    void updateMemoryOffset();
+    // difference between link time and run time addresses, zero for non-PIE programs
+    uint64_t getLoadBias() const;
+    // readable regions of the process or the ones present in the core
+    std::vector<MemoryRegion> getMemoryRegions() const;
     uint64_t getOffsettedAddress(uint64_t addr);
     uint64_t getSourceAddress(uint64_t offsettedAddress);
 
     void printSource(const std::string& fileName, size_t line, size_t linesContext = 2);
 
 private:
+    struct VariableValue {
+        Location location;
+        uint64_t value;
+    };
+
+    struct Display {
+        size_t number;
+        // variable name or $register
+        std::string expression;
+        // empty when expression couldn't be evaluated at the last stop
+        std::optional<uint64_t> lastValue;
+        bool shown;
+    };
+
+    // suspended fork of the inferior
+    struct Checkpoint {
+        size_t number;
+        pid_t pid;
+        uint64_t pc;
+        // breakpoints as they were in memory of the fork
+        BreakpointTable breakpoints;
+    };
+
+    // process followed through fork which isn't the current one,
+    // the current one lives in pid, memoryOffset, binary, breakpoints and tracepoints
+    struct Inferior {
+        size_t number;
+        pid_t pid;
+        uint64_t memoryOffset;
+        std::shared_ptr<Binary> binary;
+        BreakpointTable breakpoints;
+        std::unique_ptr<TracepointAgent> tracepoints;
+        bool running;
+        // SIGSTOP it starts with as a fork, or the one of a selection, is still to come
+        bool stopRequested;
+    };
+
+    // process stopped, exited or was killed, waitStatus is what waitpid gave
+    void handleStop(int waitStatus);
+    void handleFork(bool vfork);
+    // reloads symbols if another program is executed, moves breakpoints if it's the same one
+    void handleExec();
+    // handles stop or exit of an inferior other than the current one,
+    // true if it should be reported, then it's the current one
+    bool handleInferiorEvent(pid_t stopped, int waitStatus);
+    // current inferior goes to the table, the one at index takes its place
+    void switchInferior(size_t index, bool currentRunning);
+    // " in inferior n (pid p)" once there is more than one inferior
+    std::string describeInferior() const;
+    void handleTraceHit(uint64_t pc);
+    void handleCoverageHit(uint64_t pc);
+    // true if tracer or coverage still needs breakpoint at address
+    bool isInternalBreakpointNeeded(uint64_t address) const;
+    // internal breakpoints don't stop execution, make these ones stop while stepping
+    std::vector<uint64_t> borrowInternalBreakpoints(const std::vector<uint64_t>& addresses);
+    void returnInternalBreakpoints(const std::vector<uint64_t>& addresses);
+
+    // regions limited by find selector, empty if selector is invalid
+    std::optional<std::vector<MemoryRegion>> selectMemoryRegions(const std::string& selector) const;
+    // memory of regions is given to scan in large chunks, consecutive chunks overlap by overlap bytes,
+    // scanning stops once scan returns false
+    void scanMemory(const std::vector<MemoryRegion>& regions, size_t overlap,
+        const std::function<bool(const uint8_t* data, size_t size, uint64_t address)>& scan) const;
+
+    // built on the first completion, large programs have millions of symbols
+    const PrefixIndex& getSymbolIndex();
+    const PrefixIndex& getFileIndex();
+
+    // inferior was resumed or switched, cached registers are stale
+    void clearRegisterCache() const;
+
+    const CompiledFunction& getCompiledFunction(const dwarf::die& function);
+    // cfa of the current frame of function, empty before its frame pointer is known
+    std::optional<uint64_t> getCallFrameCfa(const CompiledFunction& function, const user_regs_struct& regs) const;
+    Location locateVariable(const CompiledVariable& variable, const EvaluationContext& context, uint64_t pc) const;
+    const std::vector<DataSymbol>& getDataSymbols();
+    // memdiff snapshot fork is killed, it's kept until the process or its image goes away
+    void dropMemorySnapshot();
+    // evaluates all variables of the current function, memory is read in one batch
+    std::vector<VariableValue> evaluateVariables(const CompiledFunction& function,
+        const std::vector<const CompiledVariable*>& variables);
+
     std::string programName;
     int pid;
     uint64_t memoryOffset;
-    elf::elf elf;
-    dwarf::dwarf dwarf;
-    std::unordered_map<uint64_t, Breakpoint> breakpoints;
+    BinaryCache binaries;
+    // what the current inferior runs, it changes on exec
+    std::shared_ptr<Binary> binary;
+    BreakpointTable breakpoints;
+    mutable std::optional<user_regs_struct> registers;
+    mutable std::optional<XState> xstate;
+    std::vector<Display> displays;
+    size_t nextDisplayNumber = 1;
+    std::vector<Checkpoint> checkpoints;
+    size_t nextCheckpointNumber = 1;
+    CallTracer tracer;
+    Coverage coverage;
+    // breakpoints which were inserted by tracer or coverage and aren't user ones
+    std::unordered_set<uint64_t> internalBreakpoints;
+    // what break was given, resolved again when run finds the program rebuilt
+    std::vector<std::string> breakpointSpecs;
+    // program was rebuilt, specs are resolved once its exec is reported
+    bool resolveSpecsOnExec = false;
+    // set when the stop was handled internally and execution should go on
+    bool resumeAfterStop = false;
+    std::set<int> caughtSyscalls;
+    // syscalls seccomp filter of the running process traces
+    std::set<int> filteredSyscalls;
+    // set when debugging a core dump, memory and registers come from it
+    std::shared_ptr<CoreFile> core;
+    size_t currentThread = 0;
+    std::string agentLibrary;
+    // connected on the first tracepoint
+    std::unique_ptr<TracepointAgent> tracepoints;
+    size_t inferiorNumber = 1;
+    size_t nextInferiorNumber = 2;
+    std::vector<Inferior> inferiors;
+    // SIGSTOP which stopped the current inferior on selection is still to come
+    bool stopRequested = false;
+    // forks which stopped before their parent reported the fork
+    std::unordered_set<pid_t> unknownForks;
+    bool followForks = true;
+    // suspended fork of process pid holding its memory as it was at memdiff start
+    struct MemorySnapshot {
+        pid_t pid;
+        pid_t fork;
+        // false if the kernel has no CONFIG_MEM_SOFT_DIRTY, then every resident page is compared
+        bool softDirty;
+    };
+    std::optional<MemorySnapshot> memorySnapshot;
+    StopReason lastStop{StopReason::Kind::Signal, 0, false};
+    uint64_t stopCount = 0;
 };
 
 } // namespace tinydbg
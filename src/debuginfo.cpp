@@ -0,0 +1,953 @@
+#include "debuginfo.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef TINYDBG_ZSTD
+#include <zstd.h>
+#endif
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef ELFCOMPRESS_ZSTD
+#define ELFCOMPRESS_ZSTD 2
+#endif
+
+namespace tinydbg {
+
+namespace {
+
+// decompressed sections read by tinydbg itself are evicted beyond that
+constexpr size_t SECTION_CACHE_LIMIT = 64 << 20;
+
+// GNU split DWARF extensions of DWARF 4
+constexpr auto DW_AT_GNU_dwo_name = static_cast<dwarf::DW_AT>(0x2130);
+constexpr auto DW_AT_GNU_dwo_id = static_cast<dwarf::DW_AT>(0x2131);
+constexpr auto DW_AT_GNU_ranges_base = static_cast<dwarf::DW_AT>(0x2132);
+constexpr auto DW_AT_GNU_addr_base = static_cast<dwarf::DW_AT>(0x2133);
+constexpr uint64_t DW_FORM_GNU_addr_index = 0x1f01;
+constexpr uint64_t DW_FORM_GNU_str_index = 0x1f02;
+constexpr uint8_t DW_OP_GNU_addr_index = 0xfb;
+constexpr uint8_t DW_OP_GNU_const_index = 0xfc;
+
+// .debug_cu_index section columns
+constexpr uint32_t DW_SECT_INFO = 1;
+constexpr uint32_t DW_SECT_ABBREV = 3;
+constexpr uint32_t DW_SECT_STR_OFFSETS = 6;
+
+std::vector<uint8_t> inflate(uint32_t type, const uint8_t* data, size_t size, size_t inflatedSize)
+{
+    std::vector<uint8_t> inflated(inflatedSize);
+    if (type == ELFCOMPRESS_ZLIB) {
+        uLongf length = inflated.size();
+        if (uncompress(inflated.data(), &length, data, size) != Z_OK || length != inflated.size()) {
+            throw std::runtime_error{"Corrupted zlib section"};
+        }
+        return inflated;
+    }
+#ifdef TINYDBG_ZSTD
+    if (type == ELFCOMPRESS_ZSTD) {
+        const auto length = ZSTD_decompress(inflated.data(), inflated.size(), data, size);
+        if (ZSTD_isError(length) || length != inflated.size()) {
+            throw std::runtime_error{"Corrupted zstd section"};
+        }
+        return inflated;
+    }
+#endif
+    throw std::runtime_error{type == ELFCOMPRESS_ZSTD ? "Built without zstd support"
+                                                      : "Unknown section compression " + std::to_string(type)};
+}
+
+class Reader {
+public:
+    Reader(const uint8_t* begin, size_t size)
+        : begin{begin}
+        , pos{begin}
+        , end{begin + size}
+    {
+    }
+
+    bool atEnd() const { return pos >= end; }
+    size_t offset() const { return pos - begin; }
+    const uint8_t* position() const { return pos; }
+
+    const uint8_t* skip(size_t size)
+    {
+        if (static_cast<size_t>(end - pos) < size) {
+            throw std::out_of_range{"Truncated split unit"};
+        }
+        const auto* start = pos;
+        pos += size;
+        return start;
+    }
+
+    template <typename T>
+    T fixed()
+    {
+        T value;
+        std::memcpy(&value, skip(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    uint64_t uleb128()
+    {
+        uint64_t result = 0;
+        int shift = 0;
+        uint8_t byte;
+        do {
+            byte = fixed<uint8_t>();
+            if (shift < 64) {
+                result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            }
+            shift += 7;
+        } while (byte & 0x80);
+        return result;
+    }
+
+    // raw bytes of a LEB128 number
+    std::pair<const uint8_t*, size_t> leb128()
+    {
+        const auto* start = pos;
+        while (fixed<uint8_t>() & 0x80) {
+        }
+        return {start, static_cast<size_t>(pos - start)};
+    }
+
+private:
+    const uint8_t* begin;
+    const uint8_t* pos;
+    const uint8_t* end;
+};
+
+class Writer {
+public:
+    std::vector<uint8_t> bytes;
+
+    void put(const void* data, size_t size)
+    {
+        const auto* start = static_cast<const uint8_t*>(data);
+        bytes.insert(bytes.end(), start, start + size);
+    }
+
+    template <typename T>
+    void fixed(T value)
+    {
+        put(&value, sizeof(value));
+    }
+
+    void uleb128(uint64_t value)
+    {
+        do {
+            uint8_t byte = value & 0x7f;
+            value >>= 7;
+            bytes.push_back(value != 0 ? byte | 0x80 : byte);
+        } while (value != 0);
+    }
+
+    template <typename T>
+    void patch(size_t offset, T value)
+    {
+        std::memcpy(bytes.data() + offset, &value, sizeof(value));
+    }
+};
+
+// Rewrites DWARF 4 .dwo units into plain DWARF libelfin understands:
+// string and address index forms become strp and addr, index operations which start
+// location expressions become DW_OP_addr and DW_OP_const8u, DIE references become ref4
+// because sizes of DIEs change, ranges get the skeleton ranges base added.
+class SplitUnitTranscoder {
+public:
+    struct Input {
+        const SectionData& info;
+        const SectionData& abbrev;
+        const SectionData& strOffsets;
+        const SectionData& addr;
+        uint64_t addrBase;
+        uint64_t rangesBase;
+    };
+
+    explicit SplitUnitTranscoder(const Input& input)
+        : input{input}
+    {
+    }
+
+    void transcode(std::vector<uint8_t>& info, std::vector<uint8_t>& abbrev)
+    {
+        transcodeAbbrevs();
+        Reader reader{input.info.data, input.info.size};
+        while (!reader.atEnd()) {
+            transcodeUnit(reader);
+        }
+        for (const auto& fixup : fixups) {
+            auto it = dieOffsets.find(fixup.target);
+            if (it == dieOffsets.end()) {
+                throw std::runtime_error{"Reference to unknown DIE"};
+            }
+            infoWriter.patch(fixup.offset, static_cast<uint32_t>(it->second - fixup.base));
+        }
+        info = std::move(infoWriter.bytes);
+        abbrev = std::move(abbrevWriter.bytes);
+    }
+
+private:
+    struct Abbrev {
+        std::vector<std::pair<uint64_t, uint64_t>> attributes;
+    };
+
+    struct Fixup {
+        size_t offset;
+        uint64_t target;
+        // start of the new unit for unit relative references
+        uint64_t base;
+    };
+
+    static uint64_t transcodeForm(uint64_t form)
+    {
+        switch (form) {
+        case DW_FORM_GNU_addr_index:
+            return static_cast<uint64_t>(dwarf::DW_FORM::addr);
+        case DW_FORM_GNU_str_index:
+            return static_cast<uint64_t>(dwarf::DW_FORM::strp);
+        case static_cast<uint64_t>(dwarf::DW_FORM::ref1):
+        case static_cast<uint64_t>(dwarf::DW_FORM::ref2):
+        case static_cast<uint64_t>(dwarf::DW_FORM::ref8):
+        case static_cast<uint64_t>(dwarf::DW_FORM::ref_udata):
+            return static_cast<uint64_t>(dwarf::DW_FORM::ref4);
+        default:
+            return form;
+        }
+    }
+
+    void transcodeAbbrevs()
+    {
+        Reader reader{input.abbrev.data, input.abbrev.size};
+        bool tableStart = true;
+        while (!reader.atEnd()) {
+            if (tableStart) {
+                tableOffsets[reader.offset()] = abbrevWriter.bytes.size();
+                currentTable = &abbrevTables[reader.offset()];
+                tableStart = false;
+            }
+            const auto code = reader.uleb128();
+            abbrevWriter.uleb128(code);
+            if (code == 0) {
+                tableStart = true;
+                continue;
+            }
+            abbrevWriter.uleb128(reader.uleb128());
+            abbrevWriter.fixed(reader.fixed<uint8_t>());
+            auto& abbrev = (*currentTable)[code];
+            while (true) {
+                const auto name = reader.uleb128();
+                const auto form = reader.uleb128();
+                abbrevWriter.uleb128(name);
+                abbrevWriter.uleb128(transcodeForm(form));
+                if (name == 0 && form == 0) {
+                    break;
+                }
+                abbrev.attributes.emplace_back(name, form);
+            }
+        }
+    }
+
+    void transcodeUnit(Reader& reader)
+    {
+        const auto oldStart = reader.offset();
+        const auto length = reader.fixed<uint32_t>();
+        if (length >= 0xfffffff0) {
+            throw std::runtime_error{"64-bit DWARF isn't supported"};
+        }
+        const auto oldEnd = reader.offset() + length;
+        const auto version = reader.fixed<uint16_t>();
+        if (version != 4) {
+            throw std::runtime_error{"DWARF " + std::to_string(version) + " split units aren't supported"};
+        }
+        const auto abbrevOffset = reader.fixed<uint32_t>();
+        addressSize = reader.fixed<uint8_t>();
+        if (addressSize != sizeof(uint64_t)) {
+            throw std::runtime_error{"Only 64-bit split units are supported"};
+        }
+        auto table = abbrevTables.find(abbrevOffset);
+        if (table == abbrevTables.end()) {
+            throw std::runtime_error{"Unknown abbreviation table"};
+        }
+
+        oldUnitStart = oldStart;
+        newUnitStart = infoWriter.bytes.size();
+        infoWriter.fixed<uint32_t>(0);
+        infoWriter.fixed<uint16_t>(version);
+        infoWriter.fixed<uint32_t>(tableOffsets.at(abbrevOffset));
+        infoWriter.fixed<uint8_t>(addressSize);
+
+        while (reader.offset() < oldEnd) {
+            dieOffsets[reader.offset()] = infoWriter.bytes.size();
+            const auto code = reader.uleb128();
+            infoWriter.uleb128(code);
+            if (code == 0) {
+                continue;
+            }
+            auto abbrev = table->second.find(code);
+            if (abbrev == table->second.end()) {
+                throw std::runtime_error{"Unknown abbreviation " + std::to_string(code)};
+            }
+            for (const auto& [name, form] : abbrev->second.attributes) {
+                transcodeValue(reader, name, form);
+            }
+        }
+
+        infoWriter.patch(newUnitStart, static_cast<uint32_t>(infoWriter.bytes.size() - newUnitStart - sizeof(uint32_t)));
+    }
+
+    void copy(Reader& reader, size_t size)
+    {
+        infoWriter.put(reader.skip(size), size);
+    }
+
+    void reference(uint64_t target, uint64_t base)
+    {
+        fixups.push_back({infoWriter.bytes.size(), target, base});
+        infoWriter.fixed<uint32_t>(0);
+    }
+
+    void transcodeValue(Reader& reader, uint64_t name, uint64_t form)
+    {
+        using dwarf::DW_FORM;
+        switch (form) {
+        case static_cast<uint64_t>(DW_FORM::addr):
+            copy(reader, addressSize);
+            break;
+        case static_cast<uint64_t>(DW_FORM::data1):
+        case static_cast<uint64_t>(DW_FORM::flag):
+            copy(reader, 1);
+            break;
+        case static_cast<uint64_t>(DW_FORM::data2):
+            copy(reader, 2);
+            break;
+        case static_cast<uint64_t>(DW_FORM::data4):
+        case static_cast<uint64_t>(DW_FORM::sec_offset):
+            if (name == static_cast<uint64_t>(dwarf::DW_AT::ranges)) {
+                infoWriter.fixed<uint32_t>(reader.fixed<uint32_t>() + input.rangesBase);
+            } else {
+                copy(reader, 4);
+            }
+            break;
+        case static_cast<uint64_t>(DW_FORM::strp):
+            copy(reader, 4);
+            break;
+        case static_cast<uint64_t>(DW_FORM::data8):
+        case static_cast<uint64_t>(DW_FORM::ref_sig8):
+            copy(reader, 8);
+            break;
+        case static_cast<uint64_t>(DW_FORM::sdata):
+        case static_cast<uint64_t>(DW_FORM::udata): {
+            const auto [data, size] = reader.leb128();
+            infoWriter.put(data, size);
+            break;
+        }
+        case static_cast<uint64_t>(DW_FORM::string): {
+            const auto* start = reader.position();
+            while (reader.fixed<uint8_t>() != 0) {
+            }
+            infoWriter.put(start, reader.position() - start);
+            break;
+        }
+        case static_cast<uint64_t>(DW_FORM::block1):
+            copyBlock(reader, reader.fixed<uint8_t>(), 1);
+            break;
+        case static_cast<uint64_t>(DW_FORM::block2):
+            copyBlock(reader, reader.fixed<uint16_t>(), 2);
+            break;
+        case static_cast<uint64_t>(DW_FORM::block4):
+            copyBlock(reader, reader.fixed<uint32_t>(), 4);
+            break;
+        case static_cast<uint64_t>(DW_FORM::block): {
+            const auto size = reader.uleb128();
+            infoWriter.uleb128(size);
+            copy(reader, size);
+            break;
+        }
+        case static_cast<uint64_t>(DW_FORM::exprloc):
+            transcodeExpression(reader, reader.uleb128());
+            break;
+        case static_cast<uint64_t>(DW_FORM::flag_present):
+            break;
+        case static_cast<uint64_t>(DW_FORM::ref1):
+            reference(oldUnitStart + reader.fixed<uint8_t>(), newUnitStart);
+            break;
+        case static_cast<uint64_t>(DW_FORM::ref2):
+            reference(oldUnitStart + reader.fixed<uint16_t>(), newUnitStart);
+            break;
+        case static_cast<uint64_t>(DW_FORM::ref4):
+            reference(oldUnitStart + reader.fixed<uint32_t>(), newUnitStart);
+            break;
+        case static_cast<uint64_t>(DW_FORM::ref8):
+            reference(oldUnitStart + reader.fixed<uint64_t>(), newUnitStart);
+            break;
+        case static_cast<uint64_t>(DW_FORM::ref_udata):
+            reference(oldUnitStart + reader.uleb128(), newUnitStart);
+            break;
+        case static_cast<uint64_t>(DW_FORM::ref_addr):
+            reference(reader.fixed<uint32_t>(), 0);
+            break;
+        case static_cast<uint64_t>(DW_FORM::indirect): {
+            const auto actual = reader.uleb128();
+            infoWriter.uleb128(transcodeForm(actual));
+            transcodeValue(reader, name, actual);
+            break;
+        }
+        case DW_FORM_GNU_addr_index:
+            infoWriter.fixed(getAddress(reader.uleb128()));
+            break;
+        case DW_FORM_GNU_str_index:
+            infoWriter.fixed(getStringOffset(reader.uleb128()));
+            break;
+        default:
+            throw std::runtime_error{"Unsupported attribute form " + std::to_string(form)};
+        }
+    }
+
+    void copyBlock(Reader& reader, size_t size, size_t lengthSize)
+    {
+        infoWriter.put(&size, lengthSize);
+        copy(reader, size);
+    }
+
+    // only the first operation is rewritten, that's where compilers put index operations of variables
+    void transcodeExpression(Reader& reader, size_t size)
+    {
+        Reader expression{reader.skip(size), size};
+        Writer rewritten;
+        if (!expression.atEnd()) {
+            const auto op = *expression.position();
+            if (op == DW_OP_GNU_addr_index || op == DW_OP_GNU_const_index) {
+                expression.skip(1);
+                rewritten.fixed<uint8_t>(op == DW_OP_GNU_addr_index ? 0x03 /* DW_OP_addr */ : 0x0e /* DW_OP_const8u */);
+                rewritten.fixed(getAddress(expression.uleb128()));
+            }
+        }
+        rewritten.put(expression.position(), size - expression.offset());
+        infoWriter.uleb128(rewritten.bytes.size());
+        infoWriter.put(rewritten.bytes.data(), rewritten.bytes.size());
+    }
+
+    uint64_t getAddress(uint64_t index) const
+    {
+        const auto offset = input.addrBase + index * addressSize;
+        if (input.addr.data == nullptr || offset + sizeof(uint64_t) > input.addr.size) {
+            throw std::runtime_error{"Address index out of .debug_addr"};
+        }
+        uint64_t address;
+        std::memcpy(&address, input.addr.data + offset, sizeof(address));
+        return address;
+    }
+
+    uint32_t getStringOffset(uint64_t index) const
+    {
+        const auto offset = index * sizeof(uint32_t);
+        if (offset + sizeof(uint32_t) > input.strOffsets.size) {
+            throw std::runtime_error{"String index out of .debug_str_offsets.dwo"};
+        }
+        uint32_t stringOffset;
+        std::memcpy(&stringOffset, input.strOffsets.data + offset, sizeof(stringOffset));
+        return stringOffset;
+    }
+
+    const Input& input;
+    Writer infoWriter;
+    Writer abbrevWriter;
+    // by old offsets
+    std::unordered_map<uint64_t, std::unordered_map<uint64_t, Abbrev>> abbrevTables;
+    std::unordered_map<uint64_t, Abbrev>* currentTable = nullptr;
+    std::unordered_map<uint64_t, uint64_t> tableOffsets;
+    std::unordered_map<uint64_t, uint64_t> dieOffsets;
+    std::vector<Fixup> fixups;
+    uint64_t oldUnitStart = 0;
+    uint64_t newUnitStart = 0;
+    uint8_t addressSize = 0;
+};
+
+// sections of the debug file, decompressed on the first load and kept while libelfin uses them
+class SectionLoader : public dwarf::loader {
+public:
+    explicit SectionLoader(elf::elf file)
+        : file{std::move(file)}
+    {
+    }
+
+    const void* load(dwarf::section_type type, size_t* size) override
+    {
+        auto it = sections.find(type);
+        if (it == sections.end()) {
+            SectionData section;
+            try {
+                section = readSection(file, dwarf::elf::section_type_to_name(type));
+            } catch (const std::exception& e) {
+                std::cerr << "Failed to read " << dwarf::elf::section_type_to_name(type) << ": " << e.what() << std::endl;
+            }
+            it = sections.emplace(type, std::move(section)).first;
+        }
+        *size = it->second.size;
+        return it->second.data;
+    }
+
+private:
+    elf::elf file;
+    std::unordered_map<dwarf::section_type, SectionData> sections;
+};
+
+// transcoded split unit, strings and ranges are taken as they are
+class SplitUnitLoader : public dwarf::loader {
+public:
+    SplitUnitLoader(std::vector<uint8_t> info, std::vector<uint8_t> abbrev, std::shared_ptr<const SectionData> strings,
+        std::shared_ptr<dwarf::loader> parent)
+        : info{std::move(info)}
+        , abbrev{std::move(abbrev)}
+        , strings{std::move(strings)}
+        , parent{std::move(parent)}
+    {
+    }
+
+    const void* load(dwarf::section_type type, size_t* size) override
+    {
+        switch (type) {
+        case dwarf::section_type::info:
+            *size = info.size();
+            return info.data();
+        case dwarf::section_type::abbrev:
+            *size = abbrev.size();
+            return abbrev.data();
+        case dwarf::section_type::str:
+            *size = strings->size;
+            return strings->data;
+        case dwarf::section_type::ranges:
+            return parent->load(type, size);
+        default:
+            *size = 0;
+            return nullptr;
+        }
+    }
+
+private:
+    std::vector<uint8_t> info;
+    std::vector<uint8_t> abbrev;
+    std::shared_ptr<const SectionData> strings;
+    std::shared_ptr<dwarf::loader> parent;
+};
+
+std::optional<elf::elf> openElf(const std::string& path)
+{
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return {};
+    }
+    try {
+        return elf::elf{elf::create_mmap_loader(fd)};
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to open " << path << ": " << e.what() << std::endl;
+        return {};
+    }
+}
+
+bool hasSection(const elf::elf& file, const std::string& name)
+{
+    const auto& section = file.get_section(name);
+    return section.valid() && section.get_hdr().type != elf::sht::nobits;
+}
+
+bool hasDebugInfo(const elf::elf& file)
+{
+    return hasSection(file, ".debug_info") || hasSection(file, ".zdebug_info");
+}
+
+// hex digits of NT_GNU_BUILD_ID note, empty if there is none
+std::string getBuildId(const elf::elf& file)
+{
+    const auto& section = file.get_section(".note.gnu.build-id");
+    if (!section.valid() || section.get_hdr().type != elf::sht::note) {
+        return {};
+    }
+    Reader reader{static_cast<const uint8_t*>(section.data()), section.size()};
+    try {
+        while (!reader.atEnd()) {
+            const auto nameSize = reader.fixed<uint32_t>();
+            const auto descriptionSize = reader.fixed<uint32_t>();
+            const auto type = reader.fixed<uint32_t>();
+            const auto* name = reader.skip((nameSize + 3) & ~3u);
+            const auto* description = reader.skip((descriptionSize + 3) & ~3u);
+            if (type == NT_GNU_BUILD_ID && nameSize == 4 && std::memcmp(name, "GNU", 4) == 0) {
+                std::ostringstream id;
+                for (uint32_t i = 0; i < descriptionSize; ++i) {
+                    id << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(description[i]);
+                }
+                return id.str();
+            }
+        }
+    } catch (const std::out_of_range&) {
+    }
+    return {};
+}
+
+std::optional<uint32_t> getFileCrc(const std::string& path)
+{
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return {};
+    }
+    uLong crc = crc32(0, nullptr, 0);
+    std::vector<uint8_t> buffer(1 << 16);
+    ssize_t size;
+    while ((size = read(fd, buffer.data(), buffer.size())) > 0) {
+        crc = crc32(crc, buffer.data(), size);
+    }
+    close(fd);
+    if (size < 0) {
+        return {};
+    }
+    return static_cast<uint32_t>(crc);
+}
+
+std::string getDirectory(const std::string& path)
+{
+    const auto slash = path.rfind('/');
+    return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+std::string getFileName(const std::string& path)
+{
+    const auto slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+std::string getRealPath(const std::string& path)
+{
+    char resolved[PATH_MAX];
+    return realpath(path.c_str(), resolved) != nullptr ? resolved : path;
+}
+
+// same places GDB looks at: build-id tree of debug directories, then .gnu_debuglink
+// next to the program, in its .debug subdirectory and under debug directories
+std::optional<std::pair<std::string, elf::elf>> findDebugFile(const std::string& programPath, const elf::elf& program,
+    const std::vector<std::string>& directories)
+{
+    const auto buildId = getBuildId(program);
+    if (buildId.size() > 2) {
+        for (const auto& directory : directories) {
+            auto path = directory + "/.build-id/" + buildId.substr(0, 2) + '/' + buildId.substr(2) + ".debug";
+            auto file = openElf(path);
+            if (file && hasDebugInfo(*file)) {
+                return std::make_pair(std::move(path), std::move(*file));
+            }
+        }
+    }
+
+    const auto& link = program.get_section(".gnu_debuglink");
+    if (!link.valid() || link.size() < sizeof(uint32_t)) {
+        return {};
+    }
+    const auto* data = static_cast<const char*>(link.data());
+    const std::string name{data, strnlen(data, link.size())};
+    const auto crcOffset = (name.size() + 1 + 3) & ~size_t{3};
+    if (crcOffset + sizeof(uint32_t) > link.size()) {
+        return {};
+    }
+    uint32_t crc;
+    std::memcpy(&crc, data + crcOffset, sizeof(crc));
+
+    const auto programDirectory = getDirectory(programPath);
+    std::vector<std::string> candidates{programDirectory + '/' + name, programDirectory + "/.debug/" + name};
+    for (const auto& directory : directories) {
+        candidates.push_back(directory + programDirectory + '/' + name);
+    }
+    for (auto& path : candidates) {
+        // the program itself may be named like its debug link
+        if (getRealPath(path) == programPath || getFileCrc(path) != crc) {
+            continue;
+        }
+        auto file = openElf(path);
+        if (file && hasDebugInfo(*file)) {
+            return std::make_pair(std::move(path), std::move(*file));
+        }
+    }
+    return {};
+}
+
+// contributions of a unit to .dwp sections from its .debug_cu_index row
+std::optional<std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>>> findPackageUnit(const SectionData& index, uint64_t id)
+{
+    Reader reader{index.data, index.size};
+    const auto version = reader.fixed<uint32_t>();
+    const auto columns = reader.fixed<uint32_t>();
+    const auto units = reader.fixed<uint32_t>();
+    const auto slots = reader.fixed<uint32_t>();
+    if (version != 2 || slots == 0 || (slots & (slots - 1)) != 0) {
+        throw std::runtime_error{"Unsupported .debug_cu_index version " + std::to_string(version)};
+    }
+    const auto* signatures = reader.skip(slots * sizeof(uint64_t));
+    const auto* rows = reader.skip(slots * sizeof(uint32_t));
+    const auto* sections = reader.skip(columns * sizeof(uint32_t));
+    const auto* offsets = reader.skip(units * columns * sizeof(uint32_t));
+    const auto* sizes = reader.skip(units * columns * sizeof(uint32_t));
+    const auto read32 = [](const uint8_t* table, size_t i) {
+        uint32_t value;
+        std::memcpy(&value, table + i * sizeof(value), sizeof(value));
+        return value;
+    };
+
+    const auto mask = slots - 1;
+    const auto step = ((id >> 32) & mask) | 1;
+    auto slot = id & mask;
+    for (uint32_t probe = 0; probe < slots; ++probe, slot = (slot + step) & mask) {
+        uint64_t signature;
+        std::memcpy(&signature, signatures + slot * sizeof(signature), sizeof(signature));
+        const auto row = read32(rows, slot);
+        if (row == 0) {
+            return {};
+        }
+        if (signature != id) {
+            continue;
+        }
+        if (row > units) {
+            throw std::runtime_error{"Corrupted .debug_cu_index"};
+        }
+        std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>> contributions;
+        for (uint32_t column = 0; column < columns; ++column) {
+            const auto cell = (row - 1) * columns + column;
+            contributions[read32(sections, column)] = {read32(offsets, cell), read32(sizes, cell)};
+        }
+        return contributions;
+    }
+    return {};
+}
+
+SectionData slice(const SectionData& section, const std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t>>& contributions,
+    uint32_t column)
+{
+    auto it = contributions.find(column);
+    if (it == contributions.end()) {
+        return {section.data, section.size, {}};
+    }
+    const auto [offset, size] = it->second;
+    if (static_cast<uint64_t>(offset) + size > section.size) {
+        throw std::runtime_error{"Unit contribution out of .dwp section"};
+    }
+    return {section.data + offset, size, {}};
+}
+
+} // namespace
+
+SectionData readSection(const elf::elf& file, const std::string& name)
+{
+    SectionData data;
+    const auto* section = &file.get_section(name);
+    // .zdebug sections of old toolchains: "ZLIB", big endian size, zlib stream
+    const bool gnuCompressed = !section->valid() && name.rfind(".debug", 0) == 0;
+    if (gnuCompressed) {
+        section = &file.get_section(".z" + name.substr(1));
+    }
+    if (!section->valid() || section->get_hdr().type == elf::sht::nobits) {
+        return data;
+    }
+
+    const auto* bytes = static_cast<const uint8_t*>(section->data());
+    const auto size = section->size();
+    if (gnuCompressed) {
+        if (size < 12 || std::memcmp(bytes, "ZLIB", 4) != 0) {
+            throw std::runtime_error{"Bad .zdebug header"};
+        }
+        uint64_t inflatedSize = 0;
+        for (int i = 4; i < 12; ++i) {
+            inflatedSize = (inflatedSize << 8) | bytes[i];
+        }
+        data.inflated = inflate(ELFCOMPRESS_ZLIB, bytes + 12, size - 12, inflatedSize);
+    } else if (static_cast<uint64_t>(section->get_hdr().flags) & SHF_COMPRESSED) {
+        Elf64_Chdr header;
+        if (size < sizeof(header)) {
+            throw std::runtime_error{"Truncated compression header"};
+        }
+        std::memcpy(&header, bytes, sizeof(header));
+        data.inflated = inflate(header.ch_type, bytes + sizeof(header), size - sizeof(header), header.ch_size);
+    } else {
+        data.data = bytes;
+        data.size = size;
+        return data;
+    }
+    data.data = data.inflated.data();
+    data.size = data.inflated.size();
+    return data;
+}
+
+DebugInfo::DebugInfo(const std::string& programName, const elf::elf& program, const std::vector<std::string>& directories)
+    : path{programName}
+    , programPath{getRealPath(programName)}
+    , file{program}
+{
+    if (!hasDebugInfo(program)) {
+        auto searched = directories;
+        searched.push_back("/usr/lib/debug");
+        if (auto debugFile = findDebugFile(programPath, program, searched)) {
+            path = std::move(debugFile->first);
+            file = std::move(debugFile->second);
+            std::cerr << "Reading debug info from " << path << std::endl;
+        }
+    }
+
+    bool hasSymtab = false;
+    for (const auto& section : program.sections()) {
+        const auto type = section.get_hdr().type;
+        if (type == elf::sht::symtab || type == elf::sht::dynsym) {
+            hasSymtab |= type == elf::sht::symtab;
+            symbolTables.push_back(section);
+        }
+    }
+    if (!hasSymtab && path != programName) {
+        for (const auto& section : file.sections()) {
+            if (section.get_hdr().type == elf::sht::symtab) {
+                symbolTables.push_back(section);
+            }
+        }
+    }
+
+    loader = std::make_shared<SectionLoader>(file);
+    dwarf = dwarf::dwarf{loader};
+}
+
+dwarf::die DebugInfo::getUnitRoot(const dwarf::compilation_unit& unit)
+{
+    const auto& root = unit.root();
+    if (!root.has(DW_AT_GNU_dwo_name)) {
+        return root;
+    }
+
+    auto it = splitUnits.find(unit.get_section_offset());
+    if (it == splitUnits.end()) {
+        it = splitUnits.emplace(unit.get_section_offset(), loadSplitUnit(root)).first;
+    }
+    if (!it->second || it->second->compilation_units().empty()) {
+        return root;
+    }
+    return it->second->compilation_units().front().root();
+}
+
+std::shared_ptr<const SectionData> DebugInfo::getLocationLists(const dwarf::unit& unit)
+{
+    const auto& units = dwarf.compilation_units();
+    const std::less<const dwarf::unit*> less;
+    if (units.empty() || less(&unit, &units.front()) || less(&units.back(), &unit)) {
+        static const auto none = std::make_shared<const SectionData>();
+        return none;
+    }
+    return getCachedSection(".debug_loc");
+}
+
+std::optional<dwarf::dwarf> DebugInfo::loadSplitUnit(const dwarf::die& skeleton)
+{
+    const auto name = skeleton[DW_AT_GNU_dwo_name].as_string();
+    try {
+        std::shared_ptr<const SectionData> strings;
+        std::optional<elf::elf> object;
+        SectionData info, abbrev, strOffsets;
+        // slices point into package sections, the cache may evict them before transcoding is done
+        std::shared_ptr<const SectionData> packageInfo, packageAbbrev, packageStrOffsets;
+
+        std::vector<std::string> candidates;
+        if (!name.empty() && name[0] == '/') {
+            candidates.push_back(name);
+        } else if (skeleton.has(dwarf::DW_AT::comp_dir)) {
+            candidates.push_back(skeleton[dwarf::DW_AT::comp_dir].as_string() + '/' + name);
+        }
+        candidates.push_back(getDirectory(programPath) + '/' + getFileName(name));
+        candidates.push_back(getDirectory(path) + '/' + getFileName(name));
+        for (const auto& candidate : candidates) {
+            if ((object = openElf(candidate))) {
+                break;
+            }
+        }
+
+        if (object) {
+            info = readSection(*object, ".debug_info.dwo");
+            abbrev = readSection(*object, ".debug_abbrev.dwo");
+            strOffsets = readSection(*object, ".debug_str_offsets.dwo");
+            // split unit loader keeps the mapping alive through the section
+            auto mapped = std::make_shared<std::pair<elf::elf, SectionData>>(*object, readSection(*object, ".debug_str.dwo"));
+            strings = std::shared_ptr<const SectionData>{mapped, &mapped->second};
+        } else {
+            if (!packageOpened) {
+                packageOpened = true;
+                for (const auto& packagePath : {programPath + ".dwp", path + ".dwp"}) {
+                    if ((package = openElf(packagePath))) {
+                        break;
+                    }
+                }
+            }
+            if (!package || !skeleton.has(DW_AT_GNU_dwo_id)) {
+                throw std::runtime_error{"No such file and no .dwp package"};
+            }
+            // units are sliced from package sections, only their strings stay with the unit
+            const auto index = getCachedSection(".debug_cu_index");
+            auto contributions = findPackageUnit(*index, skeleton[DW_AT_GNU_dwo_id].as_uconstant());
+            if (!contributions) {
+                throw std::runtime_error{"Unit isn't in the .dwp package"};
+            }
+            packageInfo = getCachedSection(".debug_info.dwo");
+            packageAbbrev = getCachedSection(".debug_abbrev.dwo");
+            packageStrOffsets = getCachedSection(".debug_str_offsets.dwo");
+            info = slice(*packageInfo, *contributions, DW_SECT_INFO);
+            abbrev = slice(*packageAbbrev, *contributions, DW_SECT_ABBREV);
+            strOffsets = slice(*packageStrOffsets, *contributions, DW_SECT_STR_OFFSETS);
+            strings = getCachedSection(".debug_str.dwo");
+        }
+
+        const auto addr = getCachedSection(".debug_addr");
+        SplitUnitTranscoder transcoder{{
+            info,
+            abbrev,
+            strOffsets,
+            *addr,
+            skeleton.has(DW_AT_GNU_addr_base) ? skeleton[DW_AT_GNU_addr_base].as_sec_offset() : 0,
+            skeleton.has(DW_AT_GNU_ranges_base) ? skeleton[DW_AT_GNU_ranges_base].as_sec_offset() : 0,
+        }};
+        std::vector<uint8_t> transcodedInfo, transcodedAbbrev;
+        transcoder.transcode(transcodedInfo, transcodedAbbrev);
+        return dwarf::dwarf{std::make_shared<SplitUnitLoader>(
+            std::move(transcodedInfo), std::move(transcodedAbbrev), std::move(strings), loader)};
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to load split unit " << name << ": " << e.what() << std::endl;
+        return {};
+    }
+}
+
+std::shared_ptr<const SectionData> DebugInfo::getCachedSection(const std::string& name)
+{
+    // package sections come from the .dwp, everything else from the debug file
+    const bool fromPackage = (name.size() > 4 && name.compare(name.size() - 4, 4, ".dwo") == 0)
+        || name == ".debug_cu_index";
+    const auto key = (fromPackage ? "dwp:" : "") + name;
+    for (auto it = sectionCache.begin(); it != sectionCache.end(); ++it) {
+        if (it->first == key) {
+            sectionCache.splice(sectionCache.end(), sectionCache, it);
+            return it->second;
+        }
+    }
+
+    const auto& source = fromPackage ? *package : file;
+    // a section which wasn't compressed points into the mapping and costs nothing to keep
+    auto section = std::make_shared<std::pair<elf::elf, SectionData>>(source, readSection(source, name));
+    std::shared_ptr<const SectionData> data{section, &section->second};
+    sectionCache.emplace_back(key, data);
+    sectionCacheSize += data->inflated.size();
+    while (sectionCacheSize > SECTION_CACHE_LIMIT && sectionCache.size() > 1) {
+        // users which still hold a section keep it alive
+        sectionCacheSize -= sectionCache.front().second->inflated.size();
+        sectionCache.pop_front();
+    }
+    return data;
+}
+
+} // namespace tinydbg
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "dwarf/dwarf++.hh"
+#include "elf/elf++.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tinydbg {
+
+// bytes of a section, owned only when they had to be decompressed
+struct SectionData {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    std::vector<uint8_t> inflated;
+};
+
+// section like ".debug_info" of file, SHF_COMPRESSED and .zdebug ones are decompressed,
+// empty if there is no such section, throws std::runtime_error if it can't be decompressed
+SectionData readSection(const elf::elf& file, const std::string& name);
+
+// Debug info of a program.
+// It comes from the program itself or from a separate file found by build-id under
+// debug directories or by .gnu_debuglink, compressed sections are decompressed when
+// they're first asked for. Skeleton units of split DWARF are resolved to their .dwo
+// file or the program .dwp once something needs their DIEs.
+class DebugInfo {
+public:
+    DebugInfo() = default;
+    // /usr/lib/debug is searched after directories
+    DebugInfo(const std::string& programName, const elf::elf& program, const std::vector<std::string>& directories);
+
+    const dwarf::dwarf& getDwarf() const { return dwarf; }
+    // the program or the separate debug file
+    const std::string& getPath() const { return path; }
+    // symtab and dynsym of the program, symtab of the debug file if the program is stripped
+    const std::vector<elf::section>& getSymbolTables() const { return symbolTables; }
+    // root DIE with functions of the unit, the split unit for skeletons,
+    // the skeleton itself if its split unit can't be loaded
+    dwarf::die getUnitRoot(const dwarf::compilation_unit& unit);
+    // .debug_loc for units of the debug file, empty for split units
+    std::shared_ptr<const SectionData> getLocationLists(const dwarf::unit& unit);
+
+private:
+    std::optional<dwarf::dwarf> loadSplitUnit(const dwarf::die& skeleton);
+    // decompressed sections tinydbg reads itself are kept in a bounded cache,
+    // the ones given to libelfin stay for the whole session because it keeps pointers to them
+    std::shared_ptr<const SectionData> getCachedSection(const std::string& name);
+
+    std::string path;
+    std::string programPath;
+    elf::elf file;
+    std::shared_ptr<dwarf::loader> loader;
+    dwarf::dwarf dwarf;
+    std::vector<elf::section> symbolTables;
+    // split units by skeleton offset, empty if loading failed
+    std::unordered_map<dwarf::section_offset, std::optional<dwarf::dwarf>> splitUnits;
+    // program .dwp, opened with the first skeleton
+    std::optional<elf::elf> package;
+    bool packageOpened = false;
+    // least recently used first
+    std::list<std::pair<std::string, std::shared_ptr<const SectionData>>> sectionCache;
+    size_t sectionCacheSize = 0;
+};
+
+} // namespace tinydbg
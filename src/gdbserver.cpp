@@ -0,0 +1,864 @@
+#include "gdbserver.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+namespace tinydbg {
+
+namespace {
+
+// packets up to this size are accepted and sent, hex
+constexpr size_t PACKET_SIZE = 0x40000;
+
+constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+std::string toHex(const uint8_t* data, size_t size)
+{
+    std::string hex;
+    hex.reserve(size * 2);
+    for (size_t i = 0; i < size; ++i) {
+        hex.push_back(HEX_DIGITS[data[i] >> 4]);
+        hex.push_back(HEX_DIGITS[data[i] & 0xf]);
+    }
+    return hex;
+}
+
+std::string toHex(uint64_t value)
+{
+    std::stringstream stream;
+    stream << std::hex << value;
+    return stream.str();
+}
+
+std::string toHexByte(uint8_t value)
+{
+    return toHex(&value, 1);
+}
+
+std::vector<uint8_t> fromHex(const std::string& hex)
+{
+    std::vector<uint8_t> data;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        data.push_back(static_cast<uint8_t>(std::stoul(hex.substr(i, 2), nullptr, 16)));
+    }
+    return data;
+}
+
+// text for an attribute value of qXfer documents
+std::string escapeXml(const std::string& text)
+{
+    std::string escaped;
+    for (const auto c : text) {
+        switch (c) {
+        case '&':
+            escaped += "&amp;";
+            break;
+        case '<':
+            escaped += "&lt;";
+            break;
+        case '>':
+            escaped += "&gt;";
+            break;
+        case '"':
+            escaped += "&quot;";
+            break;
+        case '\'':
+            escaped += "&apos;";
+            break;
+        default:
+            escaped.push_back(c);
+        }
+    }
+    return escaped;
+}
+
+// value of a hex digit, -1 if c isn't one
+int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// the SIGCHLD handler writes into it, so a stop wakes poll up like data on the socket does
+int childPipe[2] = {-1, -1};
+
+void onChildChanged(int)
+{
+    const auto savedErrno = errno;
+    const char byte = 0;
+    write(childPipe[1], &byte, 1);
+    errno = savedErrno;
+}
+
+uint8_t checksum(const std::string& data)
+{
+    uint8_t sum = 0;
+    for (const auto c : data) {
+        sum += static_cast<uint8_t>(c);
+    }
+    return sum;
+}
+
+// GDB has its own signal numbers, the first 15 match Linux
+constexpr std::pair<int, int> SIGNALS[] = {
+    {SIGBUS, 10}, {SIGUSR1, 30}, {SIGSYS, 12}, {SIGUSR2, 31}, {SIGCHLD, 20}, {SIGCONT, 19},
+    {SIGSTOP, 17}, {SIGTSTP, 18}, {SIGTTIN, 21}, {SIGTTOU, 22}, {SIGURG, 16}, {SIGXCPU, 24},
+    {SIGXFSZ, 25}, {SIGVTALRM, 26}, {SIGPROF, 27}, {SIGWINCH, 28}, {SIGIO, 23}, {SIGPWR, 32},
+};
+
+int toGdbSignal(int signal)
+{
+    for (const auto& [host, gdb] : SIGNALS) {
+        if (host == signal) {
+            return gdb;
+        }
+    }
+    return signal;
+}
+
+int fromGdbSignal(int signal)
+{
+    for (const auto& [host, gdb] : SIGNALS) {
+        if (gdb == signal) {
+            return host;
+        }
+    }
+    return signal;
+}
+
+// registers in amd64 'g' packet order, x87 and SSE ones are left out
+struct RegisterField {
+    unsigned long long user_regs_struct::*field;
+    size_t size;
+};
+
+const RegisterField REGISTERS[] = {
+    {&user_regs_struct::rax, 8}, {&user_regs_struct::rbx, 8}, {&user_regs_struct::rcx, 8},
+    {&user_regs_struct::rdx, 8}, {&user_regs_struct::rsi, 8}, {&user_regs_struct::rdi, 8},
+    {&user_regs_struct::rbp, 8}, {&user_regs_struct::rsp, 8}, {&user_regs_struct::r8, 8},
+    {&user_regs_struct::r9, 8}, {&user_regs_struct::r10, 8}, {&user_regs_struct::r11, 8},
+    {&user_regs_struct::r12, 8}, {&user_regs_struct::r13, 8}, {&user_regs_struct::r14, 8},
+    {&user_regs_struct::r15, 8}, {&user_regs_struct::rip, 8}, {&user_regs_struct::eflags, 4},
+    {&user_regs_struct::cs, 4}, {&user_regs_struct::ss, 4}, {&user_regs_struct::ds, 4},
+    {&user_regs_struct::es, 4}, {&user_regs_struct::fs, 4}, {&user_regs_struct::gs, 4},
+};
+
+// ADDRESS,LENGTH
+std::pair<uint64_t, size_t> parseRange(const std::string& arguments)
+{
+    const auto comma = arguments.find(',');
+    return {std::stoull(arguments.substr(0, comma), nullptr, 16),
+        std::stoull(arguments.substr(comma + 1), nullptr, 16)};
+}
+
+bool startsWith(const std::string& s, const std::string& prefix)
+{
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+int listenOn(const std::string& address)
+{
+    if (startsWith(address, "unix:")) {
+        sockaddr_un unixAddress{};
+        unixAddress.sun_family = AF_UNIX;
+        const auto path = address.substr(5);
+        if (path.size() >= sizeof(unixAddress.sun_path)) {
+            return -1;
+        }
+        std::strcpy(unixAddress.sun_path, path.c_str());
+        unlink(path.c_str());
+
+        const auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&unixAddress), sizeof(unixAddress)) != 0
+            || listen(fd, 1) != 0) {
+            return -1;
+        }
+        return fd;
+    }
+
+    const auto colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        return -1;
+    }
+    const auto host = address.substr(0, colon);
+    const auto port = address.substr(colon + 1);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        return -1;
+    }
+
+    int fd = -1;
+    for (auto* info = addresses; info != nullptr; info = info->ai_next) {
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        const int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, info->ai_addr, info->ai_addrlen) == 0 && listen(fd, 1) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+} // namespace
+
+GdbServer::GdbServer(Debugger& debugger)
+    : debugger{debugger}
+    , connection{-1}
+    , inputPosition{0}
+    , acknowledge{true}
+    , nonStop{false}
+    , running{false}
+    , stopRequested{false}
+    , finished{false}
+{
+    // forks run on their own, the protocol here knows only one process
+    debugger.setFollowForks(false);
+}
+
+int GdbServer::serve(const std::string& address)
+{
+    const auto listener = listenOn(address);
+    if (listener < 0) {
+        std::cerr << "Failed to listen on " << address << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+    std::cerr << "Listening on " << address << std::endl;
+
+    connection = accept(listener, nullptr, nullptr);
+    close(listener);
+    if (connection < 0) {
+        std::cerr << "Failed to accept connection: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    // replies are single writes, don't hold them back
+    const int noDelay = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    struct sigaction previousAction {};
+    if (pipe2(childPipe, O_NONBLOCK | O_CLOEXEC) == 0) {
+        struct sigaction action {};
+        action.sa_handler = onChildChanged;
+        // no SA_NOCLDSTOP, stops are what it's for
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGCHLD, &action, &previousAction);
+    }
+
+    while (!finished) {
+        const auto packet = receivePacket();
+        if (!packet) {
+            break;
+        }
+        const auto reply = handlePacket(*packet);
+        if (*packet != "\x03" && (!finished || startsWith(*packet, "D"))) {
+            sendPacket(reply);
+        }
+        if (running) {
+            waitForStop();
+        }
+    }
+
+    close(connection);
+    if (debugger.getPid() != 0) {
+        debugger.killProcess();
+    }
+    if (childPipe[0] >= 0) {
+        sigaction(SIGCHLD, &previousAction, nullptr);
+        close(childPipe[0]);
+        close(childPipe[1]);
+        childPipe[0] = childPipe[1] = -1;
+    }
+    return 0;
+}
+
+bool GdbServer::receive()
+{
+    // drop consumed data before it piles up
+    if (inputPosition > PACKET_SIZE) {
+        input.erase(0, inputPosition);
+        inputPosition = 0;
+    }
+
+    char buffer[0x10000];
+    const auto received = read(connection, buffer, sizeof(buffer));
+    if (received <= 0) {
+        return false;
+    }
+    input.append(buffer, received);
+    return true;
+}
+
+std::optional<std::string> GdbServer::takePacket()
+{
+    while (inputPosition < input.size()) {
+        const auto c = input[inputPosition];
+        if (c == '\x03') {
+            ++inputPosition;
+            return std::string{"\x03"};
+        }
+        if (c != '$') {
+            // acks and garbage between packets
+            ++inputPosition;
+            continue;
+        }
+
+        const auto end = input.find('#', inputPosition);
+        if (end == std::string::npos || end + 2 >= input.size()) {
+            return {};
+        }
+        const auto raw = input.substr(inputPosition + 1, end - inputPosition - 1);
+        const auto high = hexDigit(input[end + 1]);
+        const auto low = hexDigit(input[end + 2]);
+        inputPosition = end + 3;
+
+        if ((high < 0 || low < 0 || checksum(raw) != (high << 4 | low)) && acknowledge) {
+            write(connection, "-", 1);
+            continue;
+        }
+        if (acknowledge) {
+            write(connection, "+", 1);
+        }
+
+        // binary data escapes $, #, } and * as } followed by byte ^ 0x20
+        std::string packet;
+        packet.reserve(raw.size());
+        for (size_t i = 0; i < raw.size(); ++i) {
+            if (raw[i] == '}' && i + 1 < raw.size()) {
+                packet.push_back(static_cast<char>(raw[++i] ^ 0x20));
+            } else {
+                packet.push_back(raw[i]);
+            }
+        }
+        return packet;
+    }
+    return {};
+}
+
+std::optional<std::string> GdbServer::receivePacket()
+{
+    while (true) {
+        auto packet = takePacket();
+        if (packet) {
+            return packet;
+        }
+        if (!receive()) {
+            return {};
+        }
+    }
+}
+
+void GdbServer::sendPacket(const std::string& payload)
+{
+    send('$', payload);
+}
+
+void GdbServer::sendNotification(const std::string& payload)
+{
+    send('%', payload);
+}
+
+void GdbServer::send(char start, const std::string& payload)
+{
+    std::string packet;
+    packet.reserve(payload.size() + 4);
+    packet.push_back(start);
+    for (const auto c : payload) {
+        if (c == '$' || c == '#' || c == '}' || c == '*') {
+            packet.push_back('}');
+            packet.push_back(static_cast<char>(c ^ 0x20));
+        } else {
+            packet.push_back(c);
+        }
+    }
+    const auto sum = checksum(packet.substr(1));
+    packet.push_back('#');
+    packet += toHexByte(sum);
+
+    // acks aren't waited for, the transport is reliable
+    size_t written = 0;
+    while (written < packet.size()) {
+        const auto result = write(connection, packet.data() + written, packet.size() - written);
+        if (result <= 0) {
+            return;
+        }
+        written += result;
+    }
+}
+
+std::string GdbServer::handlePacket(const std::string& packet)
+{
+    if (packet.empty()) {
+        return {};
+    }
+
+    if (running) {
+        // registers and breakpoints need a stopped inferior, memory doesn't
+        const auto allowed = packet == "?" || packet == "vStopped" || packet == "\x03"
+            || startsWith(packet, "vCont;t") || startsWith(packet, "m") || startsWith(packet, "x")
+            || startsWith(packet, "q");
+        if (!allowed) {
+            return "E01";
+        }
+    }
+    if (debugger.getPid() == 0 && packet != "?" && !startsWith(packet, "q") && packet != "k") {
+        return "E01";
+    }
+
+    try {
+        switch (packet[0]) {
+        case '\x03':
+            interrupt(SIGINT);
+            return {};
+        case '?':
+            return running ? "OK" : getStopReply();
+        case 'g':
+            return readRegisters();
+        case 'G':
+            return writeRegisters(packet.substr(1));
+        case 'p':
+            return readRegister(std::stoul(packet.substr(1), nullptr, 16));
+        case 'P': {
+            const auto equals = packet.find('=');
+            return writeRegister(std::stoul(packet.substr(1, equals - 1), nullptr, 16), packet.substr(equals + 1));
+        }
+        case 'm':
+            return readMemory(packet.substr(1), /*binary*/ false);
+        case 'x':
+            return readMemory(packet.substr(1), /*binary*/ true);
+        case 'M':
+            return writeMemory(packet.substr(1), /*binary*/ false);
+        case 'X':
+            return writeMemory(packet.substr(1), /*binary*/ true);
+        case 'c':
+        case 's':
+            if (packet.size() > 1) {
+                debugger.setPC(std::stoull(packet.substr(1), nullptr, 16));
+            }
+            return resume(packet[0] == 's', 0);
+        case 'C':
+        case 'S':
+            return resume(packet[0] == 'S', fromGdbSignal(std::stoi(packet.substr(1, 2), nullptr, 16)));
+        case 'Z':
+        case 'z': {
+            // only software breakpoints, Z0,ADDRESS,KIND
+            if (packet.size() < 2 || packet[1] != '0') {
+                return {};
+            }
+            const auto address = parseRange(packet.substr(3)).first;
+            if (packet[0] == 'Z') {
+                debugger.setBreakpoint(address);
+            } else {
+                debugger.removeBreakpoint(address);
+            }
+            return "OK";
+        }
+        case 'H':
+            return "OK";
+        case 'T':
+            return std::stoul(packet.substr(1), nullptr, 16) == static_cast<unsigned long>(debugger.getPid()) ? "OK" : "E01";
+        case 'k':
+            debugger.killProcess();
+            finished = true;
+            return {};
+        case 'D':
+            debugger.detach();
+            finished = true;
+            return "OK";
+        case 'q':
+        case 'Q':
+            return handleQuery(packet);
+        case 'v':
+            if (packet == "vStopped") {
+                // the only thread is reported right away
+                return "OK";
+            }
+            if (packet == "vCont?") {
+                return "vCont;c;C;s;S;t";
+            }
+            if (startsWith(packet, "vCont;")) {
+                return handleVCont(packet);
+            }
+            return {};
+        default:
+            return {};
+        }
+    } catch (const std::exception&) {
+        return "E01";
+    }
+}
+
+std::string GdbServer::handleQuery(const std::string& packet)
+{
+    if (startsWith(packet, "qSupported")) {
+        return "PacketSize=" + toHex(PACKET_SIZE)
+            + ";QStartNoAckMode+;QNonStop+;qXfer:libraries:read+;qXfer:threads:read+;vContSupported+;swbreak+";
+    }
+    if (packet == "QStartNoAckMode") {
+        // this reply is still acknowledged by the client
+        sendPacket("OK");
+        acknowledge = false;
+        return {};
+    }
+    if (startsWith(packet, "QNonStop:")) {
+        nonStop = packet.back() == '1';
+        return "OK";
+    }
+    if (packet == "qAttached") {
+        // we started the process, so it's killed on quit
+        return "0";
+    }
+    if (packet == "qC") {
+        return "QC" + toHex(debugger.getPid());
+    }
+    if (packet == "qfThreadInfo") {
+        return "m" + toHex(debugger.getPid());
+    }
+    if (packet == "qsThreadInfo") {
+        return "l";
+    }
+    if (packet == "qOffsets") {
+        const auto bias = toHex(debugger.getLoadBias());
+        return "Text=" + bias + ";Data=" + bias + ";Bss=" + bias;
+    }
+    if (startsWith(packet, "qSymbol")) {
+        return "OK";
+    }
+    if (startsWith(packet, "qXfer:")) {
+        // qXfer:OBJECT:read:ANNEX:OFFSET,LENGTH
+        std::vector<std::string> parts;
+        std::stringstream stream{packet};
+        std::string part;
+        while (std::getline(stream, part, ':')) {
+            parts.push_back(part);
+        }
+        if (parts.size() < 5 || parts[2] != "read") {
+            return {};
+        }
+        const auto [offset, length] = parseRange(parts[4]);
+        return transfer(parts[1], parts[3], offset, length);
+    }
+    return {};
+}
+
+std::string GdbServer::handleVCont(const std::string& packet)
+{
+    // vCont;ACTION[:THREAD];... the first action for our thread wins
+    std::stringstream stream{packet.substr(6)};
+    std::string action;
+    while (std::getline(stream, action, ';')) {
+        const auto colon = action.find(':');
+        if (colon != std::string::npos) {
+            const auto thread = action.substr(colon + 1);
+            if (thread != "-1" && std::stoul(thread, nullptr, 16) != static_cast<unsigned long>(debugger.getPid())) {
+                continue;
+            }
+            action = action.substr(0, colon);
+        }
+
+        switch (action[0]) {
+        case 'c':
+            return resume(false, 0);
+        case 's':
+            return resume(true, 0);
+        case 'C':
+            return resume(false, fromGdbSignal(std::stoi(action.substr(1), nullptr, 16)));
+        case 'S':
+            return resume(true, fromGdbSignal(std::stoi(action.substr(1), nullptr, 16)));
+        case 't':
+            if (running) {
+                interrupt(SIGSTOP);
+            }
+            return "OK";
+        default:
+            return "E01";
+        }
+    }
+    return "OK";
+}
+
+std::string GdbServer::readRegisters()
+{
+    const auto& regs = debugger.getRegisters();
+    std::string hex;
+    for (const auto& reg : REGISTERS) {
+        const uint64_t value = regs.*reg.field;
+        hex += toHex(reinterpret_cast<const uint8_t*>(&value), reg.size);
+    }
+    return hex;
+}
+
+std::string GdbServer::writeRegisters(const std::string& hex)
+{
+    auto regs = debugger.getRegisters();
+    const auto data = fromHex(hex);
+    size_t offset = 0;
+    for (const auto& reg : REGISTERS) {
+        if (offset + reg.size > data.size()) {
+            break;
+        }
+        uint64_t value = 0;
+        std::memcpy(&value, data.data() + offset, reg.size);
+        regs.*reg.field = value;
+        offset += reg.size;
+    }
+    debugger.setRegisters(regs);
+    return "OK";
+}
+
+std::string GdbServer::readRegister(size_t number)
+{
+    if (number >= std::size(REGISTERS)) {
+        // not in our register set, client falls back to the g packet
+        return {};
+    }
+    const uint64_t value = debugger.getRegisters().*REGISTERS[number].field;
+    return toHex(reinterpret_cast<const uint8_t*>(&value), REGISTERS[number].size);
+}
+
+std::string GdbServer::writeRegister(size_t number, const std::string& hex)
+{
+    if (number >= std::size(REGISTERS)) {
+        return "E01";
+    }
+    auto regs = debugger.getRegisters();
+    const auto data = fromHex(hex);
+    uint64_t value = 0;
+    std::memcpy(&value, data.data(), std::min(data.size(), REGISTERS[number].size));
+    regs.*REGISTERS[number].field = value;
+    debugger.setRegisters(regs);
+    return "OK";
+}
+
+std::string GdbServer::readMemory(const std::string& arguments, bool binary)
+{
+    const auto [address, requested] = parseRange(arguments);
+    // hex doubles the size, escapes may do the same for binary
+    const auto length = std::min(requested, PACKET_SIZE / 2 - 16);
+
+    std::vector<uint8_t> data(length);
+    if (length > 0 && !debugger.readMemory(address, data.data(), length)) {
+        // return what's readable before the fault
+        size_t readable = 0;
+        while (readable < length && debugger.readMemory(address + readable, data.data() + readable, 1)) {
+            ++readable;
+        }
+        if (readable == 0) {
+            return "E01";
+        }
+        data.resize(readable);
+    }
+    debugger.hideBreakpoints(address, data.data(), data.size());
+
+    if (binary) {
+        return "b" + std::string{data.cbegin(), data.cend()};
+    }
+    return toHex(data.data(), data.size());
+}
+
+std::string GdbServer::writeMemory(const std::string& arguments, bool binary)
+{
+    const auto colon = arguments.find(':');
+    const auto [address, length] = parseRange(arguments.substr(0, colon));
+    if (length == 0) {
+        return "OK";
+    }
+
+    std::vector<uint8_t> data;
+    if (binary) {
+        data.assign(arguments.cbegin() + colon + 1, arguments.cend());
+    } else {
+        data = fromHex(arguments.substr(colon + 1));
+    }
+    if (data.size() < length) {
+        return "E01";
+    }
+    return debugger.writeMemory(address, data.data(), length) ? "OK" : "E01";
+}
+
+std::string GdbServer::transfer(const std::string& object, const std::string& annex, size_t offset, size_t length)
+{
+    if (!annex.empty()) {
+        return "E00";
+    }
+
+    std::string document;
+    if (object == "libraries") {
+        document = getLibraries();
+    } else if (object == "threads") {
+        document = getThreads();
+    } else {
+        return {};
+    }
+
+    if (offset >= document.size()) {
+        return "l";
+    }
+    const auto chunk = document.substr(offset, std::min(length, PACKET_SIZE / 2));
+    return (offset + chunk.size() < document.size() ? "m" : "l") + chunk;
+}
+
+std::string GdbServer::getLibraries() const
+{
+    // shared objects with the lowest address each of them is mapped at,
+    // the main program is known to the client already, files mapped as data
+    // (locale archive, the agent ring) have no executable mapping
+    std::vector<std::pair<std::string, uint64_t>> libraries;
+    std::vector<std::string> executable;
+    const auto regions = debugger.getMemoryRegions();
+    const auto program = regions.empty() ? std::string{} : regions.front().path;
+    for (const auto& region : regions) {
+        if (region.inode == 0 || region.path.empty() || region.path == program) {
+            continue;
+        }
+        if (region.perms.size() > 2 && region.perms[2] == 'x') {
+            executable.push_back(region.path);
+        }
+        const auto it = std::find_if(libraries.begin(), libraries.end(),
+            [&region](const auto& library) { return library.first == region.path; });
+        if (it == libraries.end()) {
+            libraries.push_back({region.path, region.start});
+        }
+    }
+
+    std::string document = "<library-list>";
+    for (const auto& [path, address] : libraries) {
+        if (std::find(executable.cbegin(), executable.cend(), path) == executable.cend()) {
+            continue;
+        }
+        document += "<library name=\"" + escapeXml(path) + "\"><segment address=\"0x" + toHex(address) + "\"/></library>";
+    }
+    return document + "</library-list>";
+}
+
+std::string GdbServer::getThreads() const
+{
+    // other threads of the process aren't traced
+    return "<threads><thread id=\"" + toHex(debugger.getPid()) + "\"/></threads>";
+}
+
+std::string GdbServer::resume(bool step, int signal)
+{
+    stopRequested = false;
+    if (step) {
+        debugger.singleStepInstructionWithBpCheck();
+        if (nonStop) {
+            sendNotification("Stop:" + getStopReply());
+            return "OK";
+        }
+        return getStopReply();
+    }
+
+    debugger.resume(signal);
+    running = true;
+    if (nonStop) {
+        return "OK";
+    }
+    waitForStop();
+    return getStopReply();
+}
+
+void GdbServer::waitForStop()
+{
+    while (running) {
+        if (debugger.waitForSignal(WNOHANG)) {
+            if (debugger.getPid() != 0 && debugger.isResumeNeeded()) {
+                debugger.resume();
+                continue;
+            }
+            running = false;
+            break;
+        }
+
+        // sleep until the client sends something or SIGCHLD tells the inferior changed state,
+        // without the pipe poll wakes up often enough to notice the stop
+        pollfd fds[] = {{connection, POLLIN, 0}, {childPipe[0], POLLIN, 0}};
+        if (poll(fds, 2, childPipe[0] < 0 ? 10 : -1) <= 0) {
+            continue;
+        }
+        if (fds[1].revents != 0) {
+            char buffer[64];
+            while (read(childPipe[0], buffer, sizeof(buffer)) > 0) {
+            }
+        }
+        if (fds[0].revents != 0) {
+            if (!receive()) {
+                interrupt(SIGKILL);
+                finished = true;
+            }
+            while (auto packet = takePacket()) {
+                // interrupt has no reply, the stop is reported instead
+                if (*packet == "\x03") {
+                    interrupt(SIGINT);
+                } else if (nonStop) {
+                    sendPacket(handlePacket(*packet));
+                }
+            }
+        }
+    }
+
+    if (nonStop && !finished) {
+        sendNotification("Stop:" + getStopReply());
+    }
+}
+
+void GdbServer::interrupt(int signal)
+{
+    if (running && debugger.getPid() != 0) {
+        stopRequested = signal == SIGSTOP;
+        kill(debugger.getPid(), signal);
+    }
+}
+
+std::string GdbServer::getStopReply() const
+{
+    const auto& stop = debugger.getLastStop();
+    if (debugger.getPid() == 0) {
+        switch (stop.kind) {
+        case Debugger::StopReason::Kind::Exited:
+            return "W" + toHexByte(static_cast<uint8_t>(stop.value));
+        case Debugger::StopReason::Kind::Terminated:
+            return "X" + toHexByte(static_cast<uint8_t>(toGdbSignal(stop.value)));
+        case Debugger::StopReason::Kind::Signal:
+            return "W00";
+        }
+    }
+
+    const auto signal = stopRequested && stop.value == SIGSTOP ? 0 : toGdbSignal(stop.value);
+    return "T" + toHexByte(static_cast<uint8_t>(signal)) + "thread:" + toHex(debugger.getPid()) + ";"
+        + (stop.breakpoint ? "swbreak:;" : "");
+}
+
+} // namespace tinydbg
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "debugger.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace tinydbg {
+
+// GDB remote serial protocol on top of Debugger.
+// Memory and registers go through the same cached layers as local commands,
+// binary x/X packets and a large packet size keep transfers in few round trips.
+// Only the traced thread is reported, non-stop mode sends its stops as notifications.
+class GdbServer {
+public:
+    explicit GdbServer(Debugger& debugger);
+
+    // listen on unix:/path or host:port, serve one client until it disconnects or kills the program
+    int serve(const std::string& address);
+
+private:
+    // read whatever the client sent, returns false if connection is closed
+    bool receive();
+    // next complete packet from received data, interrupt 0x03 is returned as "\x03"
+    std::optional<std::string> takePacket();
+    // blocks until a packet arrives, empty if connection is closed
+    std::optional<std::string> receivePacket();
+    void sendPacket(const std::string& payload);
+    void sendNotification(const std::string& payload);
+    void send(char start, const std::string& payload);
+
+    // reply to send, empty string is "not supported"
+    std::string handlePacket(const std::string& packet);
+    std::string handleQuery(const std::string& packet);
+    std::string handleVCont(const std::string& packet);
+    std::string readRegisters();
+    std::string writeRegisters(const std::string& hex);
+    std::string readRegister(size_t number);
+    std::string writeRegister(size_t number, const std::string& hex);
+    std::string readMemory(const std::string& arguments, bool binary);
+    std::string writeMemory(const std::string& arguments, bool binary);
+    std::string transfer(const std::string& object, const std::string& annex, size_t offset, size_t length);
+    std::string getLibraries() const;
+    std::string getThreads() const;
+
+    // step or continue, in all-stop mode waits for the stop and returns its reply
+    std::string resume(bool step, int signal);
+    // waits for a stop which has to be reported, handles packets and interrupts meanwhile
+    void waitForStop();
+    void interrupt(int signal);
+    std::string getStopReply() const;
+
+    Debugger& debugger;
+    int connection;
+    std::string input;
+    size_t inputPosition;
+    bool acknowledge;
+    bool nonStop;
+    bool running;
+    // stop was requested with vCont;t, it's reported with signal 0
+    bool stopRequested;
+    bool finished;
+};
+
+} // namespace tinydbg
@@ -0,0 +1,130 @@
+#include "inject.h"
+
+#include "registers.h"
+#include "stats.h"
+
+#include <sched.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include <cerrno>
+#include <csignal>
+
+namespace tinydbg {
+
+namespace {
+
+// "syscall" instruction bytes 0f 05 in little endian
+constexpr uint64_t SYSCALL_INSTRUCTION = 0x050f;
+
+bool waitForStop(pid_t pid, int& status)
+{
+    return stats::waitpid(pid, &status, __WALL) == pid && WIFSTOPPED(status);
+}
+
+bool isForkEvent(int status)
+{
+    return (status >> 8) == (SIGTRAP | (PTRACE_EVENT_FORK << 8));
+}
+
+// kernel's internal errors of an interrupted syscall which is restarted on resume
+constexpr int64_t ERESTARTSYS = 512;
+constexpr int64_t ERESTARTNOINTR = 513;
+constexpr int64_t ERESTARTNOHAND = 514;
+constexpr int64_t ERESTART_RESTARTBLOCK = 516;
+
+// registers which resume the process the way the kernel would have: a syscall which
+// was about to run (seccomp stop) or was interrupted is issued again, the injected
+// syscall took its place in the kernel
+user_regs_struct getResumeRegisters(const user_regs_struct& regs)
+{
+    const auto result = static_cast<int64_t>(regs.rax);
+    if (static_cast<int64_t>(regs.orig_rax) < 0
+        || (result != -ENOSYS && result != -ERESTARTSYS && result != -ERESTARTNOINTR
+            && result != -ERESTARTNOHAND && result != -ERESTART_RESTARTBLOCK)) {
+        return regs;
+    }
+
+    auto resume = regs;
+    resume.rip -= 2;
+    resume.rax = result == -ERESTART_RESTARTBLOCK ? SYS_restart_syscall : regs.orig_rax;
+    resume.orig_rax = -1;
+    return resume;
+}
+
+} // namespace
+
+std::optional<pid_t> injectFork(pid_t pid, long options)
+{
+    const auto savedRegs = getRegisters(pid);
+    const auto pc = savedRegs.rip;
+
+    errno = 0;
+    const uint64_t savedWord = stats::ptrace(PTRACE_PEEKTEXT, pid, pc, nullptr);
+    if (errno != 0) {
+        return {};
+    }
+
+    // forked process gets attached automatically and starts stopped
+    if (stats::ptrace(PTRACE_SETOPTIONS, pid, nullptr, options | PTRACE_O_TRACEFORK) < 0) {
+        return {};
+    }
+
+    // fork is a child of the inferior's parent, usually the debugger, so it's reaped by
+    // whoever kills it, even when the inferior is a stopped checkpoint which never waits
+    auto regs = savedRegs;
+    regs.rax = SYS_clone;
+    regs.rdi = CLONE_PARENT | SIGCHLD;
+    regs.rsi = 0;
+    regs.rdx = 0;
+    regs.r10 = 0;
+    regs.r8 = 0;
+    // no pending or interrupted syscall, it would run instead of ours or be restarted over it
+    regs.orig_rax = -1;
+    setRegisters(pid, regs);
+    stats::ptrace(PTRACE_POKETEXT, pid, pc, (savedWord & ~0xFFFFull) | SYSCALL_INSTRUCTION);
+
+    std::optional<pid_t> child;
+    int status;
+    // first stop is the fork event, second one is the trap after the syscall returns,
+    // at a syscall stop the skipped syscall reports a trap before ours is reached
+    for (int step = 0; step < 2 && !child; ++step) {
+        stats::ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
+        if (!waitForStop(pid, status)) {
+            break;
+        }
+        if (isForkEvent(status)) {
+            unsigned long childPid;
+            stats::ptrace(PTRACE_GETEVENTMSG, pid, nullptr, &childPid);
+            child = static_cast<pid_t>(childPid);
+
+            stats::ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
+            waitForStop(pid, status);
+        } else if (getRegisters(pid).rip != pc) {
+            break;
+        }
+    }
+
+    const auto resumeRegs = getResumeRegisters(savedRegs);
+    stats::ptrace(PTRACE_POKETEXT, pid, pc, savedWord);
+    setRegisters(pid, resumeRegs);
+    stats::ptrace(PTRACE_SETOPTIONS, pid, nullptr, options);
+
+    if (!child) {
+        return {};
+    }
+
+    // child is a copy made while syscall instruction was in place, undo it there too
+    if (!waitForStop(*child, status)) {
+        return {};
+    }
+    stats::ptrace(PTRACE_POKETEXT, *child, pc, savedWord);
+    setRegisters(*child, resumeRegs);
+    // don't leave suspended forks behind when debugger exits
+    stats::ptrace(PTRACE_SETOPTIONS, *child, nullptr, options | PTRACE_O_EXITKILL);
+
+    return child;
+}
+
+} // namespace tinydbg
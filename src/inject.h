@@ -0,0 +1,21 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <optional>
+
+namespace tinydbg {
+
+// Executes fork() inside of the stopped inferior by temporarily placing a
+// syscall instruction at its pc. Inferior state is restored afterwards.
+// Forked process is attached and left stopped with the same registers and
+// memory as the inferior had before the call. It's a child of the inferior's
+// parent (CLONE_PARENT), so the debugger reaps forks of processes it launched.
+// A syscall the inferior was stopped in (seccomp stop or interrupted one)
+// is issued again by both processes when they resume.
+// options are ptrace options of the inferior, they are restored afterwards
+// and set for the forked process as well.
+// Returns pid of the forked process.
+std::optional<pid_t> injectFork(pid_t pid, long options);
+
+} // namespace tinydbg
@@ -0,0 +1,392 @@
+#include "interpreter.h"
+
+#include <unistd.h>
+
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace tinydbg {
+
+namespace {
+
+// replies of pipelined requests are collected up to this size before being written
+constexpr size_t FLUSH_SIZE = 1 << 16;
+
+// cursor over a request line, only what requests need is decoded
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text)
+        : text{text}
+        , position{0}
+    {
+    }
+
+    char peek()
+    {
+        while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position]))) {
+            ++position;
+        }
+        if (position == text.size()) {
+            throw std::runtime_error{"unexpected end of request"};
+        }
+        return text[position];
+    }
+
+    void expect(char c)
+    {
+        if (peek() != c) {
+            throw std::runtime_error{std::string{"expected '"} + c + "' at " + std::to_string(position)};
+        }
+        ++position;
+    }
+
+    bool consume(char c)
+    {
+        if (peek() != c) {
+            return false;
+        }
+        ++position;
+        return true;
+    }
+
+    std::string parseString()
+    {
+        expect('"');
+        std::string s;
+        while (position < text.size() && text[position] != '"') {
+            const auto c = text[position++];
+            if (c != '\\') {
+                s.push_back(c);
+                continue;
+            }
+            if (position == text.size()) {
+                break;
+            }
+            switch (text[position++]) {
+            case 'b': s.push_back('\b'); break;
+            case 'f': s.push_back('\f'); break;
+            case 'n': s.push_back('\n'); break;
+            case 'r': s.push_back('\r'); break;
+            case 't': s.push_back('\t'); break;
+            case 'u': {
+                // basic multilingual plane only, encoded as UTF-8
+                const auto code = std::stoul(text.substr(position, 4), nullptr, 16);
+                position += 4;
+                if (code < 0x80) {
+                    s.push_back(static_cast<char>(code));
+                } else if (code < 0x800) {
+                    s.push_back(static_cast<char>(0xc0 | (code >> 6)));
+                    s.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+                } else {
+                    s.push_back(static_cast<char>(0xe0 | (code >> 12)));
+                    s.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+                    s.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+                }
+                break;
+            }
+            default:
+                s.push_back(text[position - 1]);
+                break;
+            }
+        }
+        expect('"');
+        return s;
+    }
+
+    // any value as it's written
+    std::string parseRaw()
+    {
+        const auto c = peek();
+        const auto start = position;
+        if (c == '"') {
+            parseString();
+        } else if (c == '{' || c == '[') {
+            size_t depth = 0;
+            do {
+                if (text[position] == '"') {
+                    parseString();
+                    continue;
+                }
+                if (text[position] == '{' || text[position] == '[') {
+                    ++depth;
+                } else if (text[position] == '}' || text[position] == ']') {
+                    --depth;
+                }
+                ++position;
+            } while (depth > 0 && position < text.size());
+        } else {
+            while (position < text.size() && std::strchr(",}] \t\r\n", text[position]) == nullptr) {
+                ++position;
+            }
+        }
+        return text.substr(start, position - start);
+    }
+
+private:
+    const std::string& text;
+    size_t position;
+};
+
+// std::cerr and std::cout of command handlers are collected instead of printed
+class OutputCapture {
+public:
+    explicit OutputCapture(std::ostream& target)
+        : cerr{std::cerr.rdbuf(target.rdbuf())}
+        , cout{std::cout.rdbuf(target.rdbuf())}
+    {
+    }
+
+    ~OutputCapture()
+    {
+        std::cerr.rdbuf(cerr);
+        std::cout.rdbuf(cout);
+    }
+
+private:
+    std::streambuf* cerr;
+    std::streambuf* cout;
+};
+
+} // namespace
+
+JsonInterpreter::JsonInterpreter(Debugger& debugger, int input, int output)
+    : debugger{debugger}
+    , input{input}
+    , writer{output}
+{
+}
+
+int JsonInterpreter::run()
+{
+    std::ostringstream output;
+    {
+        const OutputCapture capture{output};
+        debugger.initialize();
+    }
+    writer.beginObject().key("event").value("ready").key("pid").value(debugger.getPid());
+    if (!output.str().empty()) {
+        writer.key("output").value(output.str());
+    }
+    writer.endObject().endLine();
+
+    std::string received;
+    char chunk[1 << 16];
+    while (true) {
+        // everything received is answered before the next read,
+        // so pipelined requests share writes
+        size_t start = 0;
+        size_t end;
+        while ((end = received.find('\n', start)) != std::string::npos) {
+            handleRequest(received.substr(start, end - start));
+            start = end + 1;
+            if (writer.pending() > FLUSH_SIZE) {
+                writer.flush();
+            }
+        }
+        received.erase(0, start);
+        writer.flush();
+
+        const auto size = read(input, chunk, sizeof(chunk));
+        if (size <= 0) {
+            break;
+        }
+        received.append(chunk, size);
+    }
+
+    handleRequest(received);
+    writer.flush();
+    return 0;
+}
+
+JsonInterpreter::Request JsonInterpreter::parseRequest(const std::string& line)
+{
+    Request request{"null", {}, {}};
+    JsonParser parser{line};
+    parser.expect('{');
+    if (parser.consume('}')) {
+        return request;
+    }
+    do {
+        const auto key = parser.parseString();
+        parser.expect(':');
+        if (key == "id") {
+            request.id = parser.parseRaw();
+        } else if (key == "command") {
+            request.command = parser.parseString();
+        } else if (key == "args") {
+            parser.expect('[');
+            if (!parser.consume(']')) {
+                do {
+                    // numbers are passed the way they're written
+                    request.args.push_back(parser.peek() == '"' ? parser.parseString() : parser.parseRaw());
+                } while (parser.consume(','));
+                parser.expect(']');
+            }
+        } else {
+            parser.parseRaw();
+        }
+    } while (parser.consume(','));
+    parser.expect('}');
+    return request;
+}
+
+void JsonInterpreter::handleRequest(const std::string& line)
+{
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+        return;
+    }
+
+    Request request;
+    try {
+        request = parseRequest(line);
+    } catch (const std::exception& e) {
+        writer.beginObject().key("id").raw("null").key("result").value("error")
+            .key("message").value(std::string{"malformed request: "} + e.what()).endObject().endLine();
+        return;
+    }
+    execute(request);
+}
+
+void JsonInterpreter::execute(const Request& request)
+{
+    auto line = request.command;
+    for (const auto& arg : request.args) {
+        line += ' ' + arg;
+    }
+    std::istringstream words{line};
+    std::string word;
+    std::string subcommand;
+    words >> word >> subcommand;
+    const auto command = Debugger::resolveCommand(word);
+
+    // these reply with data instead of text
+    const auto structured = command == "backtrace" || command == "variables"
+        || (command == "register" && subcommand.size() > 0 && std::string{"dump"}.rfind(subcommand, 0) == 0);
+
+    const auto stops = debugger.getStopCount();
+    std::ostringstream output;
+    std::string error;
+    std::vector<Debugger::Frame> frames;
+    std::vector<Debugger::Variable> variables;
+    {
+        const OutputCapture capture{output};
+        try {
+            if (!structured) {
+                debugger.executeCommand(line);
+            } else if (!debugger.canInspect()) {
+                error = "The program is not being run";
+            } else if (command == "backtrace") {
+                frames = debugger.getBacktrace();
+            } else if (command == "variables") {
+                variables = debugger.getVariables();
+            }
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+    }
+
+    if (debugger.getStopCount() != stops) {
+        writeStop(request.id);
+    }
+
+    writer.beginObject().key("id").raw(request.id);
+    if (!error.empty()) {
+        writer.key("result").value("error").key("message").value(error);
+    } else {
+        writer.key("result").value("done");
+        if (command == "backtrace") {
+            writeBacktrace(frames);
+        } else if (command == "variables") {
+            writeVariables(variables);
+        } else if (structured) {
+            writeRegisters();
+        }
+    }
+    if (!output.str().empty()) {
+        writer.key("output").value(output.str());
+    }
+    writer.endObject().endLine();
+}
+
+void JsonInterpreter::writeStop(const std::string& id)
+{
+    const auto& stop = debugger.getLastStop();
+    writer.beginObject().key("id").raw(id);
+    switch (stop.kind) {
+    case Debugger::StopReason::Kind::Exited:
+        writer.key("event").value("exited").key("code").value(stop.value);
+        break;
+    case Debugger::StopReason::Kind::Terminated:
+        writer.key("event").value("terminated").key("signal").value(stop.value)
+            .key("description").value(strsignal(stop.value));
+        break;
+    case Debugger::StopReason::Kind::Signal: {
+        writer.key("event").value("stopped").key("reason").value(stop.breakpoint ? "breakpoint" : "signal")
+            .key("signal").value(stop.value).key("description").value(strsignal(stop.value));
+        if (debugger.getPid() == 0) {
+            break;
+        }
+        const auto pc = debugger.getPC();
+        writer.key("pc").hex(pc);
+        // stops outside of the program have no debug info
+        try {
+            const auto function = dwarf::at_name(debugger.getFunction(pc));
+            const auto line = debugger.getLineEntry(pc);
+            writer.key("function").value(function)
+                .key("file").value(line->file->path).key("line").value(static_cast<int64_t>(line->line));
+        } catch (const std::out_of_range&) {
+        }
+        break;
+    }
+    }
+    writer.endObject().endLine();
+}
+
+void JsonInterpreter::writeBacktrace(const std::vector<Debugger::Frame>& frames)
+{
+    writer.key("frames").beginArray();
+    for (const auto& frame : frames) {
+        writer.beginObject().key("pc").hex(frame.pc).key("address").hex(frame.address)
+            .key("function").value(frame.function).endObject();
+    }
+    writer.endArray();
+}
+
+void JsonInterpreter::writeRegisters()
+{
+    const auto& regs = debugger.getRegisters();
+    writer.key("registers").beginObject();
+    for (const auto& descriptor : REGISTOR_DESCRIPTORS) {
+        writer.key(descriptor.name).hex(getRegisterValue(regs, descriptor.reg));
+    }
+    writer.endObject();
+}
+
+void JsonInterpreter::writeVariables(const std::vector<Debugger::Variable>& variables)
+{
+    writer.key("variables").beginArray();
+    for (const auto& [name, location, value] : variables) {
+        writer.beginObject().key("name").value(name);
+        switch (location.type) {
+        case Location::Type::Address:
+            writer.key("address").hex(location.value).key("value").hex(value);
+            break;
+        case Location::Type::Register:
+            writer.key("register").value(static_cast<int64_t>(location.value)).key("value").hex(value);
+            break;
+        case Location::Type::Value:
+            writer.key("value").hex(value);
+            break;
+        case Location::Type::Unavailable:
+            writer.key("optimizedOut").raw("true");
+            break;
+        }
+        writer.endObject();
+    }
+    writer.endArray();
+}
+
+} // namespace tinydbg
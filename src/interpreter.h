@@ -0,0 +1,44 @@
+#pragma once
+
+#include "debugger.h"
+#include "json.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tinydbg {
+
+// --interpreter=json: one request per line on the debugger's stdin,
+// {"id": 1, "command": "break", "args": ["main"]} or {"id": 1, "command": "break main"},
+// replies and events are JSON lines on stdout tagged with the request id
+class JsonInterpreter {
+public:
+    // requests come from input and replies go to output, stdin and stdout of the program
+    // should be elsewhere
+    JsonInterpreter(Debugger& debugger, int input, int output);
+
+    int run();
+
+private:
+    // parsed request line, id is kept as raw JSON so that it's echoed back as is
+    struct Request {
+        std::string id;
+        std::string command;
+        std::vector<std::string> args;
+    };
+
+    static Request parseRequest(const std::string& line);
+    void handleRequest(const std::string& line);
+    void execute(const Request& request);
+    void writeStop(const std::string& id);
+    void writeRegisters();
+    void writeBacktrace(const std::vector<Debugger::Frame>& frames);
+    void writeVariables(const std::vector<Debugger::Variable>& variables);
+
+    Debugger& debugger;
+    int input;
+    JsonWriter writer;
+};
+
+} // namespace tinydbg
@@ -0,0 +1,137 @@
+#include "json.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+
+namespace tinydbg {
+
+JsonWriter::JsonWriter(int fd)
+    : fd{fd}
+    , afterKey{false}
+{
+}
+
+JsonWriter::~JsonWriter()
+{
+    flush();
+}
+
+void JsonWriter::separate()
+{
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    if (!nonEmpty.empty()) {
+        if (nonEmpty.back()) {
+            buffer.push_back(',');
+        }
+        nonEmpty.back() = true;
+    }
+}
+
+JsonWriter& JsonWriter::beginObject()
+{
+    separate();
+    buffer.push_back('{');
+    nonEmpty.push_back(false);
+    return *this;
+}
+
+JsonWriter& JsonWriter::endObject()
+{
+    buffer.push_back('}');
+    nonEmpty.pop_back();
+    return *this;
+}
+
+JsonWriter& JsonWriter::beginArray()
+{
+    separate();
+    buffer.push_back('[');
+    nonEmpty.push_back(false);
+    return *this;
+}
+
+JsonWriter& JsonWriter::endArray()
+{
+    buffer.push_back(']');
+    nonEmpty.pop_back();
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(const std::string& name)
+{
+    value(name);
+    buffer.push_back(':');
+    afterKey = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(const std::string& s)
+{
+    separate();
+    buffer.push_back('"');
+    for (const auto c : s) {
+        switch (c) {
+        case '"': buffer += "\\\""; break;
+        case '\\': buffer += "\\\\"; break;
+        case '\n': buffer += "\\n"; break;
+        case '\r': buffer += "\\r"; break;
+        case '\t': buffer += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[7];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                buffer += escaped;
+            } else {
+                buffer.push_back(c);
+            }
+            break;
+        }
+    }
+    buffer.push_back('"');
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(int64_t number)
+{
+    separate();
+    buffer += std::to_string(number);
+    return *this;
+}
+
+JsonWriter& JsonWriter::hex(uint64_t number)
+{
+    char s[19];
+    snprintf(s, sizeof(s), "0x%lx", number);
+    return value(std::string{s});
+}
+
+JsonWriter& JsonWriter::raw(const std::string& json)
+{
+    separate();
+    buffer += json;
+    return *this;
+}
+
+void JsonWriter::endLine()
+{
+    buffer.push_back('\n');
+}
+
+void JsonWriter::flush()
+{
+    size_t written = 0;
+    while (written < buffer.size()) {
+        const auto result = write(fd, buffer.data() + written, buffer.size() - written);
+        if (result <= 0) {
+            break;
+        }
+        written += result;
+    }
+    buffer.clear();
+}
+
+} // namespace tinydbg
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tinydbg {
+
+// builds JSON lines in memory, output is written in large chunks
+// instead of being flushed per line
+class JsonWriter {
+public:
+    explicit JsonWriter(int fd);
+    ~JsonWriter();
+
+    JsonWriter& beginObject();
+    JsonWriter& endObject();
+    JsonWriter& beginArray();
+    JsonWriter& endArray();
+    JsonWriter& key(const std::string& name);
+    JsonWriter& value(const std::string& s);
+    JsonWriter& value(int64_t number);
+    // addresses and register values don't fit into doubles, they go as "0x..." strings
+    JsonWriter& hex(uint64_t number);
+    // already serialized JSON
+    JsonWriter& raw(const std::string& json);
+    // ends the current top level value
+    void endLine();
+    void flush();
+    size_t pending() const { return buffer.size(); }
+
+private:
+    void separate();
+
+    int fd;
+    std::string buffer;
+    // whether the innermost object or array got its first element
+    std::vector<bool> nonEmpty;
+    bool afterKey;
+};
+
+} // namespace tinydbg
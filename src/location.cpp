@@ -0,0 +1,613 @@
+#include "location.h"
+
+#include "registers.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace tinydbg {
+
+namespace {
+
+// subset of DW_OP_* encodings we know how to compile
+enum : uint8_t {
+    OP_addr = 0x03,
+    OP_deref = 0x06,
+    OP_const1u = 0x08,
+    OP_const1s = 0x09,
+    OP_const2u = 0x0a,
+    OP_const2s = 0x0b,
+    OP_const4u = 0x0c,
+    OP_const4s = 0x0d,
+    OP_const8u = 0x0e,
+    OP_const8s = 0x0f,
+    OP_constu = 0x10,
+    OP_consts = 0x11,
+    OP_dup = 0x12,
+    OP_drop = 0x13,
+    OP_over = 0x14,
+    OP_pick = 0x15,
+    OP_swap = 0x16,
+    OP_abs = 0x19,
+    OP_and = 0x1a,
+    OP_div = 0x1b,
+    OP_minus = 0x1c,
+    OP_mod = 0x1d,
+    OP_mul = 0x1e,
+    OP_neg = 0x1f,
+    OP_not = 0x20,
+    OP_or = 0x21,
+    OP_plus = 0x22,
+    OP_plus_uconst = 0x23,
+    OP_shl = 0x24,
+    OP_shr = 0x25,
+    OP_shra = 0x26,
+    OP_xor = 0x27,
+    OP_lit0 = 0x30,
+    OP_lit31 = 0x4f,
+    OP_reg0 = 0x50,
+    OP_reg31 = 0x6f,
+    OP_breg0 = 0x70,
+    OP_breg31 = 0x8f,
+    OP_regx = 0x90,
+    OP_fbreg = 0x91,
+    OP_bregx = 0x92,
+    OP_deref_size = 0x94,
+    OP_nop = 0x96,
+    OP_call_frame_cfa = 0x9c,
+    OP_stack_value = 0x9f,
+};
+
+class Cursor {
+public:
+    Cursor(const uint8_t* begin, const uint8_t* end)
+        : pos{begin}
+        , end{end}
+    {
+    }
+
+    bool atEnd() const { return pos >= end; }
+
+    template <typename T>
+    T fixed()
+    {
+        if (end - pos < static_cast<ptrdiff_t>(sizeof(T))) {
+            throw std::out_of_range{"Truncated location expression"};
+        }
+        T value;
+        std::memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    uint64_t uleb128()
+    {
+        uint64_t result = 0;
+        int shift = 0;
+        uint8_t byte;
+        do {
+            byte = fixed<uint8_t>();
+            result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        return result;
+    }
+
+    int64_t sleb128()
+    {
+        int64_t result = 0;
+        int shift = 0;
+        uint8_t byte;
+        do {
+            byte = fixed<uint8_t>();
+            result |= static_cast<int64_t>(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        if (shift < 64 && (byte & 0x40)) {
+            result |= -(static_cast<int64_t>(1) << shift);
+        }
+        return result;
+    }
+
+    const uint8_t* position() const { return pos; }
+    void skip(size_t size) { pos += size; }
+
+private:
+    const uint8_t* pos;
+    const uint8_t* end;
+};
+
+bool hasOp(const LocationProgram& program, LocationOpcode opcode)
+{
+    for (const auto& op : program.ops) {
+        if (op.opcode == opcode) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// DW_OP_fbreg N with frame base "DW_OP_breg6 M" becomes "breg6 N + M" etc.
+void foldFrameBase(LocationProgram& program, const LocationProgram& frameBase)
+{
+    if (frameBase.ops.size() != 1) {
+        return;
+    }
+
+    const auto& base = frameBase.ops.front();
+    for (auto& op : program.ops) {
+        if (op.opcode != LocationOpcode::FrameBase) {
+            continue;
+        }
+        switch (base.opcode) {
+        case LocationOpcode::Reg:
+            op = {LocationOpcode::Breg, base.reg, op.operand};
+            break;
+        case LocationOpcode::Breg:
+            op = {LocationOpcode::Breg, base.reg, op.operand + base.operand};
+            break;
+        case LocationOpcode::CallFrameCfa:
+            op = {LocationOpcode::CallFrameCfa, 0, op.operand + base.operand};
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// merge "X; plus_uconst N" into a single X with adjusted operand
+void foldConstants(LocationProgram& program)
+{
+    std::vector<LocationOp> folded;
+    for (const auto& op : program.ops) {
+        if (op.opcode == LocationOpcode::PlusConst && !folded.empty()) {
+            auto& prev = folded.back();
+            if (prev.opcode == LocationOpcode::Const
+                || prev.opcode == LocationOpcode::Breg
+                || prev.opcode == LocationOpcode::FrameBase
+                || prev.opcode == LocationOpcode::CallFrameCfa) {
+                prev.operand += op.operand;
+                continue;
+            }
+        }
+        folded.push_back(op);
+    }
+    program.ops = std::move(folded);
+}
+
+std::optional<LocationProgram> compileBlock(const dwarf::value& value)
+{
+    size_t size;
+    const auto* data = static_cast<const uint8_t*>(value.as_block(&size));
+    return compileExpression(data, size);
+}
+
+uint64_t getTypeSize(dwarf::die type)
+{
+    while (type.valid()) {
+        if (type.has(dwarf::DW_AT::byte_size)) {
+            return type[dwarf::DW_AT::byte_size].as_uconstant();
+        }
+        if (type.tag == dwarf::DW_TAG::pointer_type) {
+            return sizeof(uint64_t);
+        }
+        if (!type.has(dwarf::DW_AT::type)) {
+            break;
+        }
+        type = dwarf::at_type(type);
+    }
+    return sizeof(uint64_t);
+}
+
+} // namespace
+
+const LocationProgram* CompiledLocation::select(uint64_t pc) const
+{
+    for (const auto& range : ranges) {
+        if (range.lowPC <= pc && pc < range.highPC) {
+            return &range.program;
+        }
+    }
+    return nullptr;
+}
+
+std::optional<LocationProgram> compileExpression(const uint8_t* data, size_t size)
+{
+    LocationProgram program;
+    Cursor cursor{data, data + size};
+
+    auto push = [&program](LocationOpcode opcode, int64_t operand = 0, uint16_t reg = 0) {
+        program.ops.push_back({opcode, reg, operand});
+    };
+
+    while (!cursor.atEnd()) {
+        const auto op = cursor.fixed<uint8_t>();
+        if (op >= OP_lit0 && op <= OP_lit31) {
+            push(LocationOpcode::Const, op - OP_lit0);
+        } else if (op >= OP_reg0 && op <= OP_reg31) {
+            push(LocationOpcode::Reg, 0, op - OP_reg0);
+        } else if (op >= OP_breg0 && op <= OP_breg31) {
+            push(LocationOpcode::Breg, cursor.sleb128(), op - OP_breg0);
+        } else {
+            switch (op) {
+            case OP_addr:
+                push(LocationOpcode::Const, cursor.fixed<uint64_t>());
+                break;
+            case OP_const1u:
+                push(LocationOpcode::Const, cursor.fixed<uint8_t>());
+                break;
+            case OP_const1s:
+                push(LocationOpcode::Const, cursor.fixed<int8_t>());
+                break;
+            case OP_const2u:
+                push(LocationOpcode::Const, cursor.fixed<uint16_t>());
+                break;
+            case OP_const2s:
+                push(LocationOpcode::Const, cursor.fixed<int16_t>());
+                break;
+            case OP_const4u:
+                push(LocationOpcode::Const, cursor.fixed<uint32_t>());
+                break;
+            case OP_const4s:
+                push(LocationOpcode::Const, cursor.fixed<int32_t>());
+                break;
+            case OP_const8u:
+                push(LocationOpcode::Const, cursor.fixed<uint64_t>());
+                break;
+            case OP_const8s:
+                push(LocationOpcode::Const, cursor.fixed<int64_t>());
+                break;
+            case OP_constu:
+                push(LocationOpcode::Const, cursor.uleb128());
+                break;
+            case OP_consts:
+                push(LocationOpcode::Const, cursor.sleb128());
+                break;
+            case OP_regx:
+                push(LocationOpcode::Reg, 0, cursor.uleb128());
+                break;
+            case OP_bregx: {
+                const auto reg = cursor.uleb128();
+                push(LocationOpcode::Breg, cursor.sleb128(), reg);
+                break;
+            }
+            case OP_fbreg:
+                push(LocationOpcode::FrameBase, cursor.sleb128());
+                break;
+            case OP_call_frame_cfa:
+                push(LocationOpcode::CallFrameCfa);
+                break;
+            case OP_deref:
+                push(LocationOpcode::Deref, 0, sizeof(uint64_t));
+                break;
+            case OP_deref_size:
+                push(LocationOpcode::Deref, 0, cursor.fixed<uint8_t>());
+                break;
+            case OP_plus_uconst:
+                push(LocationOpcode::PlusConst, cursor.uleb128());
+                break;
+            case OP_pick:
+                push(LocationOpcode::Pick, cursor.fixed<uint8_t>());
+                break;
+            case OP_dup:
+                push(LocationOpcode::Dup);
+                break;
+            case OP_drop:
+                push(LocationOpcode::Drop);
+                break;
+            case OP_swap:
+                push(LocationOpcode::Swap);
+                break;
+            case OP_over:
+                push(LocationOpcode::Over);
+                break;
+            case OP_plus:
+                push(LocationOpcode::Plus);
+                break;
+            case OP_minus:
+                push(LocationOpcode::Minus);
+                break;
+            case OP_mul:
+                push(LocationOpcode::Mul);
+                break;
+            case OP_div:
+                push(LocationOpcode::Div);
+                break;
+            case OP_mod:
+                push(LocationOpcode::Mod);
+                break;
+            case OP_and:
+                push(LocationOpcode::And);
+                break;
+            case OP_or:
+                push(LocationOpcode::Or);
+                break;
+            case OP_xor:
+                push(LocationOpcode::Xor);
+                break;
+            case OP_shl:
+                push(LocationOpcode::Shl);
+                break;
+            case OP_shr:
+                push(LocationOpcode::Shr);
+                break;
+            case OP_shra:
+                push(LocationOpcode::Shra);
+                break;
+            case OP_neg:
+                push(LocationOpcode::Neg);
+                break;
+            case OP_not:
+                push(LocationOpcode::Not);
+                break;
+            case OP_abs:
+                push(LocationOpcode::Abs);
+                break;
+            case OP_stack_value:
+                push(LocationOpcode::StackValue);
+                break;
+            case OP_nop:
+                break;
+            default:
+                // control flow, pieces, TLS and friends are left to libelfin
+                return {};
+            }
+        }
+    }
+
+    // register location can't be combined with anything else
+    if (hasOp(program, LocationOpcode::Reg) && program.ops.size() != 1) {
+        return {};
+    }
+
+    foldConstants(program);
+    return program;
+}
+
+std::optional<CompiledLocation> compileLocation(const dwarf::value& value, const SectionData& debugLoc, uint64_t cuBase)
+{
+    CompiledLocation location;
+
+    if (value.get_type() == dwarf::value::type::exprloc) {
+        auto program = compileBlock(value);
+        if (!program) {
+            return {};
+        }
+        location.ranges.push_back({0, std::numeric_limits<uint64_t>::max(), std::move(*program)});
+        return location;
+    }
+
+    if (value.get_type() != dwarf::value::type::loclist) {
+        return {};
+    }
+
+    // DWARF 2-4 .debug_loc list: (begin, end, length, expression)* terminated with (0, 0)
+    const auto offset = value.as_sec_offset();
+    if (debugLoc.data == nullptr || offset >= debugLoc.size) {
+        return {};
+    }
+
+    Cursor cursor{debugLoc.data + offset, debugLoc.data + debugLoc.size};
+    auto base = cuBase;
+    while (!cursor.atEnd()) {
+        const auto begin = cursor.fixed<uint64_t>();
+        const auto end = cursor.fixed<uint64_t>();
+        if (begin == 0 && end == 0) {
+            break;
+        }
+        if (begin == std::numeric_limits<uint64_t>::max()) {
+            // base address selection entry
+            base = end;
+            continue;
+        }
+
+        const auto length = cursor.fixed<uint16_t>();
+        auto program = compileExpression(cursor.position(), length);
+        cursor.skip(length);
+        if (!program) {
+            return {};
+        }
+        location.ranges.push_back({base + begin, base + end, std::move(*program)});
+    }
+
+    return location;
+}
+
+CompiledFunction compileFunction(const dwarf::die& function, const SectionData& debugLoc)
+{
+    CompiledFunction compiled;
+    if (function.has(dwarf::DW_AT::low_pc)) {
+        compiled.lowPC = dwarf::at_low_pc(function);
+    }
+
+    const auto& cuRoot = function.get_unit().root();
+    const auto cuBase = cuRoot.has(dwarf::DW_AT::low_pc) ? dwarf::at_low_pc(cuRoot) : 0;
+
+    if (function.has(dwarf::DW_AT::frame_base)) {
+        const auto frameBase = function[dwarf::DW_AT::frame_base];
+        if (frameBase.get_type() == dwarf::value::type::exprloc) {
+            compiled.frameBase = compileBlock(frameBase);
+        }
+    }
+
+    for (const auto& die : function) {
+        if (die.tag != dwarf::DW_TAG::variable || !die.has(dwarf::DW_AT::location)) {
+            continue;
+        }
+
+        CompiledVariable variable{
+            die.has(dwarf::DW_AT::name) ? dwarf::at_name(die) : "<anonymous>",
+            die.has(dwarf::DW_AT::type) ? getTypeSize(dwarf::at_type(die)) : sizeof(uint64_t),
+            compileLocation(die[dwarf::DW_AT::location], debugLoc, cuBase),
+            die};
+
+        if (variable.location) {
+            for (auto& range : variable.location->ranges) {
+                if (compiled.frameBase) {
+                    foldFrameBase(range.program, *compiled.frameBase);
+                } else if (hasOp(range.program, LocationOpcode::FrameBase)) {
+                    // frame base is unknown, let libelfin deal with it
+                    variable.location.reset();
+                    break;
+                }
+            }
+        }
+
+        compiled.variables.push_back(std::move(variable));
+    }
+
+    return compiled;
+}
+
+Location evaluateLocation(const LocationProgram& program, const EvaluationContext& context)
+{
+    if (program.ops.size() == 1 && program.ops.front().opcode == LocationOpcode::Reg) {
+        return {Location::Type::Register, program.ops.front().reg};
+    }
+
+    std::vector<uint64_t> stack;
+    stack.reserve(program.ops.size());
+
+    auto pop = [&stack]() {
+        if (stack.empty()) {
+            throw std::out_of_range{"Location expression stack underflow"};
+        }
+        const auto value = stack.back();
+        stack.pop_back();
+        return value;
+    };
+
+    bool isValue = false;
+    for (const auto& op : program.ops) {
+        switch (op.opcode) {
+        case LocationOpcode::Const:
+            stack.push_back(op.operand);
+            break;
+        case LocationOpcode::Breg:
+            stack.push_back(getRegisterValueFromDwarf(context.regs, op.reg) + op.operand);
+            break;
+        case LocationOpcode::FrameBase:
+            if (!context.frameBase) {
+                return {Location::Type::Unavailable, 0};
+            }
+            stack.push_back(*context.frameBase + op.operand);
+            break;
+        case LocationOpcode::CallFrameCfa:
+            if (!context.cfa) {
+                return {Location::Type::Unavailable, 0};
+            }
+            stack.push_back(*context.cfa + op.operand);
+            break;
+        case LocationOpcode::Deref: {
+            auto value = context.deref(pop(), op.reg);
+            if (op.reg < sizeof(uint64_t)) {
+                value &= (static_cast<uint64_t>(1) << (op.reg * 8)) - 1;
+            }
+            stack.push_back(value);
+            break;
+        }
+        case LocationOpcode::PlusConst:
+            stack.push_back(pop() + op.operand);
+            break;
+        case LocationOpcode::Dup: {
+            const auto value = pop();
+            stack.push_back(value);
+            stack.push_back(value);
+            break;
+        }
+        case LocationOpcode::Drop:
+            pop();
+            break;
+        case LocationOpcode::Swap: {
+            const auto a = pop();
+            const auto b = pop();
+            stack.push_back(a);
+            stack.push_back(b);
+            break;
+        }
+        case LocationOpcode::Over:
+        case LocationOpcode::Pick: {
+            const size_t index = op.opcode == LocationOpcode::Over ? 1 : op.operand;
+            if (index >= stack.size()) {
+                throw std::out_of_range{"Location expression stack underflow"};
+            }
+            stack.push_back(stack[stack.size() - 1 - index]);
+            break;
+        }
+        case LocationOpcode::Neg:
+            stack.push_back(-pop());
+            break;
+        case LocationOpcode::Not:
+            stack.push_back(~pop());
+            break;
+        case LocationOpcode::Abs: {
+            const auto value = static_cast<int64_t>(pop());
+            stack.push_back(value < 0 ? -value : value);
+            break;
+        }
+        case LocationOpcode::StackValue:
+            isValue = true;
+            break;
+        case LocationOpcode::Reg:
+            // handled above, compileExpression rejects other combinations
+            return {Location::Type::Unavailable, 0};
+        default: {
+            const auto b = pop();
+            const auto a = pop();
+            switch (op.opcode) {
+            case LocationOpcode::Plus:
+                stack.push_back(a + b);
+                break;
+            case LocationOpcode::Minus:
+                stack.push_back(a - b);
+                break;
+            case LocationOpcode::Mul:
+                stack.push_back(a * b);
+                break;
+            case LocationOpcode::Div:
+                if (b == 0) {
+                    return {Location::Type::Unavailable, 0};
+                }
+                stack.push_back(static_cast<int64_t>(a) / static_cast<int64_t>(b));
+                break;
+            case LocationOpcode::Mod:
+                if (b == 0) {
+                    return {Location::Type::Unavailable, 0};
+                }
+                stack.push_back(a % b);
+                break;
+            case LocationOpcode::And:
+                stack.push_back(a & b);
+                break;
+            case LocationOpcode::Or:
+                stack.push_back(a | b);
+                break;
+            case LocationOpcode::Xor:
+                stack.push_back(a ^ b);
+                break;
+            // shifting by the width or more is undefined in C++, DWARF means all bits shifted out
+            case LocationOpcode::Shl:
+                stack.push_back(b >= 64 ? 0 : a << b);
+                break;
+            case LocationOpcode::Shr:
+                stack.push_back(b >= 64 ? 0 : a >> b);
+                break;
+            case LocationOpcode::Shra:
+                stack.push_back(static_cast<int64_t>(a) >> std::min<uint64_t>(b, 63));
+                break;
+            default:
+                throw std::runtime_error{"Unhandled location opcode"};
+            }
+        }
+        }
+    }
+
+    if (stack.empty()) {
+        return {Location::Type::Unavailable, 0};
+    }
+    return {isValue ? Location::Type::Value : Location::Type::Address, stack.back()};
+}
+
+} // namespace tinydbg
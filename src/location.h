@@ -0,0 +1,120 @@
+#pragma once
+
+#include "debuginfo.h"
+
+#include "dwarf/dwarf++.hh"
+#include "elf/elf++.hh"
+
+#include <sys/user.h>
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace tinydbg {
+
+// Internal representation of DWARF location expressions.
+// DW_OP byte code is decoded once, operands are sign-extended and
+// frame base references are folded into register offsets where possible,
+// so evaluation is a loop over a register snapshot without ptrace calls.
+enum class LocationOpcode : uint8_t {
+    Const, // push operand
+    Reg, // location is dwarf register reg
+    Breg, // push value of dwarf register reg + operand
+    FrameBase, // push frame base + operand
+    CallFrameCfa, // push canonical frame address + operand
+    Deref, // pop address, push reg bytes read from it
+    PlusConst, // add operand to top of stack
+    Dup,
+    Drop,
+    Swap,
+    Over,
+    Pick, // push copy of stack entry number operand
+    Plus,
+    Minus,
+    Mul,
+    Div,
+    Mod,
+    And,
+    Or,
+    Xor,
+    Shl,
+    Shr,
+    Shra,
+    Neg,
+    Not,
+    Abs,
+    StackValue, // value on top of stack is the variable value itself
+};
+
+struct LocationOp {
+    LocationOpcode opcode;
+    // dwarf register for Reg and Breg, size for Deref
+    uint16_t reg;
+    int64_t operand;
+};
+
+struct LocationProgram {
+    std::vector<LocationOp> ops;
+};
+
+// program is valid for pc in [lowPC, highPC), addresses aren't offsetted
+struct LocationRange {
+    uint64_t lowPC;
+    uint64_t highPC;
+    LocationProgram program;
+};
+
+struct CompiledLocation {
+    std::vector<LocationRange> ranges;
+
+    const LocationProgram* select(uint64_t pc) const;
+};
+
+struct Location {
+    enum class Type {
+        Address,
+        Register,
+        Value,
+        Unavailable,
+    };
+
+    Type type;
+    uint64_t value;
+};
+
+struct EvaluationContext {
+    const user_regs_struct& regs;
+    // value of DW_AT_frame_base, only needed when it couldn't be folded
+    std::optional<uint64_t> frameBase;
+    // used by Deref only
+    std::function<uint64_t(uint64_t address, unsigned size)> deref;
+    // canonical frame address, empty if it isn't known at pc
+    std::optional<uint64_t> cfa;
+};
+
+struct CompiledVariable {
+    std::string name;
+    uint64_t size;
+    // empty if expression uses unsupported operations
+    std::optional<CompiledLocation> location;
+    // kept for fallback to libelfin interpreter
+    dwarf::die die;
+};
+
+struct CompiledFunction {
+    // address of the first instruction, not offsetted
+    uint64_t lowPC = 0;
+    std::optional<LocationProgram> frameBase;
+    std::vector<CompiledVariable> variables;
+};
+
+std::optional<LocationProgram> compileExpression(const uint8_t* data, size_t size);
+std::optional<CompiledLocation> compileLocation(const dwarf::value& value, const SectionData& debugLoc, uint64_t cuBase);
+CompiledFunction compileFunction(const dwarf::die& function, const SectionData& debugLoc);
+
+Location evaluateLocation(const LocationProgram& program, const EvaluationContext& context);
+
+} // namespace tinydbg
@@ -1,16 +1,60 @@
 #include "debugger.h"
+#include "stats.h"
 
 #include <iostream>
 
+namespace {
+
+std::vector<std::string> split(const std::string& s, char delimiter)
+{
+    std::vector<std::string> tokens;
+    size_t start = 0;
+    size_t end;
+    while ((end = s.find(delimiter, start)) != std::string::npos) {
+        tokens.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    tokens.push_back(s.substr(start));
+    return tokens;
+}
+
+} // namespace
+
 int main(int argc, char* argv[])
 {
     try {
-        if (argc < 2) {
+        tinydbg::DebugOptions options;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg{argv[i]};
+            if (arg == "--catch-syscall" && i + 1 < argc) {
+                options.catchSyscalls = split(argv[++i], ',');
+            } else if (arg == "--core" && i + 1 < argc) {
+                options.coreFile = argv[++i];
+            } else if (arg == "--agent" && i + 1 < argc) {
+                options.agentLibrary = argv[++i];
+            } else if (arg == "--server" && i + 1 < argc) {
+                options.serverAddress = argv[++i];
+            } else if (arg.rfind("--interpreter=", 0) == 0) {
+                options.interpreter = arg.substr(14);
+            } else if (arg == "--stats-file" && i + 1 < argc) {
+                options.statsFile = argv[++i];
+            } else if (arg == "--debug-dir" && i + 1 < argc) {
+                options.debugDirectories.push_back(argv[++i]);
+            } else {
+                options.programName = arg;
+            }
+        }
+
+        if (options.programName.empty()) {
             std::cerr << "Program name not specified";
             return -1;
         }
 
-        return tinydbg::debug(argv[1]);
+        const auto result = tinydbg::debug(options);
+        if (!options.statsFile.empty() && !tinydbg::stats::exportJson(options.statsFile)) {
+            std::cerr << "Failed to write stats to " << options.statsFile << std::endl;
+        }
+        return result;
     } catch (const std::exception& e) {
         std::cerr << "An error occured: " << e.what();
         return -1;
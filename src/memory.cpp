@@ -0,0 +1,205 @@
+#include "memory.h"
+
+#include "stats.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace tinydbg {
+
+std::vector<MemoryRegion> readMemoryRegions(pid_t pid)
+{
+    std::vector<MemoryRegion> regions;
+    std::ifstream maps{"/proc/" + std::to_string(pid) + "/maps"};
+    std::string line;
+    while (std::getline(maps, line)) {
+        // ADDRESS-ADDRESS PERMS OFFSET DEV INODE [PATH]
+        std::istringstream stream{line};
+        std::string range, offset, device;
+        MemoryRegion region{};
+        stream >> range >> region.perms >> offset >> device >> region.inode;
+        std::getline(stream >> std::ws, region.path);
+
+        const auto dash = range.find('-');
+        if (dash == std::string::npos) {
+            continue;
+        }
+        region.start = std::stoull(range.substr(0, dash), nullptr, 16);
+        region.end = std::stoull(range.substr(dash + 1), nullptr, 16);
+        region.offset = std::stoull(offset, nullptr, 16);
+        regions.push_back(std::move(region));
+    }
+    return regions;
+}
+
+bool readMemory(pid_t pid, uint64_t address, void* buffer, size_t size)
+{
+    iovec local{buffer, size};
+    iovec remote{reinterpret_cast<void*>(address), size};
+    stats::Timer timer{stats::Operation::ReadMemory};
+    const auto read = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+    timer.addBytes(read > 0 ? read : 0);
+    return read >= 0 && static_cast<size_t>(read) == size;
+}
+
+size_t readMemoryBatch(pid_t pid, const std::vector<MemoryRange>& ranges, void* buffer)
+{
+    auto* out = static_cast<uint8_t*>(buffer);
+
+    std::vector<iovec> local;
+    std::vector<iovec> remote;
+    local.reserve(ranges.size());
+    remote.reserve(ranges.size());
+    for (const auto& range : ranges) {
+        local.push_back({out, range.size});
+        remote.push_back({reinterpret_cast<void*>(range.address), range.size});
+        out += range.size;
+    }
+
+    size_t totalRead = 0;
+    size_t first = 0;
+    while (first < ranges.size()) {
+        // kernel accepts at most IOV_MAX iovecs per call
+        const auto count = std::min<size_t>(ranges.size() - first, IOV_MAX);
+        const auto batchEnd = first + count;
+        stats::Timer timer{stats::Operation::ReadMemory};
+        const auto read = process_vm_readv(pid, &local[first], count, &remote[first], count, 0);
+        timer.addBytes(read > 0 ? read : 0);
+
+        // process_vm_readv stops at the first range it fails to read,
+        // skip over completely read ranges
+        auto transferred = read < 0 ? 0 : static_cast<size_t>(read);
+        while (first < batchEnd && transferred >= local[first].iov_len) {
+            transferred -= local[first].iov_len;
+            totalRead += local[first].iov_len;
+            ++first;
+        }
+
+        if (first < batchEnd) {
+            // range is unreadable, zero it and continue from the next one
+            std::memset(local[first].iov_base, 0, local[first].iov_len);
+            ++first;
+        }
+    }
+
+    return totalRead;
+}
+
+bool writeMemoryBatch(pid_t pid, const std::vector<MemoryRange>& ranges, const void* buffer,
+    std::vector<size_t>* written)
+{
+    if (written) {
+        written->assign(ranges.size(), 0);
+    }
+    const auto path = "/proc/" + std::to_string(pid) + "/mem";
+    const auto fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    const auto* in = static_cast<const uint8_t*>(buffer);
+    bool success = true;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        const auto& range = ranges[i];
+        stats::Timer timer{stats::Operation::WriteMemory};
+        const auto rangeWritten = pwrite(fd, in, range.size, static_cast<off_t>(range.address));
+        timer.addBytes(rangeWritten > 0 ? rangeWritten : 0);
+        success = success && rangeWritten >= 0 && static_cast<size_t>(rangeWritten) == range.size;
+        if (written && rangeWritten > 0) {
+            (*written)[i] = rangeWritten;
+        }
+        in += range.size;
+    }
+
+    close(fd);
+    return success;
+}
+
+bool clearSoftDirty(pid_t pid)
+{
+    const auto path = "/proc/" + std::to_string(pid) + "/clear_refs";
+    const auto fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+    // "4" resets soft-dirty bits only, referenced bits stay
+    const auto written = write(fd, "4", 1);
+    close(fd);
+    return written == 1;
+}
+
+std::optional<std::vector<MemoryRange>> readPagemap(pid_t pid, const std::vector<MemoryRange>& ranges, uint64_t bits)
+{
+    const auto path = "/proc/" + std::to_string(pid) + "/pagemap";
+    const auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return {};
+    }
+
+    const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    // ranges which only had address space reserved can be huge, read pagemap in pieces
+    constexpr size_t PAGEMAP_CHUNK = 1 << 16;
+    std::vector<uint64_t> entries(PAGEMAP_CHUNK);
+    std::vector<MemoryRange> pages;
+    for (const auto& range : ranges) {
+        const auto pageCount = range.size / pageSize;
+        for (uint64_t first = 0; first < pageCount; first += PAGEMAP_CHUNK) {
+            const auto count = std::min<uint64_t>(pageCount - first, PAGEMAP_CHUNK);
+            const auto pagemapOffset = (range.address / pageSize + first) * sizeof(uint64_t);
+            const auto read = pread(fd, entries.data(), count * sizeof(uint64_t), pagemapOffset);
+            if (read < 0) {
+                close(fd);
+                return {};
+            }
+
+            for (uint64_t i = 0; i < static_cast<size_t>(read) / sizeof(uint64_t); ++i) {
+                if ((entries[i] & bits) == 0) {
+                    continue;
+                }
+                const auto address = range.address + (first + i) * pageSize;
+                if (!pages.empty() && pages.back().address + pages.back().size == address) {
+                    pages.back().size += pageSize;
+                } else {
+                    pages.push_back({address, pageSize});
+                }
+            }
+        }
+    }
+
+    close(fd);
+    return pages;
+}
+
+bool isSoftDirtyTracked()
+{
+    static const bool tracked = []() {
+        const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+        auto* page = static_cast<volatile uint8_t*>(
+            mmap(nullptr, pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (page == MAP_FAILED) {
+            return false;
+        }
+        // a new page is soft-dirty anyway, only a write after clearing tells
+        page[0] = 1;
+        bool result = false;
+        if (clearSoftDirty(getpid())) {
+            page[0] = 2;
+            const auto dirty = readPagemap(getpid(), {{reinterpret_cast<uint64_t>(page), pageSize}}, PAGEMAP_SOFT_DIRTY);
+            result = dirty && !dirty->empty();
+        }
+        munmap(const_cast<uint8_t*>(page), pageSize);
+        return result;
+    }();
+    return tracked;
+}
+
+} // namespace tinydbg
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace tinydbg {
+
+struct MemoryRange {
+    uint64_t address;
+    size_t size;
+};
+
+// mapping from /proc/<pid>/maps
+struct MemoryRegion {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;
+    uint64_t inode;
+    // rwxp or rwxs
+    std::string perms;
+    std::string path;
+
+    bool isReadable() const { return !perms.empty() && perms[0] == 'r'; }
+};
+
+std::vector<MemoryRegion> readMemoryRegions(pid_t pid);
+
+// read size bytes of inferior memory with process_vm_readv
+// returns false if the whole range couldn't be read
+bool readMemory(pid_t pid, uint64_t address, void* buffer, size_t size);
+
+// read all ranges back to back into buffer using as few syscalls as possible
+// bytes of unreadable ranges are zeroed
+// returns number of successfully read bytes
+size_t readMemoryBatch(pid_t pid, const std::vector<MemoryRange>& ranges, void* buffer);
+
+// write ranges taking data back to back from buffer through /proc/<pid>/mem,
+// unlike process_vm_writev it works for read-only pages like .text
+// ranges after a failed one are still written, written gets bytes written of each range
+bool writeMemoryBatch(pid_t pid, const std::vector<MemoryRange>& ranges, const void* buffer,
+    std::vector<size_t>* written = nullptr);
+
+// clear soft-dirty bits of every page of the process, the kernel sets them again on write,
+// false if clear_refs can't be written, without CONFIG_MEM_SOFT_DIRTY it can but nothing is tracked
+bool clearSoftDirty(pid_t pid);
+
+// pagemap entry bits, see Documentation/admin-guide/mm/pagemap.rst
+constexpr uint64_t PAGEMAP_PRESENT = uint64_t{1} << 63;
+constexpr uint64_t PAGEMAP_SWAPPED = uint64_t{1} << 62;
+// page is mapped from a file (or is shared anonymous), i.e. wasn't copied on write
+constexpr uint64_t PAGEMAP_FILE = uint64_t{1} << 61;
+// written since clearSoftDirty, set on every new page too
+constexpr uint64_t PAGEMAP_SOFT_DIRTY = uint64_t{1} << 55;
+
+// pages of page aligned ranges with any of bits set in their pagemap entry,
+// adjacent pages are merged, empty if pagemap can't be read
+std::optional<std::vector<MemoryRange>> readPagemap(pid_t pid, const std::vector<MemoryRange>& ranges, uint64_t bits);
+
+// whether the kernel sets soft-dirty bits on write, probed once on a page of our own
+bool isSoftDirtyTracked();
+
+} // namespace tinydbg
@@ -1,8 +1,14 @@
 #include "registers.h"
 
+#include "stats.h"
+
+#include <cpuid.h>
+#include <elf.h>
 #include <sys/ptrace.h>
+#include <sys/uio.h>
 
 #include <algorithm>
+#include <cstring>
 #include <functional>
 #include <iomanip>
 #include <iostream>
@@ -19,39 +25,130 @@ auto findRegisterDescriptor(std::function<bool(const RegisterDescriptor&)> predi
         predicate);
 }
 
+// XSAVE state components
+enum XStateComponent {
+    X87 = 0,
+    SSE = 1,
+    AVX = 2, // upper halves of ymm0-15
+    OPMASK = 5, // k0-7
+    ZMM_HI256 = 6, // upper halves of zmm0-15
+    HI16_ZMM = 7, // zmm16-31
+};
+
+// legacy FXSAVE region
+constexpr size_t MXCSR_OFFSET = 24;
+constexpr size_t ST_OFFSET = 32;
+constexpr size_t XMM_OFFSET = 160;
+// software reserved bytes of FXSAVE region, ptrace puts XCR0 there
+constexpr size_t XCR0_OFFSET = 464;
+constexpr size_t XSTATE_BV_OFFSET = 512;
+
+// offset of the component in standard format, the same for every process on this CPU
+size_t getComponentOffset(int component)
+{
+    static const auto offsets = [] {
+        std::array<uint32_t, 8> offsets{};
+        for (int i = AVX; i <= HI16_ZMM; ++i) {
+            unsigned eax = 0;
+            unsigned ebx = 0;
+            unsigned ecx = 0;
+            unsigned edx = 0;
+            if (__get_cpuid_count(0xd, i, &eax, &ebx, &ecx, &edx)) {
+                offsets[i] = ebx;
+            }
+        }
+        return offsets;
+    }();
+    return offsets.at(component);
+}
+
+// size of the whole XSAVE area for all features the CPU supports
+size_t getXStateSize()
+{
+    unsigned eax = 0;
+    unsigned ebx = 0;
+    unsigned ecx = 0;
+    unsigned edx = 0;
+    if (!__get_cpuid_count(0xd, 0, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    return ecx;
+}
+
+// name prefix and number, "xmm12" -> {"xmm", 12}
+std::optional<std::pair<std::string, size_t>> splitRegisterName(const std::string& name)
+{
+    const auto digits = name.find_first_of("0123456789");
+    if (digits == std::string::npos || digits == 0) {
+        return {};
+    }
+    try {
+        size_t parsed = 0;
+        const auto number = std::stoul(name.substr(digits), &parsed);
+        if (digits + parsed != name.size()) {
+            return {};
+        }
+        return std::make_pair(name.substr(0, digits), number);
+    } catch (const std::exception&) {
+        return {};
+    }
+}
+
 } // namespace
 
-uint64_t getRegisterValue(pid_t pid, Register r)
+user_regs_struct getRegisters(pid_t pid)
 {
     user_regs_struct regs;
-    ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+    stats::ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+    return regs;
+}
+
+void setRegisters(pid_t pid, const user_regs_struct& regs)
+{
+    stats::ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
+}
+
+uint64_t getRegisterValue(pid_t pid, Register r)
+{
+    return getRegisterValue(getRegisters(pid), r);
+}
 
+uint64_t getRegisterValue(const user_regs_struct& regs, Register r)
+{
     const auto it = findRegisterDescriptor(
         [r](const auto& rd) { return rd.reg == r; });
     // we can do that cause we have same layout of REGISTOR_DESCRIPTORS and user_regs_struct
     // same could be done with switch(Register)
-    return *(reinterpret_cast<uint64_t*>(&regs) + (it - REGISTOR_DESCRIPTORS.cbegin()));
+    return *(reinterpret_cast<const uint64_t*>(&regs) + (it - REGISTOR_DESCRIPTORS.cbegin()));
 }
 
 uint64_t getRegisterValueFromDwarf(pid_t pid, int dwarfRegNum)
+{
+    return getRegisterValueFromDwarf(getRegisters(pid), dwarfRegNum);
+}
+
+uint64_t getRegisterValueFromDwarf(const user_regs_struct& regs, int dwarfRegNum)
 {
     const auto it = findRegisterDescriptor(
         [dwarfRegNum](const auto& rd) { return rd.dwarfReg == dwarfRegNum; });
     if (it == REGISTOR_DESCRIPTORS.cend()) {
         throw std::out_of_range{"Unknown dwarf register"};
     }
-    return getRegisterValue(pid, it->reg);
+    return getRegisterValue(regs, it->reg);
 }
 
 void setRegisterValue(pid_t pid, Register r, uint64_t value)
 {
-    user_regs_struct regs;
-    ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+    auto regs = getRegisters(pid);
+    setRegisterValue(regs, r, value);
+    setRegisters(pid, regs);
+}
 
+void setRegisterValue(user_regs_struct& regs, Register r, uint64_t value)
+{
     const auto it = findRegisterDescriptor(
         [r](const auto& rd) { return rd.reg == r; });
     *(reinterpret_cast<uint64_t*>(&regs) + (it - REGISTOR_DESCRIPTORS.cbegin())) = value;
-    ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
 }
 
 std::string getRegisterName(Register r)
@@ -71,13 +168,143 @@ std::optional<Register> getRegister(const std::string& name)
     return it->reg;
 }
 
-void dumpRegisters(pid_t pid)
+void dumpRegisters(const user_regs_struct& regs)
 {
     for (const auto& r : REGISTOR_DESCRIPTORS) {
         std::cerr << r.name << " 0x"
                   << std::setfill('0') << std::setw(16) << std::hex
-                  << getRegisterValue(pid, r.reg) << std::endl;
+                  << getRegisterValue(regs, r.reg) << std::endl;
+    }
+}
+
+XState::XState(std::vector<uint8_t> area)
+    : area{std::move(area)}
+{
+    std::memcpy(&features, this->area.data() + XCR0_OFFSET, sizeof(features));
+    // x87 and SSE are always there
+    features |= 0x3;
+}
+
+XState XState::read(pid_t pid)
+{
+    const auto size = getXStateSize();
+    if (size < XSTATE_BV_OFFSET + 64) {
+        return {};
+    }
+
+    std::vector<uint8_t> area(size);
+    iovec iov{area.data(), area.size()};
+    if (stats::ptrace(PTRACE_GETREGSET, pid, NT_X86_XSTATE, &iov) != 0 || iov.iov_len < XSTATE_BV_OFFSET + 64) {
+        return {};
+    }
+    area.resize(iov.iov_len);
+    return XState{std::move(area)};
+}
+
+bool XState::append(std::vector<uint8_t>& bytes, int component, size_t offset, size_t size) const
+{
+    if ((features & (uint64_t{1} << component)) == 0) {
+        return false;
+    }
+    const auto start = component <= SSE ? offset : getComponentOffset(component) + offset;
+    if (start + size > area.size()) {
+        return false;
+    }
+
+    uint64_t present = 0;
+    std::memcpy(&present, area.data() + XSTATE_BV_OFFSET, sizeof(present));
+    // init state of a component isn't written out, it's all zeros for registers we show
+    if (component > SSE && (present & (uint64_t{1} << component)) == 0) {
+        bytes.insert(bytes.end(), size, 0);
+    } else {
+        bytes.insert(bytes.end(), area.cbegin() + start, area.cbegin() + start + size);
+    }
+    return true;
+}
+
+std::vector<uint8_t> XState::getRegister(const std::string& name) const
+{
+    if (area.empty()) {
+        return {};
+    }
+
+    std::vector<uint8_t> bytes;
+    if (name == "mxcsr") {
+        return append(bytes, SSE, MXCSR_OFFSET, 4) ? bytes : std::vector<uint8_t>{};
+    }
+
+    const auto split = splitRegisterName(name);
+    if (!split) {
+        return {};
+    }
+    const auto& [prefix, number] = *split;
+
+    bool ok = false;
+    if (prefix == "st" && number < 8) {
+        ok = append(bytes, X87, ST_OFFSET + number * 16, 10);
+    } else if (prefix == "k" && number < 8) {
+        ok = append(bytes, OPMASK, number * 8, 8);
+    } else if (number >= 16 && number < 32) {
+        // Hi16_ZMM keeps whole registers, xmm and ymm are their low parts
+        const auto size = prefix == "xmm" ? 16 : prefix == "ymm" ? 32 : prefix == "zmm" ? 64 : 0;
+        ok = size > 0 && append(bytes, HI16_ZMM, (number - 16) * 64, size);
+    } else if (number < 16) {
+        // low 128 bits in the legacy area, then the upper halves component by component
+        ok = (prefix == "xmm" || prefix == "ymm" || prefix == "zmm") && append(bytes, SSE, XMM_OFFSET + number * 16, 16);
+        if (ok && prefix != "xmm") {
+            ok = append(bytes, AVX, number * 16, 16);
+        }
+        if (ok && prefix == "zmm") {
+            ok = append(bytes, ZMM_HI256, number * 32, 32);
+        }
+    }
+    return ok ? bytes : std::vector<uint8_t>{};
+}
+
+std::vector<std::string> XState::getRegisterNames() const
+{
+    std::vector<std::string> names;
+    if (area.empty()) {
+        return names;
+    }
+
+    for (size_t i = 0; i < 8; ++i) {
+        names.push_back("st" + std::to_string(i));
+    }
+    names.push_back("mxcsr");
+    // the widest available form of each vector register
+    const auto avx512 = (features & (uint64_t{1} << HI16_ZMM)) != 0;
+    const std::string prefix = avx512 ? "zmm" : (features & (uint64_t{1} << AVX)) != 0 ? "ymm" : "xmm";
+    for (size_t i = 0; i < (avx512 ? 32 : 16); ++i) {
+        names.push_back(prefix + std::to_string(i));
+    }
+    if ((features & (uint64_t{1} << OPMASK)) != 0) {
+        for (size_t i = 0; i < 8; ++i) {
+            names.push_back("k" + std::to_string(i));
+        }
+    }
+    return names;
+}
+
+std::optional<std::string> XState::getDwarfRegisterName(int dwarfRegNum)
+{
+    // numbering from x86-64 psABI
+    if (dwarfRegNum >= 17 && dwarfRegNum <= 32) {
+        return "xmm" + std::to_string(dwarfRegNum - 17);
+    }
+    if (dwarfRegNum >= 33 && dwarfRegNum <= 40) {
+        return "st" + std::to_string(dwarfRegNum - 33);
+    }
+    if (dwarfRegNum == 64) {
+        return std::string{"mxcsr"};
+    }
+    if (dwarfRegNum >= 67 && dwarfRegNum <= 82) {
+        return "xmm" + std::to_string(dwarfRegNum - 67 + 16);
+    }
+    if (dwarfRegNum >= 118 && dwarfRegNum <= 125) {
+        return "k" + std::to_string(dwarfRegNum - 118);
     }
+    return {};
 }
 
 } // namespace tinydbg
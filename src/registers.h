@@ -1,9 +1,13 @@
 #pragma once
 
+#include <sys/types.h>
 #include <sys/user.h>
 
 #include <array>
+#include <cstdint>
 #include <optional>
+#include <string>
+#include <vector>
 
 namespace tinydbg {
 
@@ -57,11 +61,46 @@ static const std::array<RegisterDescriptor, REGISTER_NUMBER> REGISTOR_DESCRIPTOR
     {Register::gs, 55, "gs"},
 }};
 
+user_regs_struct getRegisters(pid_t pid);
+void setRegisters(pid_t pid, const user_regs_struct& regs);
+
 uint64_t getRegisterValue(pid_t pid, Register r);
+uint64_t getRegisterValue(const user_regs_struct& regs, Register r);
 uint64_t getRegisterValueFromDwarf(pid_t pid, int dwarfRegNum);
+uint64_t getRegisterValueFromDwarf(const user_regs_struct& regs, int dwarfRegNum);
 void setRegisterValue(pid_t pid, Register r, uint64_t value);
+void setRegisterValue(user_regs_struct& regs, Register r, uint64_t value);
 std::string getRegisterName(Register r);
 std::optional<Register> getRegister(const std::string& name);
-void dumpRegisters(pid_t pid);
+void dumpRegisters(const user_regs_struct& regs);
+
+// XSAVE area of a thread in standard format as PTRACE_GETREGSET(NT_X86_XSTATE) returns it,
+// x87, SSE, AVX and AVX-512 registers are sliced out of it
+class XState {
+public:
+    XState() = default;
+    // empty area if the kernel doesn't provide it
+    static XState read(pid_t pid);
+
+    bool empty() const { return area.empty(); }
+    // little endian bytes of stN, mxcsr, xmmN, ymmN, zmmN or kN,
+    // empty for unknown names and components the CPU doesn't have
+    std::vector<uint8_t> getRegister(const std::string& name) const;
+    // names of registers present in this area in dump order
+    std::vector<std::string> getRegisterNames() const;
+
+    // vector register of dwarf number 17-32, 67-82 (xmm), 33-40 (st), 64 (mxcsr) or 118-125 (k)
+    static std::optional<std::string> getDwarfRegisterName(int dwarfRegNum);
+
+private:
+    explicit XState(std::vector<uint8_t> area);
+
+    // bytes [offset, offset + size) of component, zeros if it's in init state
+    bool append(std::vector<uint8_t>& bytes, int component, size_t offset, size_t size) const;
+
+    std::vector<uint8_t> area;
+    // components enabled by the OS (XCR0)
+    uint64_t features = 0;
+};
 
 } // namespace tinydbg
@@ -0,0 +1,358 @@
+#include "search.h"
+
+#include <immintrin.h>
+
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+namespace tinydbg {
+
+namespace {
+
+bool matchesAt(const uint8_t* data, const SearchPattern& pattern)
+{
+    for (size_t i = 0; i < pattern.bytes.size(); ++i) {
+        if (((data[i] ^ pattern.bytes[i]) & pattern.mask[i]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Candidates are positions where two fully specified bytes of the pattern match,
+// whole pattern is compared for them only.
+struct Anchors {
+    size_t first;
+    size_t last;
+};
+
+bool findPatternScalar(const uint8_t* data, size_t begin, size_t end, const SearchPattern& pattern,
+    std::vector<uint64_t>& matches, size_t limit)
+{
+    for (size_t i = begin; i < end; ++i) {
+        if (matchesAt(data + i, pattern)) {
+            matches.push_back(i);
+            if (matches.size() >= limit) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// checks candidate positions given as bitmask of positions starting at base
+bool verifyCandidates(const uint8_t* data, size_t base, uint32_t candidates, const SearchPattern& pattern,
+    std::vector<uint64_t>& matches, size_t limit)
+{
+    while (candidates != 0) {
+        const auto position = base + __builtin_ctz(candidates);
+        if (matchesAt(data + position, pattern)) {
+            matches.push_back(position);
+            if (matches.size() >= limit) {
+                return false;
+            }
+        }
+        candidates &= candidates - 1;
+    }
+    return true;
+}
+
+__attribute__((target("avx2"))) bool findPatternAvx2(const uint8_t* data, size_t end, const SearchPattern& pattern,
+    Anchors anchors, std::vector<uint64_t>& matches, size_t limit)
+{
+    const auto first = _mm256_set1_epi8(static_cast<char>(pattern.bytes[anchors.first]));
+    const auto last = _mm256_set1_epi8(static_cast<char>(pattern.bytes[anchors.last]));
+
+    size_t i = 0;
+    for (; i + 32 <= end; i += 32) {
+        const auto firstBlock = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + anchors.first));
+        const auto lastBlock = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + anchors.last));
+        const auto equal = _mm256_and_si256(_mm256_cmpeq_epi8(firstBlock, first), _mm256_cmpeq_epi8(lastBlock, last));
+        const auto candidates = static_cast<uint32_t>(_mm256_movemask_epi8(equal));
+        if (candidates != 0 && !verifyCandidates(data, i, candidates, pattern, matches, limit)) {
+            return false;
+        }
+    }
+    return findPatternScalar(data, i, end, pattern, matches, limit);
+}
+
+bool findPatternSse2(const uint8_t* data, size_t end, const SearchPattern& pattern,
+    Anchors anchors, std::vector<uint64_t>& matches, size_t limit)
+{
+    const auto first = _mm_set1_epi8(static_cast<char>(pattern.bytes[anchors.first]));
+    const auto last = _mm_set1_epi8(static_cast<char>(pattern.bytes[anchors.last]));
+
+    size_t i = 0;
+    for (; i + 16 <= end; i += 16) {
+        const auto firstBlock = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + anchors.first));
+        const auto lastBlock = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + anchors.last));
+        const auto equal = _mm_and_si128(_mm_cmpeq_epi8(firstBlock, first), _mm_cmpeq_epi8(lastBlock, last));
+        const auto candidates = static_cast<uint32_t>(_mm_movemask_epi8(equal));
+        if (candidates != 0 && !verifyCandidates(data, i, candidates, pattern, matches, limit)) {
+            return false;
+        }
+    }
+    return findPatternScalar(data, i, end, pattern, matches, limit);
+}
+
+bool findPointersScalar(const uint64_t* words, size_t begin, size_t count, uint64_t low, uint64_t high,
+    std::vector<uint64_t>& matches, size_t limit)
+{
+    for (size_t i = begin; i < count; ++i) {
+        if (words[i] - low < high - low) {
+            matches.push_back(i * sizeof(uint64_t));
+            if (matches.size() >= limit) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+__attribute__((target("avx2"))) bool findPointersAvx2(const uint64_t* words, size_t count, uint64_t low, uint64_t high,
+    std::vector<uint64_t>& matches, size_t limit)
+{
+    // unsigned value - low < high - low, AVX2 only has signed compare so both sides are biased
+    const auto bias = _mm256_set1_epi64x(INT64_MIN);
+    const auto lowVector = _mm256_set1_epi64x(static_cast<int64_t>(low));
+    const auto range = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(high - low)), bias);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+        const auto distance = _mm256_xor_si256(_mm256_sub_epi64(block, lowVector), bias);
+        auto candidates = static_cast<uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(range, distance))));
+        while (candidates != 0) {
+            matches.push_back((i + __builtin_ctz(candidates)) * sizeof(uint64_t));
+            if (matches.size() >= limit) {
+                return false;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+    return findPointersScalar(words, i, count, low, high, matches, limit);
+}
+
+bool findPointersSse2(const uint64_t* words, size_t count, uint64_t value,
+    std::vector<uint64_t>& matches, size_t limit)
+{
+    // SSE2 has no 64-bit compare, both halves of a word have to be equal
+    const auto valueVector = _mm_set1_epi64x(static_cast<int64_t>(value));
+
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + i));
+        const auto halves = static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, valueVector))));
+        if ((halves & 0x3) == 0x3) {
+            matches.push_back(i * sizeof(uint64_t));
+            if (matches.size() >= limit) {
+                return false;
+            }
+        }
+        if ((halves & 0xc) == 0xc) {
+            matches.push_back((i + 1) * sizeof(uint64_t));
+            if (matches.size() >= limit) {
+                return false;
+            }
+        }
+    }
+    return findPointersScalar(words, i, count, value, value + 1, matches, limit);
+}
+
+bool hasAvx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+uint8_t parseHexDigit(char c)
+{
+    if (!std::isxdigit(static_cast<unsigned char>(c))) {
+        throw std::invalid_argument{"Invalid hex digit"};
+    }
+    return std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : std::tolower(c) - 'a' + 10;
+}
+
+// x:de ad ?? e?, ? is a wildcard nibble
+std::optional<SearchPattern> parseHexPattern(const std::string& text)
+{
+    std::string digits;
+    for (const auto c : text) {
+        if (!std::isspace(static_cast<unsigned char>(c))) {
+            digits.push_back(c);
+        }
+    }
+    if (digits.empty() || digits.size() % 2 != 0) {
+        return {};
+    }
+
+    SearchPattern pattern;
+    for (size_t i = 0; i < digits.size(); i += 2) {
+        uint8_t byte = 0;
+        uint8_t mask = 0;
+        for (size_t nibble = 0; nibble < 2; ++nibble) {
+            byte <<= 4;
+            mask <<= 4;
+            if (digits[i + nibble] != '?') {
+                byte |= parseHexDigit(digits[i + nibble]);
+                mask |= 0xf;
+            }
+        }
+        pattern.bytes.push_back(byte);
+        pattern.mask.push_back(mask);
+    }
+    return pattern;
+}
+
+// "text" with \\, \", \n, \t, \0 and \xNN escapes
+std::optional<SearchPattern> parseStringPattern(const std::string& text)
+{
+    if (text.size() < 2 || text.back() != '"') {
+        return {};
+    }
+
+    SearchPattern pattern;
+    for (size_t i = 1; i + 1 < text.size(); ++i) {
+        auto c = static_cast<uint8_t>(text[i]);
+        if (c == '\\' && i + 2 < text.size()) {
+            const auto escaped = text[++i];
+            switch (escaped) {
+            case 'n':
+                c = '\n';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case '0':
+                c = '\0';
+                break;
+            case 'x':
+                if (i + 3 >= text.size()) {
+                    return {};
+                }
+                c = parseHexDigit(text[i + 1]) << 4 | parseHexDigit(text[i + 2]);
+                i += 2;
+                break;
+            default:
+                c = escaped;
+                break;
+            }
+        }
+        pattern.bytes.push_back(c);
+    }
+    pattern.mask.assign(pattern.bytes.size(), 0xff);
+    return pattern;
+}
+
+uint64_t parseNumber(const std::string& text)
+{
+    size_t parsed = 0;
+    const auto value = text[0] == '-' ? static_cast<uint64_t>(std::stoll(text, &parsed, 0)) : std::stoull(text, &parsed, 0);
+    if (parsed != text.size()) {
+        throw std::invalid_argument{"Invalid number"};
+    }
+    return value;
+}
+
+} // namespace
+
+std::optional<SearchPattern> parseSearchPattern(const std::string& text)
+{
+    try {
+        if (text.empty()) {
+            return {};
+        }
+        if (text[0] == '"') {
+            return parseStringPattern(text);
+        }
+        if (text.compare(0, 2, "x:") == 0) {
+            return parseHexPattern(text.substr(2));
+        }
+
+        // [u|i]WIDTH:VALUE[/MASK] or a bare number
+        size_t width = 0;
+        auto number = text;
+        const auto colon = text.find(':');
+        if (colon != std::string::npos) {
+            if (text[0] != 'u' && text[0] != 'i') {
+                return {};
+            }
+            width = std::stoul(text.substr(1, colon - 1)) / 8;
+            if (width != 1 && width != 2 && width != 4 && width != 8) {
+                return {};
+            }
+            number = text.substr(colon + 1);
+        }
+
+        auto mask = ~uint64_t{0};
+        const auto slash = number.find('/');
+        if (slash != std::string::npos) {
+            mask = parseNumber(number.substr(slash + 1));
+            number = number.substr(0, slash);
+        }
+        const auto value = parseNumber(number);
+
+        if (width == 0) {
+            const auto isHex = number.compare(0, 2, "0x") == 0;
+            const auto bits = isHex ? (number.size() - 2) * 4 : 64 - __builtin_clzll(value | 1);
+            width = 1;
+            while (width < 8 && width * 8 < bits) {
+                width *= 2;
+            }
+        }
+
+        // little endian
+        SearchPattern pattern;
+        for (size_t i = 0; i < width; ++i) {
+            pattern.bytes.push_back(static_cast<uint8_t>(value >> (i * 8)));
+            pattern.mask.push_back(static_cast<uint8_t>(mask >> (i * 8)));
+        }
+        return pattern;
+    } catch (const std::logic_error&) {
+        return {};
+    }
+}
+
+bool findPattern(const uint8_t* data, size_t size, const SearchPattern& pattern,
+    std::vector<uint64_t>& matches, size_t limit)
+{
+    if (pattern.bytes.empty() || size < pattern.bytes.size()) {
+        return true;
+    }
+    // positions where the whole pattern fits
+    const auto end = size - pattern.bytes.size() + 1;
+
+    // first and last fully specified bytes filter candidates
+    std::optional<Anchors> anchors;
+    for (size_t i = 0; i < pattern.mask.size(); ++i) {
+        if (pattern.mask[i] == 0xff) {
+            anchors = Anchors{anchors ? anchors->first : i, i};
+        }
+    }
+    if (!anchors) {
+        return findPatternScalar(data, 0, end, pattern, matches, limit);
+    }
+
+    if (hasAvx2()) {
+        return findPatternAvx2(data, end, pattern, *anchors, matches, limit);
+    }
+    return findPatternSse2(data, end, pattern, *anchors, matches, limit);
+}
+
+bool findPointers(const uint8_t* data, size_t size, uint64_t low, uint64_t high,
+    std::vector<uint64_t>& matches, size_t limit)
+{
+    const auto* words = reinterpret_cast<const uint64_t*>(data);
+    const auto count = size / sizeof(uint64_t);
+
+    if (hasAvx2()) {
+        return findPointersAvx2(words, count, low, high, matches, limit);
+    }
+    if (high - low == 1) {
+        return findPointersSse2(words, count, low, matches, limit);
+    }
+    return findPointersScalar(words, 0, count, low, high, matches, limit);
+}
+
+} // namespace tinydbg
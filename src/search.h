@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace tinydbg {
+
+// byte string where only bits set in mask have to match
+struct SearchPattern {
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> mask;
+};
+
+// "text", x:de ad ?? ef, u8/u16/u32/u64/i8/i16/i32/i64:VALUE[/MASK] or a bare number,
+// bare numbers take the smallest of 1, 2, 4 or 8 bytes which holds all given digits
+std::optional<SearchPattern> parseSearchPattern(const std::string& text);
+
+// Scanners append offsets of matches in data to matches until it holds limit entries,
+// return false once the limit is reached. AVX2 or SSE2 is used when CPU has it.
+
+// pattern has to fit into data entirely
+bool findPattern(const uint8_t* data, size_t size, const SearchPattern& pattern,
+    std::vector<uint64_t>& matches, size_t limit);
+// 8-byte aligned words with value in [low, high), data should be 8-byte aligned in the inferior
+bool findPointers(const uint8_t* data, size_t size, uint64_t low, uint64_t high,
+    std::vector<uint64_t>& matches, size_t limit);
+
+} // namespace tinydbg
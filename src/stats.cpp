@@ -0,0 +1,197 @@
+#include "stats.h"
+
+#include "json.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+namespace tinydbg::stats {
+
+namespace {
+
+const char* getName(Operation operation)
+{
+    switch (operation) {
+    case Operation::PeekData:
+        return "PTRACE_PEEKDATA";
+    case Operation::PokeData:
+        return "PTRACE_POKEDATA";
+    case Operation::GetRegs:
+        return "PTRACE_GETREGS";
+    case Operation::SetRegs:
+        return "PTRACE_SETREGS";
+    case Operation::GetRegset:
+        return "PTRACE_GETREGSET";
+    case Operation::GetSigInfo:
+        return "PTRACE_GETSIGINFO";
+    case Operation::Continue:
+        return "PTRACE_CONT";
+    case Operation::SingleStep:
+        return "PTRACE_SINGLESTEP";
+    case Operation::OtherPtrace:
+        return "ptrace (other)";
+    case Operation::Wait:
+        return "waitpid";
+    case Operation::ReadMemory:
+        return "process_vm_readv";
+    case Operation::WriteMemory:
+        return "/proc/pid/mem write";
+    case Operation::Count:
+        break;
+    }
+    return "unknown";
+}
+
+// log2 buckets of latency in ns
+struct Counters {
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+    std::array<uint64_t, 64> histogram{};
+
+    void add(uint64_t ns, uint64_t size)
+    {
+        ++calls;
+        bytes += size;
+        total += ns;
+        max = std::max(max, ns);
+        size_t bucket = 0;
+        while ((ns >> bucket) > 1 && bucket + 2 < histogram.size()) {
+            ++bucket;
+        }
+        ++histogram[bucket];
+    }
+};
+
+std::array<Counters, static_cast<size_t>(Operation::Count)> operations;
+// keyed by names from the command table, they live forever
+std::unordered_map<const char*, Counters> commands;
+
+void printCounters(std::ostream& out, const char* name, const Counters& counters, bool withBytes)
+{
+    out << name << ": " << counters.calls << " calls";
+    if (withBytes && counters.bytes > 0) {
+        out << ", " << counters.bytes << " bytes";
+    }
+    out << ", total " << formatDuration(counters.total)
+        << ", avg " << formatDuration(counters.total / counters.calls)
+        << ", max " << formatDuration(counters.max) << '\n';
+
+    for (size_t bucket = 0; bucket < counters.histogram.size(); ++bucket) {
+        if (counters.histogram[bucket] > 0) {
+            out << "  [" << formatDuration(uint64_t{1} << bucket)
+                << ", " << formatDuration(uint64_t{1} << (bucket + 1)) << "): "
+                << counters.histogram[bucket] << '\n';
+        }
+    }
+}
+
+void writeCounters(JsonWriter& writer, const char* name, const Counters& counters)
+{
+    writer.beginObject().key("name").value(name)
+        .key("calls").value(static_cast<int64_t>(counters.calls))
+        .key("bytes").value(static_cast<int64_t>(counters.bytes))
+        .key("totalNs").value(static_cast<int64_t>(counters.total))
+        .key("maxNs").value(static_cast<int64_t>(counters.max));
+    // [lower bound in ns, count] of non-empty buckets
+    writer.key("histogram").beginArray();
+    for (size_t bucket = 0; bucket < counters.histogram.size(); ++bucket) {
+        if (counters.histogram[bucket] > 0) {
+            writer.beginArray().value(static_cast<int64_t>(uint64_t{1} << bucket))
+                .value(static_cast<int64_t>(counters.histogram[bucket])).endArray();
+        }
+    }
+    writer.endArray().endObject();
+}
+
+// commands sorted by total time, the most expensive first
+std::vector<std::pair<const char*, const Counters*>> getCommands()
+{
+    std::vector<std::pair<const char*, const Counters*>> sorted;
+    for (const auto& [name, counters] : commands) {
+        sorted.push_back({name, &counters});
+    }
+    std::sort(sorted.begin(), sorted.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.second->total > rhs.second->total; });
+    return sorted;
+}
+
+} // namespace
+
+#ifdef TINYDBG_STATS
+
+uint64_t now()
+{
+    const auto time = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+
+void record(Operation operation, uint64_t ns, uint64_t bytes)
+{
+    operations[static_cast<size_t>(operation)].add(ns, bytes);
+}
+
+void recordCommand(const char* command, uint64_t ns)
+{
+    commands[command].add(ns, 0);
+}
+
+#endif
+
+void print(std::ostream& out)
+{
+    if (!ENABLED) {
+        out << "Built without TINYDBG_STATS, nothing is measured\n";
+        return;
+    }
+
+    for (size_t i = 0; i < operations.size(); ++i) {
+        if (operations[i].calls > 0) {
+            printCounters(out, getName(static_cast<Operation>(i)), operations[i], /*withBytes*/ true);
+        }
+    }
+    for (const auto& [name, counters] : getCommands()) {
+        printCounters(out, name, *counters, /*withBytes*/ false);
+    }
+}
+
+void reset()
+{
+    operations = {};
+    commands.clear();
+}
+
+bool exportJson(const std::string& path)
+{
+    const auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    {
+        JsonWriter writer{fd};
+        writer.beginObject().key("enabled").raw(ENABLED ? "true" : "false");
+        writer.key("operations").beginArray();
+        for (size_t i = 0; i < operations.size(); ++i) {
+            if (operations[i].calls > 0) {
+                writeCounters(writer, getName(static_cast<Operation>(i)), operations[i]);
+            }
+        }
+        writer.endArray().key("commands").beginArray();
+        for (const auto& [name, counters] : getCommands()) {
+            writeCounters(writer, name, *counters);
+        }
+        writer.endArray().endObject().endLine();
+    }
+    return close(fd) == 0;
+}
+
+} // namespace tinydbg::stats
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+namespace tinydbg::stats {
+
+// traced syscalls, each gets call and byte counters and a latency histogram
+enum class Operation {
+    PeekData,
+    PokeData,
+    GetRegs,
+    SetRegs,
+    GetRegset,
+    GetSigInfo,
+    Continue,
+    SingleStep,
+    OtherPtrace,
+    Wait,
+    ReadMemory,
+    WriteMemory,
+    Count,
+};
+
+constexpr Operation getOperation(__ptrace_request request)
+{
+    switch (request) {
+    case PTRACE_PEEKTEXT:
+    case PTRACE_PEEKDATA:
+        return Operation::PeekData;
+    case PTRACE_POKETEXT:
+    case PTRACE_POKEDATA:
+        return Operation::PokeData;
+    case PTRACE_GETREGS:
+        return Operation::GetRegs;
+    case PTRACE_SETREGS:
+        return Operation::SetRegs;
+    case PTRACE_GETREGSET:
+        return Operation::GetRegset;
+    case PTRACE_GETSIGINFO:
+        return Operation::GetSigInfo;
+    case PTRACE_CONT:
+        return Operation::Continue;
+    case PTRACE_SINGLESTEP:
+        return Operation::SingleStep;
+    default:
+        return Operation::OtherPtrace;
+    }
+}
+
+#ifdef TINYDBG_STATS
+
+uint64_t now();
+void record(Operation operation, uint64_t ns, uint64_t bytes);
+void recordCommand(const char* command, uint64_t ns);
+
+// times its own lifetime
+class Timer {
+public:
+    explicit Timer(Operation operation)
+        : operation{operation}
+        , start{now()}
+    {
+    }
+
+    ~Timer() { record(operation, now() - start, bytes); }
+
+    void addBytes(uint64_t count) { bytes += count; }
+
+private:
+    Operation operation;
+    uint64_t start;
+    uint64_t bytes = 0;
+};
+
+class CommandTimer {
+public:
+    explicit CommandTimer(const char* command)
+        : command{command}
+        , start{now()}
+    {
+    }
+
+    ~CommandTimer() { recordCommand(command, now() - start); }
+
+private:
+    const char* command;
+    uint64_t start;
+};
+
+constexpr bool ENABLED = true;
+
+#else
+
+// built without TINYDBG_STATS, nothing is measured and calls compile down to the bare syscalls
+class Timer {
+public:
+    explicit Timer(Operation) {}
+    void addBytes(uint64_t) {}
+};
+
+class CommandTimer {
+public:
+    explicit CommandTimer(const char*) {}
+};
+
+constexpr bool ENABLED = false;
+
+#endif
+
+void print(std::ostream& out);
+void reset();
+// counters and histograms as JSON, false if file couldn't be written
+bool exportJson(const std::string& path);
+
+namespace detail {
+
+inline void* toArgument(std::nullptr_t)
+{
+    return nullptr;
+}
+
+template <typename T>
+void* toArgument(T* pointer)
+{
+    return const_cast<void*>(static_cast<const void*>(pointer));
+}
+
+template <typename T, std::enable_if_t<std::is_integral_v<T>, int> = 0>
+void* toArgument(T value)
+{
+    return reinterpret_cast<void*>(static_cast<uintptr_t>(value));
+}
+
+} // namespace detail
+
+// ptrace counted under its request, PEEK/POKE move a word each
+template <typename Address, typename Data>
+long ptrace(__ptrace_request request, pid_t pid, Address address, Data data)
+{
+    const auto operation = getOperation(request);
+    Timer timer{operation};
+    if (operation == Operation::PeekData || operation == Operation::PokeData) {
+        timer.addBytes(sizeof(long));
+    }
+    return ::ptrace(request, pid, detail::toArgument(address), detail::toArgument(data));
+}
+
+inline pid_t waitpid(pid_t pid, int* status, int options)
+{
+    Timer timer{Operation::Wait};
+    return ::waitpid(pid, status, options);
+}
+
+} // namespace tinydbg::stats
@@ -1,5 +1,9 @@
 #include "symbol.h"
 
+#include <cxxabi.h>
+
+#include <cstdlib>
+
 namespace tinydbg {
 
 std::string toString(SymbolType st)
@@ -34,4 +38,16 @@ SymbolType toSymbolType(elf::stt sym)
     }
 };
 
+std::string demangle(const std::string& name)
+{
+    int status;
+    char* demangled = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+    if (status != 0) {
+        return name;
+    }
+    std::string result{demangled};
+    std::free(demangled);
+    return result;
+}
+
 } // namespace tinydbg
@@ -23,5 +23,7 @@ struct Symbol {
 
 std::string toString(SymbolType st);
 SymbolType toSymbolType(elf::stt sym);
+// demangled C++ name or name itself if it isn't mangled
+std::string demangle(const std::string& name);
 
 } // namespace tinydbg
@@ -0,0 +1,472 @@
+#include "syscalls.h"
+
+#include "memory.h"
+
+#include <linux/audit.h>
+#include <linux/seccomp.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <sstream>
+
+namespace tinydbg {
+
+namespace {
+
+struct SyscallDescriptor {
+    int number;
+    const char* name;
+    // bit i is set if argument i is a path
+    unsigned stringArgs;
+};
+
+// x86_64, sorted by number
+const SyscallDescriptor SYSCALL_DESCRIPTORS[] = {
+    {0, "read", 0},
+    {1, "write", 0},
+    {2, "open", 0x1},
+    {3, "close", 0},
+    {4, "stat", 0x1},
+    {5, "fstat", 0},
+    {6, "lstat", 0x1},
+    {7, "poll", 0},
+    {8, "lseek", 0},
+    {9, "mmap", 0},
+    {10, "mprotect", 0},
+    {11, "munmap", 0},
+    {12, "brk", 0},
+    {13, "rt_sigaction", 0},
+    {14, "rt_sigprocmask", 0},
+    {15, "rt_sigreturn", 0},
+    {16, "ioctl", 0},
+    {17, "pread64", 0},
+    {18, "pwrite64", 0},
+    {19, "readv", 0},
+    {20, "writev", 0},
+    {21, "access", 0x1},
+    {22, "pipe", 0},
+    {23, "select", 0},
+    {24, "sched_yield", 0},
+    {25, "mremap", 0},
+    {26, "msync", 0},
+    {27, "mincore", 0},
+    {28, "madvise", 0},
+    {29, "shmget", 0},
+    {30, "shmat", 0},
+    {31, "shmctl", 0},
+    {32, "dup", 0},
+    {33, "dup2", 0},
+    {34, "pause", 0},
+    {35, "nanosleep", 0},
+    {36, "getitimer", 0},
+    {37, "alarm", 0},
+    {38, "setitimer", 0},
+    {39, "getpid", 0},
+    {40, "sendfile", 0},
+    {41, "socket", 0},
+    {42, "connect", 0},
+    {43, "accept", 0},
+    {44, "sendto", 0},
+    {45, "recvfrom", 0},
+    {46, "sendmsg", 0},
+    {47, "recvmsg", 0},
+    {48, "shutdown", 0},
+    {49, "bind", 0},
+    {50, "listen", 0},
+    {51, "getsockname", 0},
+    {52, "getpeername", 0},
+    {53, "socketpair", 0},
+    {54, "setsockopt", 0},
+    {55, "getsockopt", 0},
+    {56, "clone", 0},
+    {57, "fork", 0},
+    {58, "vfork", 0},
+    {59, "execve", 0x1},
+    {60, "exit", 0},
+    {61, "wait4", 0},
+    {62, "kill", 0},
+    {63, "uname", 0},
+    {64, "semget", 0},
+    {65, "semop", 0},
+    {66, "semctl", 0},
+    {67, "shmdt", 0},
+    {68, "msgget", 0},
+    {69, "msgsnd", 0},
+    {70, "msgrcv", 0},
+    {71, "msgctl", 0},
+    {72, "fcntl", 0},
+    {73, "flock", 0},
+    {74, "fsync", 0},
+    {75, "fdatasync", 0},
+    {76, "truncate", 0x1},
+    {77, "ftruncate", 0},
+    {78, "getdents", 0},
+    {79, "getcwd", 0},
+    {80, "chdir", 0x1},
+    {81, "fchdir", 0},
+    {82, "rename", 0x3},
+    {83, "mkdir", 0x1},
+    {84, "rmdir", 0x1},
+    {85, "creat", 0x1},
+    {86, "link", 0x3},
+    {87, "unlink", 0x1},
+    {88, "symlink", 0x3},
+    {89, "readlink", 0x1},
+    {90, "chmod", 0x1},
+    {91, "fchmod", 0},
+    {92, "chown", 0x1},
+    {93, "fchown", 0},
+    {94, "lchown", 0x1},
+    {95, "umask", 0},
+    {96, "gettimeofday", 0},
+    {97, "getrlimit", 0},
+    {98, "getrusage", 0},
+    {99, "sysinfo", 0},
+    {100, "times", 0},
+    {101, "ptrace", 0},
+    {102, "getuid", 0},
+    {103, "syslog", 0},
+    {104, "getgid", 0},
+    {105, "setuid", 0},
+    {106, "setgid", 0},
+    {107, "geteuid", 0},
+    {108, "getegid", 0},
+    {109, "setpgid", 0},
+    {110, "getppid", 0},
+    {111, "getpgrp", 0},
+    {112, "setsid", 0},
+    {113, "setreuid", 0},
+    {114, "setregid", 0},
+    {115, "getgroups", 0},
+    {116, "setgroups", 0},
+    {117, "setresuid", 0},
+    {118, "getresuid", 0},
+    {119, "setresgid", 0},
+    {120, "getresgid", 0},
+    {121, "getpgid", 0},
+    {122, "setfsuid", 0},
+    {123, "setfsgid", 0},
+    {124, "getsid", 0},
+    {125, "capget", 0},
+    {126, "capset", 0},
+    {127, "rt_sigpending", 0},
+    {128, "rt_sigtimedwait", 0},
+    {129, "rt_sigqueueinfo", 0},
+    {130, "rt_sigsuspend", 0},
+    {131, "sigaltstack", 0},
+    {132, "utime", 0},
+    {133, "mknod", 0x1},
+    {134, "uselib", 0},
+    {135, "personality", 0},
+    {136, "ustat", 0},
+    {137, "statfs", 0x1},
+    {138, "fstatfs", 0},
+    {139, "sysfs", 0},
+    {140, "getpriority", 0},
+    {141, "setpriority", 0},
+    {142, "sched_setparam", 0},
+    {143, "sched_getparam", 0},
+    {144, "sched_setscheduler", 0},
+    {145, "sched_getscheduler", 0},
+    {146, "sched_get_priority_max", 0},
+    {147, "sched_get_priority_min", 0},
+    {148, "sched_rr_get_interval", 0},
+    {149, "mlock", 0},
+    {150, "munlock", 0},
+    {151, "mlockall", 0},
+    {152, "munlockall", 0},
+    {153, "vhangup", 0},
+    {154, "modify_ldt", 0},
+    {155, "pivot_root", 0},
+    {156, "_sysctl", 0},
+    {157, "prctl", 0},
+    {158, "arch_prctl", 0},
+    {159, "adjtimex", 0},
+    {160, "setrlimit", 0},
+    {161, "chroot", 0x1},
+    {162, "sync", 0},
+    {163, "acct", 0x1},
+    {164, "settimeofday", 0},
+    {165, "mount", 0x7},
+    {166, "umount2", 0x1},
+    {167, "swapon", 0x1},
+    {168, "swapoff", 0x1},
+    {169, "reboot", 0},
+    {170, "sethostname", 0},
+    {171, "setdomainname", 0},
+    {172, "iopl", 0},
+    {173, "ioperm", 0},
+    {174, "create_module", 0},
+    {175, "init_module", 0},
+    {176, "delete_module", 0},
+    {177, "get_kernel_syms", 0},
+    {178, "query_module", 0},
+    {179, "quotactl", 0},
+    {180, "nfsservctl", 0},
+    {181, "getpmsg", 0},
+    {182, "putpmsg", 0},
+    {183, "afs_syscall", 0},
+    {184, "tuxcall", 0},
+    {185, "security", 0},
+    {186, "gettid", 0},
+    {187, "readahead", 0},
+    {188, "setxattr", 0x3},
+    {189, "lsetxattr", 0},
+    {190, "fsetxattr", 0},
+    {191, "getxattr", 0x3},
+    {192, "lgetxattr", 0},
+    {193, "fgetxattr", 0},
+    {194, "listxattr", 0x1},
+    {195, "llistxattr", 0},
+    {196, "flistxattr", 0},
+    {197, "removexattr", 0x3},
+    {198, "lremovexattr", 0},
+    {199, "fremovexattr", 0},
+    {200, "tkill", 0},
+    {201, "time", 0},
+    {202, "futex", 0},
+    {203, "sched_setaffinity", 0},
+    {204, "sched_getaffinity", 0},
+    {205, "set_thread_area", 0},
+    {206, "io_setup", 0},
+    {207, "io_destroy", 0},
+    {208, "io_getevents", 0},
+    {209, "io_submit", 0},
+    {210, "io_cancel", 0},
+    {211, "get_thread_area", 0},
+    {212, "lookup_dcookie", 0},
+    {213, "epoll_create", 0},
+    {214, "epoll_ctl_old", 0},
+    {215, "epoll_wait_old", 0},
+    {216, "remap_file_pages", 0},
+    {217, "getdents64", 0},
+    {218, "set_tid_address", 0},
+    {219, "restart_syscall", 0},
+    {220, "semtimedop", 0},
+    {221, "fadvise64", 0},
+    {222, "timer_create", 0},
+    {223, "timer_settime", 0},
+    {224, "timer_gettime", 0},
+    {225, "timer_getoverrun", 0},
+    {226, "timer_delete", 0},
+    {227, "clock_settime", 0},
+    {228, "clock_gettime", 0},
+    {229, "clock_getres", 0},
+    {230, "clock_nanosleep", 0},
+    {231, "exit_group", 0},
+    {232, "epoll_wait", 0},
+    {233, "epoll_ctl", 0},
+    {234, "tgkill", 0},
+    {235, "utimes", 0},
+    {236, "vserver", 0},
+    {237, "mbind", 0},
+    {238, "set_mempolicy", 0},
+    {239, "get_mempolicy", 0},
+    {240, "mq_open", 0},
+    {241, "mq_unlink", 0},
+    {242, "mq_timedsend", 0},
+    {243, "mq_timedreceive", 0},
+    {244, "mq_notify", 0},
+    {245, "mq_getsetattr", 0},
+    {246, "kexec_load", 0},
+    {247, "waitid", 0},
+    {248, "add_key", 0},
+    {249, "request_key", 0},
+    {250, "keyctl", 0},
+    {251, "ioprio_set", 0},
+    {252, "ioprio_get", 0},
+    {253, "inotify_init", 0},
+    {254, "inotify_add_watch", 0x2},
+    {255, "inotify_rm_watch", 0},
+    {256, "migrate_pages", 0},
+    {257, "openat", 0x2},
+    {258, "mkdirat", 0x2},
+    {259, "mknodat", 0x2},
+    {260, "fchownat", 0x2},
+    {261, "futimesat", 0},
+    {262, "newfstatat", 0x2},
+    {263, "unlinkat", 0x2},
+    {264, "renameat", 0xa},
+    {265, "linkat", 0xa},
+    {266, "symlinkat", 0x5},
+    {267, "readlinkat", 0x2},
+    {268, "fchmodat", 0x2},
+    {269, "faccessat", 0x2},
+    {270, "pselect6", 0},
+    {271, "ppoll", 0},
+    {272, "unshare", 0},
+    {273, "set_robust_list", 0},
+    {274, "get_robust_list", 0},
+    {275, "splice", 0},
+    {276, "tee", 0},
+    {277, "sync_file_range", 0},
+    {278, "vmsplice", 0},
+    {279, "move_pages", 0},
+    {280, "utimensat", 0x2},
+    {281, "epoll_pwait", 0},
+    {282, "signalfd", 0},
+    {283, "timerfd_create", 0},
+    {284, "eventfd", 0},
+    {285, "fallocate", 0},
+    {286, "timerfd_settime", 0},
+    {287, "timerfd_gettime", 0},
+    {288, "accept4", 0},
+    {289, "signalfd4", 0},
+    {290, "eventfd2", 0},
+    {291, "epoll_create1", 0},
+    {292, "dup3", 0},
+    {293, "pipe2", 0},
+    {294, "inotify_init1", 0},
+    {295, "preadv", 0},
+    {296, "pwritev", 0},
+    {297, "rt_tgsigqueueinfo", 0},
+    {298, "perf_event_open", 0},
+    {299, "recvmmsg", 0},
+    {300, "fanotify_init", 0},
+    {301, "fanotify_mark", 0},
+    {302, "prlimit64", 0},
+    {303, "name_to_handle_at", 0},
+    {304, "open_by_handle_at", 0},
+    {305, "clock_adjtime", 0},
+    {306, "syncfs", 0},
+    {307, "sendmmsg", 0},
+    {308, "setns", 0},
+    {309, "getcpu", 0},
+    {310, "process_vm_readv", 0},
+    {311, "process_vm_writev", 0},
+    {312, "kcmp", 0},
+    {313, "finit_module", 0},
+    {314, "sched_setattr", 0},
+    {315, "sched_getattr", 0},
+    {316, "renameat2", 0xa},
+    {317, "seccomp", 0},
+    {318, "getrandom", 0},
+    {319, "memfd_create", 0},
+    {320, "kexec_file_load", 0},
+    {321, "bpf", 0},
+    {322, "execveat", 0x2},
+    {323, "userfaultfd", 0},
+    {324, "membarrier", 0},
+    {325, "mlock2", 0},
+    {326, "copy_file_range", 0},
+    {327, "preadv2", 0},
+    {328, "pwritev2", 0},
+    {329, "pkey_mprotect", 0},
+    {330, "pkey_alloc", 0},
+    {331, "pkey_free", 0},
+    {332, "statx", 0x2},
+    {333, "io_pgetevents", 0},
+    {334, "rseq", 0},
+    {424, "pidfd_send_signal", 0},
+    {425, "io_uring_setup", 0},
+    {426, "io_uring_enter", 0},
+    {427, "io_uring_register", 0},
+    {428, "open_tree", 0},
+    {429, "move_mount", 0},
+    {430, "fsopen", 0},
+    {431, "fsconfig", 0},
+    {432, "fsmount", 0},
+    {433, "fspick", 0},
+    {434, "pidfd_open", 0},
+    {435, "clone3", 0},
+    {436, "close_range", 0},
+    {437, "openat2", 0x2},
+    {438, "pidfd_getfd", 0},
+    {439, "faccessat2", 0x2},
+    {440, "process_madvise", 0},
+    {441, "epoll_pwait2", 0},
+    {442, "mount_setattr", 0},
+    {443, "quotactl_fd", 0},
+    {444, "landlock_create_ruleset", 0},
+    {445, "landlock_add_rule", 0},
+    {446, "landlock_restrict_self", 0},
+    {447, "memfd_secret", 0},
+    {448, "process_mrelease", 0},
+    {449, "futex_waitv", 0},
+    {450, "set_mempolicy_home_node", 0},
+};
+
+const SyscallDescriptor* findSyscall(int number)
+{
+    const auto* end = std::end(SYSCALL_DESCRIPTORS);
+    const auto* it = std::lower_bound(std::begin(SYSCALL_DESCRIPTORS), end, number,
+        [](const auto& sd, int number) { return sd.number < number; });
+    if (it == end || it->number != number) {
+        return nullptr;
+    }
+    return it;
+}
+
+std::string readString(pid_t pid, uint64_t address)
+{
+    constexpr size_t MAX_LENGTH = 256;
+    char buffer[MAX_LENGTH + 1] = {};
+    // string may end right before an unmapped page, fall back to smaller reads
+    for (size_t size = MAX_LENGTH; size > 0; size /= 4) {
+        if (readMemory(pid, address, buffer, size)) {
+            break;
+        }
+    }
+    return buffer;
+}
+
+} // namespace
+
+std::optional<int> getSyscallNumber(const std::string& name)
+{
+    const auto* it = std::find_if(std::begin(SYSCALL_DESCRIPTORS), std::end(SYSCALL_DESCRIPTORS),
+        [&name](const auto& sd) { return name == sd.name; });
+    if (it == std::end(SYSCALL_DESCRIPTORS)) {
+        return {};
+    }
+    return it->number;
+}
+
+std::string getSyscallName(int number)
+{
+    const auto* sd = findSyscall(number);
+    return sd != nullptr ? sd->name : "syscall_" + std::to_string(number);
+}
+
+std::string formatSyscall(pid_t pid, const user_regs_struct& regs)
+{
+    const auto number = static_cast<int>(regs.orig_rax);
+    const auto* sd = findSyscall(number);
+    const uint64_t args[] = {regs.rdi, regs.rsi, regs.rdx, regs.r10, regs.r8, regs.r9};
+
+    std::ostringstream out;
+    out << getSyscallName(number) << '(' << std::hex;
+    for (size_t i = 0; i < std::size(args); ++i) {
+        if (i > 0) {
+            out << ", ";
+        }
+        if (sd != nullptr && (sd->stringArgs & (1u << i)) && args[i] != 0) {
+            out << '"' << readString(pid, args[i]) << '"';
+        } else {
+            out << "0x" << args[i];
+        }
+    }
+    out << ')';
+    return out.str();
+}
+
+std::vector<sock_filter> buildSyscallFilter(const std::vector<int>& syscalls)
+{
+    std::vector<sock_filter> filter;
+
+    // syscall numbers are only meaningful for the native architecture
+    filter.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, arch)));
+    filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0));
+    filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+
+    filter.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, nr)));
+    for (const auto number : syscalls) {
+        filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(number), 0, 1));
+        filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+    }
+    filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+
+    return filter;
+}
+
+} // namespace tinydbg
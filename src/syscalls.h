@@ -0,0 +1,24 @@
+#pragma once
+
+#include <linux/filter.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace tinydbg {
+
+std::optional<int> getSyscallNumber(const std::string& name);
+std::string getSyscallName(int number);
+
+// "openat(0xffffff9c, "/etc/passwd", 0x0, ...)" using syscall arguments from regs,
+// path arguments are read from inferior memory
+std::string formatSyscall(pid_t pid, const user_regs_struct& regs);
+
+// seccomp program which returns SECCOMP_RET_TRACE for given syscalls
+// and lets everything else run without stopping
+std::vector<sock_filter> buildSyscallFilter(const std::vector<int>& syscalls);
+
+} // namespace tinydbg
@@ -0,0 +1,217 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iomanip>
+
+namespace tinydbg {
+
+namespace {
+
+uint64_t now()
+{
+    const auto time = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+
+} // namespace
+
+std::string formatDuration(uint64_t ns)
+{
+    if (ns < 1000) {
+        return std::to_string(ns) + "ns";
+    }
+    if (ns < 1000 * 1000) {
+        return std::to_string(ns / 1000) + "us";
+    }
+    if (ns < 1000 * 1000 * 1000) {
+        return std::to_string(ns / 1000 / 1000) + "ms";
+    }
+    return std::to_string(ns / 1000 / 1000 / 1000) + "s";
+}
+
+void CallTracer::addFunction(uint64_t address, const std::string& name)
+{
+    if (entries.count(address) > 0) {
+        return;
+    }
+    entries[address] = static_cast<uint32_t>(functions.size());
+    functions.push_back(name);
+}
+
+std::vector<uint64_t> CallTracer::entryAddresses() const
+{
+    std::vector<uint64_t> addresses;
+    for (const auto& [address, function] : entries) {
+        addresses.push_back(address);
+    }
+    return addresses;
+}
+
+std::vector<uint64_t> CallTracer::returnAddresses() const
+{
+    std::vector<uint64_t> addresses;
+    for (const auto& [address, count] : returns) {
+        addresses.push_back(address);
+    }
+    return addresses;
+}
+
+bool CallTracer::onEntry(uint64_t address, uint64_t returnAddress, const user_regs_struct& regs, pid_t tid)
+{
+    const auto function = entries.at(address);
+    buffer.push({now(), static_cast<uint32_t>(tid), function, TraceEventKind::Entry,
+        {regs.rdi, regs.rsi, regs.rdx, regs.rcx, regs.r8, regs.r9}});
+
+    // at entry return address is on top of the stack, ret pops it
+    frames.push_back({returnAddress, regs.rsp + sizeof(uint64_t), function});
+    return returns[returnAddress]++ == 0;
+}
+
+std::vector<uint64_t> CallTracer::onReturn(uint64_t address, const user_regs_struct& regs, pid_t tid)
+{
+    std::vector<uint64_t> released;
+
+    // stack grows down, so every frame at or below current stack pointer is gone,
+    // deeper ones were left by longjmp or exceptions and don't produce events
+    while (!frames.empty() && frames.back().stackPointer <= regs.rsp) {
+        const auto frame = frames.back();
+        frames.pop_back();
+
+        if (frame.returnAddress == address && frame.stackPointer == regs.rsp) {
+            buffer.push({now(), static_cast<uint32_t>(tid), frame.function, TraceEventKind::Exit,
+                {regs.rax}});
+        }
+
+        if (--returns[frame.returnAddress] == 0) {
+            returns.erase(frame.returnAddress);
+            released.push_back(frame.returnAddress);
+        }
+    }
+
+    return released;
+}
+
+void CallTracer::rebase(int64_t delta)
+{
+    std::unordered_map<uint64_t, uint32_t> rebased;
+    for (const auto& [address, function] : entries) {
+        rebased[address + delta] = function;
+    }
+    entries = std::move(rebased);
+    returns.clear();
+    frames.clear();
+}
+
+void CallTracer::clear()
+{
+    functions.clear();
+    entries.clear();
+    returns.clear();
+    frames.clear();
+    buffer.clear();
+}
+
+void CallTracer::dump(std::ostream& out, size_t count) const
+{
+    if (buffer.dropped() > 0) {
+        out << buffer.dropped() << " older events were overwritten\n";
+    }
+
+    const auto size = buffer.size();
+    const auto first = count < size ? size - count : 0;
+    const auto start = size > 0 ? buffer.at(0).timestamp : 0;
+    for (size_t i = first; i < size; ++i) {
+        const auto& event = buffer.at(i);
+        out << std::dec << '[' << std::setw(12) << event.timestamp - start << "] "
+            << event.tid << ' ';
+        if (event.kind == TraceEventKind::Entry) {
+            out << "-> " << functions[event.function] << std::hex << "(0x" << event.args[0];
+            for (size_t arg = 1; arg < 6; ++arg) {
+                out << ", 0x" << event.args[arg];
+            }
+            out << ")\n";
+        } else {
+            out << "<- " << functions[event.function] << " = 0x" << std::hex << event.args[0] << '\n';
+        }
+    }
+    out << std::dec;
+}
+
+void CallTracer::printStats(std::ostream& out) const
+{
+    // log2 buckets of call latency in ns
+    struct Stats {
+        uint64_t calls = 0;
+        uint64_t returned = 0;
+        uint64_t total = 0;
+        uint64_t max = 0;
+        std::array<uint64_t, 64> histogram{};
+    };
+    std::vector<Stats> stats(functions.size());
+
+    // pair entries and exits with a call stack per thread
+    std::unordered_map<uint32_t, std::vector<const TraceEvent*>> stacks;
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        const auto& event = buffer.at(i);
+        auto& stack = stacks[event.tid];
+        if (event.kind == TraceEventKind::Entry) {
+            ++stats[event.function].calls;
+            stack.push_back(&event);
+            continue;
+        }
+
+        // entries whose exits were never recorded are skipped
+        while (!stack.empty() && stack.back()->function != event.function) {
+            stack.pop_back();
+        }
+        if (stack.empty()) {
+            continue;
+        }
+
+        const auto latency = event.timestamp - stack.back()->timestamp;
+        stack.pop_back();
+        auto& functionStats = stats[event.function];
+        ++functionStats.returned;
+        functionStats.total += latency;
+        functionStats.max = std::max(functionStats.max, latency);
+        size_t bucket = 0;
+        while ((latency >> bucket) > 1 && bucket + 2 < functionStats.histogram.size()) {
+            ++bucket;
+        }
+        ++functionStats.histogram[bucket];
+    }
+
+    std::vector<size_t> order(functions.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(),
+        [&stats](auto lhs, auto rhs) { return stats[lhs].calls > stats[rhs].calls; });
+
+    out << std::dec;
+    for (const auto function : order) {
+        const auto& functionStats = stats[function];
+        if (functionStats.calls == 0) {
+            continue;
+        }
+
+        out << functions[function] << ": " << functionStats.calls << " calls";
+        if (functionStats.returned > 0) {
+            out << ", avg " << formatDuration(functionStats.total / functionStats.returned)
+                << ", max " << formatDuration(functionStats.max);
+        }
+        out << '\n';
+
+        for (size_t bucket = 0; bucket < functionStats.histogram.size(); ++bucket) {
+            if (functionStats.histogram[bucket] > 0) {
+                out << "  [" << formatDuration(uint64_t{1} << bucket)
+                    << ", " << formatDuration(uint64_t{1} << (bucket + 1)) << "): "
+                    << functionStats.histogram[bucket] << '\n';
+            }
+        }
+    }
+}
+
+} // namespace tinydbg
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tinydbg {
+
+// "12us" with the largest unit keeping the value above zero
+std::string formatDuration(uint64_t ns);
+
+enum class TraceEventKind : uint8_t {
+    Entry,
+    Exit,
+};
+
+// fixed size binary record, decoded only on dump
+struct TraceEvent {
+    uint64_t timestamp; // steady clock, ns
+    uint32_t tid;
+    uint32_t function; // index in CallTracer function table
+    TraceEventKind kind;
+    // rdi, rsi, rdx, rcx, r8, r9 on entry, rax on exit
+    uint64_t args[6];
+};
+
+// ring buffer which overwrites the oldest events when full
+class TraceBuffer {
+public:
+    explicit TraceBuffer(size_t capacity)
+        : events(capacity)
+        , written{0}
+    {
+    }
+
+    void push(const TraceEvent& event)
+    {
+        events[written % events.size()] = event;
+        ++written;
+    }
+
+    size_t size() const { return written < events.size() ? written : events.size(); }
+    uint64_t dropped() const { return written - size(); }
+    // i-th oldest event still in the buffer
+    const TraceEvent& at(size_t i) const { return events[(written - size() + i) % events.size()]; }
+    void clear() { written = 0; }
+
+private:
+    std::vector<TraceEvent> events;
+    uint64_t written;
+};
+
+// Bookkeeping of function entry/exit tracing.
+// Debugger owns the breakpoints, tracer tells which ones are needed.
+class CallTracer {
+public:
+    explicit CallTracer(size_t capacity = 1 << 16)
+        : buffer{capacity}
+    {
+    }
+
+    // address should be offset to process virtual memory
+    void addFunction(uint64_t address, const std::string& name);
+    bool isEntry(uint64_t address) const { return entries.count(address) > 0; }
+    bool isReturn(uint64_t address) const { return returns.count(address) > 0; }
+    bool empty() const { return entries.empty(); }
+    std::vector<uint64_t> entryAddresses() const;
+    std::vector<uint64_t> returnAddresses() const;
+
+    // record entry, returns true if return address needs a new breakpoint
+    bool onEntry(uint64_t address, uint64_t returnAddress, const user_regs_struct& regs, pid_t tid);
+    // record exit, returns return addresses which don't need breakpoints anymore
+    std::vector<uint64_t> onReturn(uint64_t address, const user_regs_struct& regs, pid_t tid);
+
+    // drop pending frames and move entries by delta, used when process is relaunched
+    void rebase(int64_t delta);
+    void clear();
+    void clearEvents() { buffer.clear(); }
+
+    void dump(std::ostream& out, size_t count) const;
+    // call count and latency histogram per function
+    void printStats(std::ostream& out) const;
+
+private:
+    struct Frame {
+        uint64_t returnAddress;
+        // stack pointer value after return
+        uint64_t stackPointer;
+        uint32_t function;
+    };
+
+    std::vector<std::string> functions;
+    std::unordered_map<uint64_t, uint32_t> entries;
+    // number of pending frames using each return breakpoint
+    std::unordered_map<uint64_t, size_t> returns;
+    std::vector<Frame> frames;
+    TraceBuffer buffer;
+};
+
+} // namespace tinydbg
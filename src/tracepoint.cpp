@@ -0,0 +1,315 @@
+#include "tracepoint.h"
+
+#include "memory.h"
+#include "x86.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <stdexcept>
+
+namespace tinydbg {
+
+namespace {
+
+// jmp rel32
+constexpr size_t JUMP_SIZE = 5;
+
+void append(std::vector<uint8_t>& code, std::initializer_list<uint8_t> bytes)
+{
+    code.insert(code.end(), bytes);
+}
+
+void appendValue(std::vector<uint8_t>& code, const void* value, size_t size)
+{
+    const auto* bytes = static_cast<const uint8_t*>(value);
+    code.insert(code.end(), bytes, bytes + size);
+}
+
+std::optional<int32_t> getJumpOffset(uint64_t from, uint64_t to)
+{
+    const auto offset = static_cast<int64_t>(to - from);
+    if (offset < INT32_MIN || offset > INT32_MAX) {
+        return {};
+    }
+    return static_cast<int32_t>(offset);
+}
+
+// Trampoline for a site at address, placed at trampoline:
+//   lea rsp, [rsp - 128]; pushfq; push rax ... r15
+//   mov rbx, rsp; and rsp, -16
+//   mov edi, site; mov rsi, rbx; call [rip + record]
+//   mov rsp, rbx; pop r15 ... rax; popfq; lea rsp, [rsp + 128]
+//   displaced instructions
+//   jmp address + displaced size
+//   record: dq recordFunction
+std::vector<uint8_t> buildTrampoline(uint64_t trampoline, uint32_t site, uint64_t address,
+    const uint8_t* displaced, size_t displacedSize, uint64_t recordFunction)
+{
+    std::vector<uint8_t> code;
+    append(code, {0x48, 0x8d, 0x64, 0x24, 0x80}); // lea rsp, [rsp - 128]
+    append(code, {0x9c}); // pushfq
+    append(code, {0x50, 0x51, 0x52, 0x53, 0x56, 0x57, 0x55}); // push rax, rcx, rdx, rbx, rsi, rdi, rbp
+    for (uint8_t reg = 0; reg < 8; ++reg) {
+        append(code, {0x41, static_cast<uint8_t>(0x50 + reg)}); // push r8 ... r15
+    }
+    append(code, {0x48, 0x89, 0xe3}); // mov rbx, rsp
+    append(code, {0x48, 0x83, 0xe4, 0xf0}); // and rsp, -16
+    append(code, {0xbf}); // mov edi, site
+    appendValue(code, &site, sizeof(site));
+    append(code, {0x48, 0x89, 0xde}); // mov rsi, rbx
+    append(code, {0xff, 0x15}); // call [rip + record]
+    const auto callDisplacementOffset = code.size();
+    append(code, {0, 0, 0, 0});
+    append(code, {0x48, 0x89, 0xdc}); // mov rsp, rbx
+    for (uint8_t reg = 8; reg-- > 0;) {
+        append(code, {0x41, static_cast<uint8_t>(0x58 + reg)}); // pop r15 ... r8
+    }
+    append(code, {0x5d, 0x5f, 0x5e, 0x5b, 0x5a, 0x59, 0x58}); // pop rbp, rdi, rsi, rbx, rdx, rcx, rax
+    append(code, {0x9d}); // popfq
+    append(code, {0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00, 0x00, 0x00}); // lea rsp, [rsp + 128]
+
+    code.insert(code.end(), displaced, displaced + displacedSize);
+
+    const auto back = getJumpOffset(trampoline + code.size() + JUMP_SIZE, address + displacedSize);
+    if (!back) {
+        throw std::runtime_error{"Trampoline area is out of jump range"};
+    }
+    append(code, {0xe9}); // jmp rel32
+    appendValue(code, &*back, sizeof(*back));
+
+    const int32_t recordDisplacement = code.size() - (callDisplacementOffset + sizeof(int32_t));
+    std::memcpy(code.data() + callDisplacementOffset, &recordDisplacement, sizeof(recordDisplacement));
+    appendValue(code, &recordFunction, sizeof(recordFunction));
+    return code;
+}
+
+} // namespace
+
+TracepointAgent::TracepointAgent(pid_t pid)
+    : pid{pid}
+    , header{nullptr}
+    , mappingSize{0}
+    , nextTrampoline{0}
+    , events{1 << 16}
+    , stopping{false}
+{
+    const auto name = agent::getSharedMemoryName(pid);
+    const auto fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        throw std::runtime_error{"Agent isn't loaded, start tinydbg with --agent <libtinydbg-agent.so>"};
+    }
+
+    auto* memory = mmap(nullptr, agent::getSharedMemorySize(agent::RING_CAPACITY),
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        throw std::runtime_error{"Failed to map agent memory"};
+    }
+
+    header = static_cast<agent::Header*>(memory);
+    mappingSize = agent::getSharedMemorySize(agent::RING_CAPACITY);
+    if (header->magic != agent::MAGIC || header->version != agent::VERSION
+        || header->capacity != agent::RING_CAPACITY) {
+        munmap(header, mappingSize);
+        throw std::runtime_error{"Agent isn't initialized or has another version"};
+    }
+    nextTrampoline = header->trampolineArea;
+
+    drainThread = std::thread{&TracepointAgent::drainLoop, this};
+}
+
+TracepointAgent::~TracepointAgent()
+{
+    stopping = true;
+    drainThread.join();
+    munmap(header, mappingSize);
+}
+
+std::optional<size_t> TracepointAgent::getDisplacedSize(const uint8_t* code, size_t size)
+{
+    // whole instructions covering the jump
+    size_t displaced = 0;
+    while (displaced < JUMP_SIZE) {
+        const auto length = getRelocatableLength(code + displaced, size - displaced);
+        if (!length) {
+            return {};
+        }
+        displaced += *length;
+    }
+    return displaced;
+}
+
+void TracepointAgent::addTracepoint(uint64_t address, const std::string& name, const uint8_t* code, size_t size)
+{
+    const auto displaced = getDisplacedSize(code, size);
+    if (!displaced) {
+        throw std::runtime_error{"Instructions at the site use rip relative addressing, branch or aren't known"};
+    }
+    if (nextTrampoline + agent::TRAMPOLINE_SLOT_SIZE > header->trampolineArea + header->trampolineSize) {
+        throw std::runtime_error{"No space left for trampolines"};
+    }
+
+    const auto trampoline = nextTrampoline;
+    const auto site = static_cast<uint32_t>(sites.size());
+    const auto trampolineCode = buildTrampoline(trampoline, site, address, code, *displaced, header->recordFunction);
+    if (trampolineCode.size() > agent::TRAMPOLINE_SLOT_SIZE) {
+        throw std::runtime_error{"Trampoline doesn't fit into its slot"};
+    }
+
+    const auto jump = getJumpOffset(address + JUMP_SIZE, trampoline);
+    if (!jump) {
+        throw std::runtime_error{"Site is out of jump range of the trampoline area"};
+    }
+    // leftover bytes of displaced instructions are never executed unless something jumps there
+    std::vector<uint8_t> patch(*displaced, 0xcc);
+    patch[0] = 0xe9;
+    std::memcpy(patch.data() + 1, &*jump, sizeof(*jump));
+
+    // trampoline has to be complete before the site jumps into it
+    if (!writeMemoryBatch(pid, {{trampoline, trampolineCode.size()}}, trampolineCode.data())
+        || !writeMemoryBatch(pid, {{address, patch.size()}}, patch.data())) {
+        throw std::runtime_error{"Failed to write tracepoint"};
+    }
+
+    nextTrampoline += agent::TRAMPOLINE_SLOT_SIZE;
+    sites.push_back({address, name, {code, code + *displaced}, true});
+    std::lock_guard<std::mutex> lock{mutex};
+    hits.resize(sites.size());
+}
+
+void TracepointAgent::removeTracepoints()
+{
+    for (auto& site : sites) {
+        if (site.active) {
+            writeMemoryBatch(pid, {{site.address, site.original.size()}}, site.original.data());
+            site.active = false;
+        }
+    }
+}
+
+bool TracepointAgent::isInsideSite(uint64_t address) const
+{
+    for (const auto& site : sites) {
+        if (site.active && address > site.address && address < site.address + site.original.size()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::pair<uint64_t, uint8_t>> TracepointAgent::getOriginalBytes() const
+{
+    std::vector<std::pair<uint64_t, uint8_t>> bytes;
+    for (const auto& site : sites) {
+        if (site.active) {
+            for (size_t i = 0; i < site.original.size(); ++i) {
+                bytes.push_back({site.address + i, site.original[i]});
+            }
+        }
+    }
+    return bytes;
+}
+
+void TracepointAgent::removeFromFork(pid_t forkPid) const
+{
+    for (const auto& site : sites) {
+        if (site.active) {
+            writeMemoryBatch(forkPid, {{site.address, site.original.size()}}, site.original.data());
+        }
+    }
+}
+
+void TracepointAgent::drain()
+{
+    const auto capacity = header->capacity;
+    auto* records = agent::getRecords(header);
+    auto tail = header->tail.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock{mutex};
+    while (true) {
+        auto& record = records[tail % capacity];
+        // producer may have claimed the slot but not finished writing it
+        if (record.sequence.load(std::memory_order_acquire) != tail + 1) {
+            break;
+        }
+        const auto& regs = record.regs;
+        events.push({record.timestamp, record.tid, record.site, TraceEventKind::Entry,
+            {regs.rdi, regs.rsi, regs.rdx, regs.rcx, regs.r8, regs.r9}});
+        if (record.site < hits.size()) {
+            ++hits[record.site];
+        }
+        ++tail;
+        header->tail.store(tail, std::memory_order_release);
+    }
+}
+
+void TracepointAgent::drainLoop()
+{
+    while (!stopping) {
+        drain();
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+}
+
+void TracepointAgent::list(std::ostream& out) const
+{
+    for (size_t i = 0; i < sites.size(); ++i) {
+        out << std::dec << i << ": 0x" << std::hex << sites[i].address << ' ' << sites[i].name
+            << (sites[i].active ? "" : " (removed)") << '\n';
+    }
+    out << std::dec;
+}
+
+void TracepointAgent::dump(std::ostream& out, size_t count)
+{
+    drain();
+    std::lock_guard<std::mutex> lock{mutex};
+
+    if (events.dropped() > 0) {
+        out << events.dropped() << " older hits were overwritten\n";
+    }
+    const auto size = events.size();
+    const auto first = count < size ? size - count : 0;
+    const auto start = size > 0 ? events.at(0).timestamp : 0;
+    for (size_t i = first; i < size; ++i) {
+        const auto& event = events.at(i);
+        // timestamps are in TSC ticks
+        out << std::dec << '[' << std::setw(14) << event.timestamp - start << "] " << event.tid << ' '
+            << sites[event.function].name << std::hex << " (0x" << event.args[0];
+        for (size_t arg = 1; arg < 6; ++arg) {
+            out << ", 0x" << event.args[arg];
+        }
+        out << ")\n";
+    }
+    out << std::dec;
+}
+
+void TracepointAgent::printStats(std::ostream& out)
+{
+    drain();
+    std::lock_guard<std::mutex> lock{mutex};
+
+    for (size_t i = 0; i < hits.size(); ++i) {
+        out << sites[i].name << ": " << std::dec << hits[i] << " hits\n";
+    }
+    const auto dropped = header->dropped.load(std::memory_order_relaxed);
+    if (dropped > 0) {
+        out << dropped << " hits were lost, ring was full\n";
+    }
+}
+
+void TracepointAgent::clearEvents()
+{
+    drain();
+    std::lock_guard<std::mutex> lock{mutex};
+    events.clear();
+    std::fill(hits.begin(), hits.end(), 0);
+}
+
+} // namespace tinydbg
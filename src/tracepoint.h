@@ -0,0 +1,83 @@
+#pragma once
+
+#include "agent/protocol.h"
+#include "trace.h"
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tinydbg {
+
+// Fast tracepoints through libtinydbg-agent.so loaded into the inferior.
+// Instructions at a site are moved to a trampoline which records registers into
+// a shared memory ring and jumps back, site starts with a jump to the trampoline.
+// Hits are drained by a background thread, the inferior never stops for them.
+class TracepointAgent {
+public:
+    // throws if the agent isn't loaded into pid
+    explicit TracepointAgent(pid_t pid);
+    ~TracepointAgent();
+
+    TracepointAgent(const TracepointAgent&) = delete;
+    TracepointAgent& operator=(const TracepointAgent&) = delete;
+
+    // number of bytes starting at code which are moved to trampoline,
+    // empty if instructions can't be executed elsewhere
+    static std::optional<size_t> getDisplacedSize(const uint8_t* code, size_t size);
+
+    // address should be offset to process virtual memory, code holds original instructions there,
+    // throws if site can't be patched
+    void addTracepoint(uint64_t address, const std::string& name, const uint8_t* code, size_t size);
+    // put original instructions back, trampolines stay for threads which may be inside them,
+    // other threads should be stopped so none executes a half restored jump
+    void removeTracepoints();
+    // address is inside of instructions replaced by an active site, but not at its start
+    bool isInsideSite(uint64_t address) const;
+    // address and original byte of every byte the active sites replace
+    std::vector<std::pair<uint64_t, uint8_t>> getOriginalBytes() const;
+    // put original instructions back in a fork, which has a copy of the patched memory
+    // and the ring mapping of this process, sites stay here
+    void removeFromFork(pid_t forkPid) const;
+    bool empty() const { return sites.empty(); }
+    void setPid(pid_t newPid) { pid = newPid; }
+
+    void list(std::ostream& out) const;
+    void dump(std::ostream& out, size_t count);
+    void printStats(std::ostream& out);
+    void clearEvents();
+
+private:
+    struct Site {
+        uint64_t address;
+        std::string name;
+        std::vector<uint8_t> original;
+        bool active;
+    };
+
+    void drain();
+    void drainLoop();
+
+    pid_t pid;
+    agent::Header* header;
+    size_t mappingSize;
+    uint64_t nextTrampoline;
+    std::vector<Site> sites;
+
+    // guards events and hits, they're filled by drain thread
+    std::mutex mutex;
+    TraceBuffer events;
+    std::vector<uint64_t> hits;
+    std::atomic<bool> stopping;
+    std::thread drainThread;
+};
+
+} // namespace tinydbg
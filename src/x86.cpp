@@ -0,0 +1,292 @@
+#include "x86.h"
+
+namespace tinydbg {
+
+namespace {
+
+enum class Immediate {
+    None,
+    Byte,
+    // 4 bytes or 2 with operand size prefix
+    Full,
+    // 8 bytes with REX.W, Full otherwise
+    Quad,
+    // enter
+    Enter,
+};
+
+struct Opcode {
+    bool known;
+    bool modrm;
+    Immediate immediate;
+};
+
+constexpr Opcode UNKNOWN{false, false, Immediate::None};
+
+Opcode getOneByteOpcode(uint8_t opcode, uint8_t reg)
+{
+    // add, or, adc, sbb, and, sub, xor, cmp
+    if (opcode < 0x40 && (opcode & 0x7) < 6) {
+        switch (opcode & 0x7) {
+        case 4:
+            return {true, false, Immediate::Byte};
+        case 5:
+            return {true, false, Immediate::Full};
+        default:
+            return {true, true, Immediate::None};
+        }
+    }
+    if (opcode >= 0x50 && opcode <= 0x5f) {
+        return {true, false, Immediate::None};
+    }
+    if (opcode >= 0x90 && opcode <= 0x99) {
+        return {true, false, Immediate::None};
+    }
+    if (opcode >= 0xb0 && opcode <= 0xb7) {
+        return {true, false, Immediate::Byte};
+    }
+    if (opcode >= 0xb8 && opcode <= 0xbf) {
+        return {true, false, Immediate::Quad};
+    }
+    if (opcode >= 0xd8 && opcode <= 0xdf) {
+        return {true, true, Immediate::None};
+    }
+
+    switch (opcode) {
+    case 0x63:
+    case 0x84 ... 0x8b:
+    case 0x8d:
+    case 0x8f:
+    case 0xd0 ... 0xd3:
+    case 0xfe:
+        return {true, true, Immediate::None};
+    case 0x68:
+        return {true, false, Immediate::Full};
+    case 0x69:
+    case 0x81:
+    case 0xc7:
+        return {true, true, Immediate::Full};
+    case 0x6a:
+    case 0xa8:
+        return {true, false, Immediate::Byte};
+    case 0x6b:
+    case 0x80:
+    case 0x83:
+    case 0xc0:
+    case 0xc1:
+    case 0xc6:
+        return {true, true, Immediate::Byte};
+    case 0x9c:
+    case 0x9d:
+    case 0x9e:
+    case 0x9f:
+    case 0xa4 ... 0xa7:
+    case 0xaa ... 0xaf:
+    case 0xc9:
+    case 0xf5:
+    case 0xf8 ... 0xfd:
+        return {true, false, Immediate::None};
+    case 0xa9:
+        return {true, false, Immediate::Full};
+    case 0xc8:
+        return {true, false, Immediate::Enter};
+    case 0xf6:
+        return {true, true, reg < 2 ? Immediate::Byte : Immediate::None};
+    case 0xf7:
+        return {true, true, reg < 2 ? Immediate::Full : Immediate::None};
+    case 0xff:
+        // inc, dec, push, calls and jumps aren't relocatable
+        return reg == 0 || reg == 1 || reg == 6 ? Opcode{true, true, Immediate::None} : UNKNOWN;
+    default:
+        // jumps, calls, returns, int3, moffs moves and the rest
+        return UNKNOWN;
+    }
+}
+
+Opcode getTwoByteOpcode(uint8_t opcode)
+{
+    switch (opcode) {
+    case 0x05: // syscall
+    case 0x31: // rdtsc
+    case 0xa2: // cpuid
+    case 0x77: // emms
+    case 0xc8 ... 0xcf: // bswap
+        return {true, false, Immediate::None};
+    case 0x0d:
+    case 0x10 ... 0x17:
+    case 0x18 ... 0x1f: // hints and nops, endbr64
+    case 0x28 ... 0x2f:
+    case 0x40 ... 0x4f:
+    case 0x50 ... 0x6f:
+    case 0x74 ... 0x76:
+    case 0x7e:
+    case 0x7f:
+    case 0x90 ... 0x9f:
+    case 0xa3:
+    case 0xa5:
+    case 0xab:
+    case 0xad:
+    case 0xae: // fences, ldmxcsr, stmxcsr
+    case 0xaf:
+    case 0xb0 ... 0xb1:
+    case 0xb3:
+    case 0xb6 ... 0xb8:
+    case 0xbb ... 0xbf:
+    case 0xc0 ... 0xc1:
+    case 0xc3:
+    case 0xc7:
+    case 0xd0 ... 0xff:
+        return {true, true, Immediate::None};
+    case 0x70 ... 0x73:
+    case 0xa4:
+    case 0xac:
+    case 0xba:
+    case 0xc2:
+    case 0xc4 ... 0xc6:
+        return {true, true, Immediate::Byte};
+    default:
+        // conditional jumps and system instructions
+        return UNKNOWN;
+    }
+}
+
+size_t getImmediateSize(Immediate immediate, bool operandSizePrefix, bool rexW)
+{
+    switch (immediate) {
+    case Immediate::None:
+        return 0;
+    case Immediate::Byte:
+        return 1;
+    case Immediate::Full:
+        return operandSizePrefix ? 2 : 4;
+    case Immediate::Quad:
+        return rexW ? 8 : (operandSizePrefix ? 2 : 4);
+    case Immediate::Enter:
+        return 3;
+    }
+    return 0;
+}
+
+// modrm, sib and displacement size, empty for rip-relative addressing
+std::optional<size_t> getModrmSize(const uint8_t* modrm, size_t size)
+{
+    if (size < 1) {
+        return {};
+    }
+    const auto mod = *modrm >> 6;
+    const auto rm = *modrm & 0x7;
+    if (mod == 3) {
+        return 1;
+    }
+    if (mod == 0 && rm == 5) {
+        return {};
+    }
+
+    size_t length = 1;
+    if (rm == 4) {
+        if (size < 2) {
+            return {};
+        }
+        ++length;
+        // no base register, disp32 follows
+        if (mod == 0 && (modrm[1] & 0x7) == 5) {
+            length += 4;
+        }
+    }
+    if (mod == 1) {
+        length += 1;
+    } else if (mod == 2) {
+        length += 4;
+    }
+    return length;
+}
+
+} // namespace
+
+std::optional<size_t> getRelocatableLength(const uint8_t* code, size_t size)
+{
+    size_t length = 0;
+    bool operandSizePrefix = false;
+
+    // legacy prefixes
+    while (length < size) {
+        const auto byte = code[length];
+        if (byte == 0x66) {
+            operandSizePrefix = true;
+        } else if (byte != 0x67 && byte != 0xf0 && byte != 0xf2 && byte != 0xf3
+            && byte != 0x2e && byte != 0x36 && byte != 0x3e && byte != 0x26 && byte != 0x64 && byte != 0x65) {
+            break;
+        }
+        ++length;
+    }
+
+    bool rexW = false;
+    if (length < size && (code[length] & 0xf0) == 0x40) {
+        rexW = (code[length] & 0x8) != 0;
+        ++length;
+    }
+    if (length >= size) {
+        return {};
+    }
+
+    Opcode opcode = UNKNOWN;
+    const auto first = code[length++];
+    if (first == 0xc4 || first == 0xc5) {
+        // VEX: opcode map is in the payload, every instruction but vzeroupper/vzeroall has modrm
+        const auto payloadSize = first == 0xc4 ? 2 : 1;
+        if (length + payloadSize >= size) {
+            return {};
+        }
+        const auto map = first == 0xc4 ? code[length] & 0x1f : 1;
+        length += payloadSize;
+        const auto vexOpcode = code[length++];
+        if (map == 1 && vexOpcode == 0x77) {
+            return length;
+        }
+        if (map == 1) {
+            const auto known = getTwoByteOpcode(vexOpcode);
+            opcode = {true, true, known.immediate};
+        } else if (map == 2) {
+            opcode = {true, true, Immediate::None};
+        } else if (map == 3) {
+            opcode = {true, true, Immediate::Byte};
+        }
+    } else if (first == 0x0f) {
+        if (length >= size) {
+            return {};
+        }
+        const auto second = code[length++];
+        if (second == 0x38) {
+            opcode = {true, true, Immediate::None};
+            ++length;
+        } else if (second == 0x3a) {
+            opcode = {true, true, Immediate::Byte};
+            ++length;
+        } else {
+            opcode = getTwoByteOpcode(second);
+        }
+    } else {
+        const auto reg = length < size ? (code[length] >> 3) & 0x7 : 0;
+        opcode = getOneByteOpcode(first, reg);
+    }
+
+    if (!opcode.known || length > size) {
+        return {};
+    }
+
+    if (opcode.modrm) {
+        const auto modrmSize = getModrmSize(code + length, size - length);
+        if (!modrmSize) {
+            return {};
+        }
+        length += *modrmSize;
+    }
+    length += getImmediateSize(opcode.immediate, operandSizePrefix, rexW);
+
+    if (length > size) {
+        return {};
+    }
+    return length;
+}
+
+} // namespace tinydbg
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace tinydbg {
+
+// Length of x86-64 instruction at code if it can be executed at another address unchanged,
+// i.e. doesn't address memory relative to rip and doesn't transfer control.
+// Only common general purpose, x87, SSE and VEX encoded instructions are known,
+// everything else is reported as not relocatable.
+std::optional<size_t> getRelocatableLength(const uint8_t* code, size_t size);
+
+} // namespace tinydbg